@@ -0,0 +1,40 @@
+#! /bin/bash
+
+# MACH1 m1-transcode testing
+#
+# Checks that `-segments N` writes the same bytes as the serial path.
+#
+# USAGE:
+# - ./scripts/_test_segments.sh <m1-transcode> <M1Spatial-8 wav> [segments]
+#   e.g. ./scripts/_test_segments.sh _builds/m1-transcode ~/Desktop/Mach1-TestFiles/m1-debug-shrtpt-m1spatial.wav 4
+#
+
+M1TRANSCODE=${1:?path to m1-transcode}
+INPUT=${2:?M1Spatial-8 input wav}
+SEGMENTS=${3:-4}
+OUTDIR=$(mktemp -d)
+trap 'rm -rf "$OUTDIR"' EXIT
+
+FAILED=0
+check() {
+	local name=$1
+	shift
+	"$M1TRANSCODE" -in-file "$INPUT" -in-fmt M1Spatial-8 -out-file "$OUTDIR/$name-serial.wav" "$@" > /dev/null || { echo "FAIL $name: serial run"; FAILED=1; return; }
+	"$M1TRANSCODE" -in-file "$INPUT" -in-fmt M1Spatial-8 -out-file "$OUTDIR/$name-segments.wav" -segments $SEGMENTS "$@" > /dev/null || { echo "FAIL $name: segmented run"; FAILED=1; return; }
+	if cmp -s "$OUTDIR/$name-serial.wav" "$OUTDIR/$name-segments.wav"; then
+		echo "ok   $name"
+	else
+		echo "FAIL $name: segmented output differs from serial"
+		FAILED=1
+	fi
+}
+
+check 714 -out-fmt 7.1.4_C -out-file-chans 0
+check 514 -out-fmt 5.1.4_C -out-file-chans 0
+check acn -out-fmt ACNSN3D -out-file-chans 0
+check horizon -out-fmt M1Horizon -out-file-chans 0
+check normalize -out-fmt 7.1.4_C -out-file-chans 0 -normalize
+# falls back to the serial path, so it has to match too
+check lfe-sub -out-fmt 5.1_C -out-file-chans 0 -lfe-sub 3
+
+exit $FAILED
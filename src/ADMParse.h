@@ -4,69 +4,120 @@
 #ifndef ADMParse_h
 #define ADMParse_h
 
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
 class ADMParse
 {
 public:
     
     struct metadataLocators{
-        std::string::size_type mdStartIndex, mdEndIndex, totalFileSize;
+        std::string::size_type mdStartIndex = 0, mdEndIndex = 0, totalFileSize = 0;
+    };
+    
+    // payload of one chunk, size 0 when the file doesn't have it
+    struct chunkLocator{
+        uint64_t offset = 0, size = 0;
+        bool found() const { return size > 0; }
+    };
+    
+    struct chunkIndex{
+        chunkLocator fmt, data, axml, chna, bext, ixml;
+        uint64_t totalFileSize = 0;
+        bool valid = false; // a RIFF, RF64 or BW64 WAVE header was found
     };
     
     /*
-     locateMetadata(char* inFile)
-     Expects a complete path to a binary file and parses it for XML data
-     Upon finding any matches it returns the starting/ending index locations
-     of the metadata as well as the total file size for convenience
-     
-     TODO: make the end index a smarter search (xml end tags)
+     indexChunks(char* inFile)
+     Walks the chunk headers of a RIFF/RF64/BW64 file and returns where the
+     payload of its fmt, data, axml, chna, bext and iXML chunks are. Only the
+     8 byte headers (and the ds64 chunk of RF64/BW64 files, which carries
+     the 64 bit sizes) are read, the file is skipped through by seeking.
      */
-    metadataLocators locateMetadata(char* inFile)
+    chunkIndex indexChunks(const char* inFile)
     {
-        metadataLocators locators;
-        const char* filename = inFile;
-        const char* start_search_term = "<?xml version=";
-        size_t search_term_size = strlen(start_search_term);
-        std::string::size_type offset, found_at, md_remainder;
+        chunkIndex index;
+        std::ifstream file(inFile, std::ios::binary);
+        if (!file) return index;
+        file.seekg(0, std::ios::end);
+        index.totalFileSize = (uint64_t)file.tellg();
+        file.seekg(0, std::ios::beg);
         
-        std::ifstream file(filename, std::ios::binary);
-        if (file)
-        {
-            file.seekg(0, std::ios::end);
-            size_t file_size = file.tellg();
-            file.seekg(0, std::ios::beg);
-            locators.totalFileSize = file_size;
-            std::string file_content;
-            
-            file_content.reserve(file_size);
-            char buffer[16384];
-            std::streamsize chars_read;
-            
-            while (file.read(buffer, sizeof buffer), chars_read = file.gcount())
-                file_content.append(buffer, chars_read);
+        char header[12];
+        if (!file.read(header, sizeof header) || memcmp(header + 8, "WAVE", 4) != 0) return index;
+        bool riff = memcmp(header, "RIFF", 4) == 0;
+        if (!riff && memcmp(header, "RF64", 4) != 0 && memcmp(header, "BW64", 4) != 0) return index;
+        index.valid = true;
+        
+        // RF64/BW64 chunks over 4GB carry 0xFFFFFFFF and have their size in ds64
+        uint64_t ds64DataSize = 0;
+        std::string ds64Table;
+        uint64_t position = sizeof header;
+        while (position + 8 <= index.totalFileSize) {
+            char chunkHeader[8];
+            file.seekg(position, std::ios::beg);
+            if (!file.read(chunkHeader, sizeof chunkHeader)) break;
+            uint64_t size = readLE(chunkHeader + 4, 4);
+            uint64_t offset = position + 8;
             
-            if (file.eof())
-            {
-                for (offset = 0; file_size > offset && (found_at = file_content.find(start_search_term, offset)) != std::string::npos; offset = found_at + search_term_size)
-                {
-                    offset = found_at + search_term_size;
-                    md_remainder = file_size-offset;
-                    locators.mdStartIndex = file_size-md_remainder-search_term_size;
-                    
-                    //TODO: convert to string, search last use of "</", regex the rest of term to ">",
-                    locators.mdEndIndex = file_size;
-                    //std::cout << "\n" << "Found Match at Char Index: " << found_at << "\n" << "Line: " << (found_at/24)+1 << " | Char: " << found_at%24 << "\n";
+            if (!riff && memcmp(chunkHeader, "ds64", 4) == 0 && size >= 28) {
+                std::string ds64((size_t)size, '\0');
+                if (!file.read(&ds64[0], size)) break;
+                ds64DataSize = readLE(&ds64[8], 8);
+                uint64_t tableLength = readLE(&ds64[24], 4);
+                if (28 + tableLength * 12 <= size) ds64Table = ds64.substr(28, (size_t)(tableLength * 12));
+            } else if (!riff && size == 0xFFFFFFFF) {
+                size = memcmp(chunkHeader, "data", 4) == 0 ? ds64DataSize : 0;
+                for (size_t entry = 0; entry + 12 <= ds64Table.size(); entry += 12) {
+                    if (memcmp(&ds64Table[entry], chunkHeader, 4) == 0) size = readLE(&ds64Table[entry + 4], 8);
                 }
             }
+            // a truncated last chunk still counts up to the end of the file
+            if (offset + size > index.totalFileSize) size = index.totalFileSize - offset;
+            
+            chunkLocator locator;
+            locator.offset = offset;
+            locator.size = size;
+            if (memcmp(chunkHeader, "fmt ", 4) == 0) index.fmt = locator;
+            else if (memcmp(chunkHeader, "data", 4) == 0) index.data = locator;
+            else if (memcmp(chunkHeader, "axml", 4) == 0) index.axml = locator;
+            else if (memcmp(chunkHeader, "chna", 4) == 0) index.chna = locator;
+            else if (memcmp(chunkHeader, "bext", 4) == 0) index.bext = locator;
+            else if (memcmp(chunkHeader, "iXML", 4) == 0) index.ixml = locator;
+            
+            position = offset + size + (size & 1); // chunks are word aligned
+        }
+        return index;
+    }
+    
+    /*
+     locateMetadata(char* inFile)
+     Expects a complete path to a RIFF/RF64/BW64 file and finds its XML
+     metadata through the chunk index: the axml chunk, or the iXML chunk
+     when there is no axml. Returns the starting/ending index locations
+     of the metadata as well as the total file size for convenience, the
+     start is 0 when there is none.
+     */
+    metadataLocators locateMetadata(char* inFile)
+    {
+        metadataLocators locators;
+        chunkIndex index = indexChunks(inFile);
+        locators.totalFileSize = (std::string::size_type)index.totalFileSize;
+        const chunkLocator& metadata = index.axml.found() ? index.axml : index.ixml;
+        if (metadata.found()) {
+            locators.mdStartIndex = (std::string::size_type)metadata.offset;
+            locators.mdEndIndex = (std::string::size_type)(metadata.offset + metadata.size);
         }
-        file.close();
         return locators;
     }
     
     /*
      exportMetadata(inputPath, outputPath, metadataStartingIndex, metadataEndingIndex, totalAudioFileSize)
-     Parses metadata and exports it to a new file with .txt appended
-     
-     TODO: make endIndex = filesize for safety
+     Exports the metadata between the indices to a new file with .txt appended,
+     only those bytes are read
      */
     void exportMetadata(char* inFile, char* outPath, std::string::size_type mdStartIndex, std::string::size_type mdEndIndex, std::string::size_type fileSize)
     {
@@ -75,12 +126,12 @@ public:
         std::ofstream mdOutFile(outPath, std::ios::binary);
         if (file)
         {
-            file.seekg(mdStartIndex, std::ios::beg); // seek to end of file where matched xml tag starts
-            size_t file_size = fileSize-mdStartIndex;
+            file.seekg(mdStartIndex, std::ios::beg); // seek to where the metadata chunk starts
+            size_t file_size = (mdEndIndex > mdStartIndex && mdEndIndex <= fileSize ? mdEndIndex : fileSize) - mdStartIndex;
             //TODO: regex out and rename file
-            char* F = new char[file_size];
+            char* F = new char[file_size + 1];
             file.read(F, file_size);
-            F[file_size] = 0; //write end byte
+            F[file.gcount()] = 0; //write end byte
             mdOutFile << F << std::endl;
             printXMLInfo(F);
 			delete[] F;
@@ -90,9 +141,8 @@ public:
     
     /*
      exportMetadata(inputPath, outputPath, metadataStartingIndex, metadataEndingIndex, totalAudioFileSize)
-     Parses metadata and exports it to a new file with .txt appended
-     
-     TODO: make endIndex = filesize for safety
+     Exports the metadata between the indices to a new file with .txt appended,
+     only those bytes are read
      */
     void exportMetadata(std::string inFile, std::string outPath, std::string::size_type mdStartIndex, std::string::size_type mdEndIndex, std::string::size_type fileSize)
     {
@@ -101,12 +151,12 @@ public:
         std::ofstream mdOutFile(outPath, std::ios::binary);
         if (file)
         {
-            file.seekg(mdStartIndex, std::ios::beg); // seek to end of file where matched xml tag starts
-            size_t file_size = fileSize-mdStartIndex;
+            file.seekg(mdStartIndex, std::ios::beg); // seek to where the metadata chunk starts
+            size_t file_size = (mdEndIndex > mdStartIndex && mdEndIndex <= fileSize ? mdEndIndex : fileSize) - mdStartIndex;
             //TODO: regex out and rename file
-			char* F = new char[file_size];
-			file.read(F, file_size);
-            F[file_size] = 0; //write end byte
+            char* F = new char[file_size + 1];
+            file.read(F, file_size);
+            F[file.gcount()] = 0; //write end byte
             mdOutFile << F << std::endl;
             printXMLInfo(F);
 			delete[] F;
@@ -114,6 +164,14 @@ public:
         }
     }
     
+    // little endian integer of `bytes` bytes
+    static uint64_t readLE(const char* data, int bytes)
+    {
+        uint64_t value = 0;
+        for (int i = bytes - 1; i >= 0; i--) value = (value << 8) | (unsigned char)data[i];
+        return value;
+    }
+    
     void printXMLInfo(char* data)
     {
         //TODO: parse datascheme
@@ -0,0 +1,109 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef AdmTrackMap_h
+#define AdmTrackMap_h
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bw64/bw64.hpp"
+#include "pugixml.hpp"
+
+/*
+ AdmTrackMap
+ Which tracks of a BW64 file carry each ADM audioObject. The `axml`
+ chunk lists the audioTrackUIDRefs of every audioObject and the `chna`
+ chunk gives the track of every audioTrackUID, so a multichannel ADM file
+ can be transcoded directly instead of being split into one WAV per
+ object first.
+
+ Objects are keyed by audioObjectID and kept in document order; names
+ are not unique, so a name is looked up together with how many objects of
+ that name came before it.
+ */
+class AdmTrackMap
+{
+public:
+    struct Object {
+        std::string id;
+        std::string name;
+        std::vector<int> tracks; // 0 based, -1 for a UID chna doesn't list
+    };
+
+private:
+    std::map<std::string, Object> objectsById;
+    std::vector<std::string> order; // audioObjectIDs in document order
+
+    // element name without a namespace prefix
+    static const char* localName(const pugi::xml_node& node)
+    {
+        const char* name = node.name();
+        const char* colon = strrchr(name, ':');
+        return colon ? colon + 1 : name;
+    }
+
+    void collectObjects(const pugi::xml_node& node, const std::map<std::string, int>& trackOfUid)
+    {
+        for (pugi::xml_node child = node.first_child(); child; child = child.next_sibling()) {
+            if (child.type() != pugi::node_element) continue;
+            if (strcmp(localName(child), "audioObject") != 0) {
+                collectObjects(child, trackOfUid);
+                continue;
+            }
+            std::string id = child.attribute("audioObjectID").value();
+            if (objectsById.count(id)) continue; // the first definition of an ID wins
+            Object& object = objectsById[id];
+            object.id = id;
+            object.name = child.attribute("audioObjectName").value();
+            for (pugi::xml_node ref = child.first_child(); ref; ref = ref.next_sibling()) {
+                if (ref.type() != pugi::node_element || strcmp(localName(ref), "audioTrackUIDRef") != 0) continue;
+                std::map<std::string, int>::const_iterator track = trackOfUid.find(ref.child_value());
+                object.tracks.push_back(track != trackOfUid.end() ? track->second : -1);
+            }
+            order.push_back(id);
+        }
+    }
+
+public:
+    /*
+     build(chna, axml)
+     Returns false when the axml can't be parsed or names no objects.
+     */
+    bool build(const bw64::ChnaChunk& chna, const std::string& axml)
+    {
+        objectsById.clear();
+        order.clear();
+        std::map<std::string, int> trackOfUid;
+        std::vector<bw64::AudioId> audioIds = chna.audioIds();
+        for (size_t i = 0; i < audioIds.size(); i++) {
+            // chna track indices start at 1
+            trackOfUid[audioIds[i].uid()] = (int)audioIds[i].trackIndex() - 1;
+        }
+
+        pugi::xml_document document;
+        if (!document.load_string(axml.c_str())) return false;
+        collectObjects(document, trackOfUid);
+        return !order.empty();
+    }
+
+    int getNumObjects() const { return (int)order.size(); }
+
+    /*
+     find(name, occurrence)
+     The `occurrence`th (0 based) audioObject called `name` in document
+     order, nullptr when there are fewer.
+     */
+    const Object* find(const std::string& name, int occurrence) const
+    {
+        for (size_t i = 0; i < order.size(); i++) {
+            const Object& object = objectsById.find(order[i])->second;
+            if (object.name == name && occurrence-- == 0) return &object;
+        }
+        return nullptr;
+    }
+};
+
+#endif /* AdmTrackMap_h */
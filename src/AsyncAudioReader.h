@@ -0,0 +1,190 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef AsyncAudioReader_h
+#define AsyncAudioReader_h
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "AsyncFileIO.h"
+#include "MappedAudioReader.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ AsyncAudioReader
+ Read-ahead input backend for WAV/RF64/BW64 files on an AsyncFileIO
+ queue. The `data` chunk is split into buffer sized pieces and the next
+ few pieces are always in flight, so the transcoder converts from memory
+ while the disk works ahead instead of taking page faults or small
+ blocking reads.
+
+ The layout (data offset, frames, sample type) comes from a
+ MappedAudioReader that parsed the file; samples are converted with the
+ same loops.
+ */
+class AsyncAudioReader
+{
+    AsyncFileIO* io = nullptr;
+    int fd = -1;
+    int firstBuffer = 0;
+    int numBuffers = 0;
+
+    uint64_t dataOffset = 0;
+    uint64_t numFrames = 0;
+    uint64_t position = 0;       // in frames
+    uint64_t framesPerBuffer = 0;
+    uint64_t nextPiece = 0;      // next piece to submit
+    uint64_t readyPiece = 0;     // piece waited for, valid with `ready`
+    bool ready = false;
+
+    int numChannels = 0;
+    int sampleRate = 0;
+    int blockAlign = 0;
+    MappedAudioReader::SampleType sampleType = MappedAudioReader::SAMPLE_PCM_16;
+
+    uint64_t numPieces() const
+    {
+        return (numFrames + framesPerBuffer - 1) / framesPerBuffer;
+    }
+
+    uint64_t pieceFrames(uint64_t piece) const
+    {
+        uint64_t first = piece * framesPerBuffer;
+        return (std::min)(framesPerBuffer, numFrames - first);
+    }
+
+    // keeps every buffer busy with the pieces after the one being read
+    void submitAhead(uint64_t piece)
+    {
+        while (nextPiece < numPieces() && nextPiece < piece + (uint64_t)numBuffers) {
+            io->submitRead(firstBuffer + (int)(nextPiece % numBuffers), fd, dataOffset + nextPiece * framesPerBuffer * blockAlign, (size_t)(pieceFrames(nextPiece) * blockAlign));
+            nextPiece++;
+        }
+        io->flush();
+    }
+
+    void cancel()
+    {
+        for (int i = 0; i < numBuffers; i++) io->wait(firstBuffer + i);
+        ready = false;
+    }
+
+public:
+    AsyncAudioReader() {}
+    ~AsyncAudioReader() { close(); }
+
+    AsyncAudioReader(const AsyncAudioReader&) = delete;
+    AsyncAudioReader& operator=(const AsyncAudioReader&) = delete;
+
+    /*
+     open(path, layout, io, numBuffers)
+     Opens `path`, parsed before by `layout`, and starts reading ahead on
+     `numBuffers` (2 or more) of the queue's buffers.
+     */
+    bool open(const std::string& path, const MappedAudioReader& layout, AsyncFileIO& queue, int buffers)
+    {
+        close();
+#ifdef _WIN32
+        (void)path; (void)layout; (void)queue; (void)buffers;
+        return false;
+#else
+        if (!layout.isOpened() || buffers < 2) return false;
+        if (queue.getBufferBytes() < (size_t)layout.getBlockAlign()) return false;
+        firstBuffer = queue.reserveBuffers(buffers);
+        if (firstBuffer < 0) return false;
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+#if defined(__linux__)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        io = &queue;
+        numBuffers = buffers;
+        dataOffset = layout.getDataOffset();
+        numFrames = layout.frames();
+        numChannels = layout.channels();
+        sampleRate = layout.samplerate();
+        blockAlign = layout.getBlockAlign();
+        sampleType = layout.getSampleType();
+        framesPerBuffer = queue.getBufferBytes() / blockAlign;
+        seek(0);
+        return true;
+#endif
+    }
+
+    void close()
+    {
+        if (io) cancel();
+#ifndef _WIN32
+        if (fd >= 0) ::close(fd);
+#endif
+        fd = -1;
+        io = nullptr;
+        numFrames = 0;
+        position = 0;
+    }
+
+    bool isOpened() const { return fd >= 0; }
+    int channels() const { return numChannels; }
+    int samplerate() const { return sampleRate; }
+    uint64_t frames() const { return numFrames; }
+
+    /*
+     seek(frame)
+     Drops what was read ahead and starts again at `frame`.
+     */
+    void seek(uint64_t frame)
+    {
+        if (!io) return;
+        cancel();
+        position = frame < numFrames ? frame : numFrames;
+        nextPiece = position / framesPerBuffer;
+        submitAhead(nextPiece);
+    }
+
+    /*
+     readPlanar(planes, offset, frames)
+     Converts up to `frames` frames from the current position into
+     planes[channel][offset + n] and advances. Returns the frames read,
+     a failed read throws.
+     */
+    int readPlanar(float** planes, int offset, int frames)
+    {
+        if (!io) return 0;
+        uint64_t available = numFrames - position;
+        if ((uint64_t)frames > available) frames = (int)available;
+        int done = 0;
+        while (done < frames) {
+            uint64_t piece = position / framesPerBuffer;
+            int buffer = firstBuffer + (int)(piece % numBuffers);
+            if (!ready || readyPiece != piece) {
+                long result = io->wait(buffer);
+                if (result < 0 || (uint64_t)result != pieceFrames(piece) * blockAlign) {
+                    throw std::runtime_error("reading in-file");
+                }
+                readyPiece = piece;
+                ready = true;
+            }
+            uint64_t inPiece = position - piece * framesPerBuffer;
+            int n = (int)(std::min)((uint64_t)(frames - done), pieceFrames(piece) - inPiece);
+            MappedAudioReader::convertPlanar(io->buffer(buffer) + inPiece * blockAlign, sampleType, numChannels, blockAlign, planes, offset + done, n);
+            position += n;
+            done += n;
+            if (position == piece * framesPerBuffer + pieceFrames(piece)) {
+                // the buffer is free for the piece `numBuffers` ahead
+                ready = false;
+                submitAhead(piece + 1);
+            }
+        }
+        return done;
+    }
+};
+
+#endif /* AsyncAudioReader_h */
@@ -0,0 +1,564 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef AsyncFileIO_h
+#define AsyncFileIO_h
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define M1_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+/*
+ AsyncFileIO
+ Queue of large positional reads and writes over a fixed set of aligned
+ buffers. Callers reserve buffers, fill or drain them and submit them with
+ a file descriptor and offset; the transfer runs in the background until
+ wait() is called for that buffer.
+
+ On Linux the requests go through io_uring, the buffers are registered
+ with the ring when RLIMIT_MEMLOCK allows it and everything queued between
+ two flush() calls goes to the kernel with a single system call. Where
+ io_uring isn't available (older kernels, seccomp profiles) a few worker
+ threads run pread()/pwrite() instead. The sync backend transfers each
+ request on submit, which still batches small writes into big ones.
+
+ One instance is driven by one thread at a time.
+ */
+class AsyncFileIO
+{
+public:
+    enum Backend {
+        BACKEND_SYNC,     // requests run to completion on submit
+        BACKEND_IO_URING,
+        BACKEND_THREADS
+    };
+
+    static const size_t DEFAULT_BUFFER_BYTES = 1 << 20;
+    static const size_t ALIGNMENT = 4096; // page and O_DIRECT alignment
+    static const int MAX_WORKERS = 8;
+
+private:
+    enum State {
+        STATE_IDLE,
+        STATE_PENDING,
+        STATE_DONE
+    };
+
+    struct Request {
+        unsigned char* buffer = nullptr;
+        int fd = -1;
+        bool write = false;
+        uint64_t offset = 0;
+        size_t bytes = 0;    // requested
+        size_t done = 0;     // transferred so far
+        long result = 0;     // bytes transferred or -errno
+        State state = STATE_IDLE;
+    };
+
+    Backend backend = BACKEND_SYNC;
+    size_t bufferBytes = 0;
+    std::vector<Request> requests;
+    int reserved = 0;
+
+    // thread backend
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;     // queued requests or stopping
+    std::condition_variable finished; // a request completed
+    std::deque<int> queue;
+    bool stopping = false;
+
+#ifdef M1_HAVE_IO_URING
+    int ringFd = -1;
+    void* sqMap = nullptr;
+    size_t sqMapBytes = 0;
+    void* cqMap = nullptr;
+    size_t cqMapBytes = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesBytes = 0;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    std::vector<struct iovec> iovecs;
+    unsigned toSubmit = 0;
+    bool registered = false;
+#endif
+
+    static unsigned char* allocateBuffer(size_t bytes)
+    {
+        void* ptr = nullptr;
+#ifdef _WIN32
+        ptr = _aligned_malloc(bytes, ALIGNMENT);
+#else
+        if (posix_memalign(&ptr, ALIGNMENT, bytes) != 0) ptr = nullptr;
+#endif
+        return (unsigned char*)ptr;
+    }
+
+    static void freeBuffer(unsigned char* ptr)
+    {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    // blocking transfer of a whole request, used by the worker threads
+    static long transfer(const Request& r)
+    {
+#ifdef _WIN32
+        (void)r;
+        return -EIO;
+#else
+        size_t done = 0;
+        while (done < r.bytes) {
+            ssize_t n = r.write
+                ? pwrite(r.fd, r.buffer + done, r.bytes - done, (off_t)(r.offset + done))
+                : pread(r.fd, r.buffer + done, r.bytes - done, (off_t)(r.offset + done));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return -errno;
+            if (n == 0) break; // end of file
+            done += (size_t)n;
+        }
+        return (long)done;
+#endif
+    }
+
+    void workerLoop()
+    {
+        for (;;) {
+            int index;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                index = queue.front();
+                queue.pop_front();
+            }
+            // the request is left alone by its owner while it's pending
+            long result = transfer(requests[index]);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                requests[index].result = result;
+                requests[index].state = STATE_DONE;
+            }
+            finished.notify_all();
+        }
+    }
+
+#ifdef M1_HAVE_IO_URING
+    bool setupRing(unsigned entries)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0) return false;
+        ringFd = fd;
+
+        sqMapBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqMapBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+        singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#endif
+        if (singleMap) sqMapBytes = cqMapBytes = (std::max)(sqMapBytes, cqMapBytes);
+
+        sqMap = mmap(nullptr, sqMapBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqMap == MAP_FAILED) {
+            sqMap = nullptr;
+            closeRing();
+            return false;
+        }
+        if (singleMap) {
+            cqMap = sqMap;
+        } else {
+            cqMap = mmap(nullptr, cqMapBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cqMap == MAP_FAILED) {
+                cqMap = nullptr;
+                closeRing();
+                return false;
+            }
+        }
+        sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqesMap = mmap(nullptr, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqesMap == MAP_FAILED) {
+            closeRing();
+            return false;
+        }
+        sqes = (io_uring_sqe*)sqesMap;
+
+        unsigned char* sq = (unsigned char*)sqMap;
+        unsigned char* cq = (unsigned char*)cqMap;
+        sqTail = (unsigned*)(sq + params.sq_off.tail);
+        sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + params.sq_off.array);
+        cqHead = (unsigned*)(cq + params.cq_off.head);
+        cqTail = (unsigned*)(cq + params.cq_off.tail);
+        cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+        // pinned buffers save the kernel mapping them on every request,
+        // without enough RLIMIT_MEMLOCK the plain vectored ops are used
+        iovecs.resize(requests.size());
+        for (size_t i = 0; i < requests.size(); i++) {
+            iovecs[i].iov_base = requests[i].buffer;
+            iovecs[i].iov_len = bufferBytes;
+        }
+        registered = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iovecs.data(), (unsigned)iovecs.size()) == 0;
+        return true;
+    }
+
+    void closeRing()
+    {
+        if (sqes) munmap(sqes, sqesBytes);
+        if (cqMap && cqMap != sqMap) munmap(cqMap, cqMapBytes);
+        if (sqMap) munmap(sqMap, sqMapBytes);
+        if (ringFd >= 0) ::close(ringFd);
+        sqes = nullptr;
+        sqMap = cqMap = nullptr;
+        ringFd = -1;
+        toSubmit = 0;
+        registered = false;
+    }
+
+    // queues the rest of a request on the submission ring
+    void pushRequest(int index)
+    {
+        Request& r = requests[index];
+        unsigned tail = *sqTail;
+        unsigned slot = tail & *sqMask;
+        io_uring_sqe* sqe = &sqes[slot];
+        memset(sqe, 0, sizeof(*sqe));
+        size_t remaining = r.bytes - r.done;
+        if (registered) {
+            sqe->opcode = r.write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->addr = (uint64_t)(uintptr_t)(r.buffer + r.done);
+            sqe->len = (uint32_t)remaining;
+            sqe->buf_index = (uint16_t)index;
+        } else {
+            iovecs[index].iov_base = r.buffer + r.done;
+            iovecs[index].iov_len = remaining;
+            sqe->opcode = r.write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->addr = (uint64_t)(uintptr_t)&iovecs[index];
+            sqe->len = 1;
+        }
+        sqe->fd = r.fd;
+        sqe->off = r.offset + r.done;
+        sqe->user_data = (uint64_t)index;
+        sqArray[slot] = slot;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        toSubmit++;
+    }
+
+    // submits what's queued, optionally waiting for a completion
+    bool enter(unsigned minComplete)
+    {
+        for (;;) {
+            unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+            long submitted = syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0);
+            if (submitted >= 0) {
+                toSubmit -= (unsigned)(std::min)((long)toSubmit, submitted);
+                return true;
+            }
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN || errno == EBUSY) && reap() > 0) continue;
+            return false;
+        }
+    }
+
+    // collects completions, resubmitting short transfers
+    int reap()
+    {
+        int completed = 0;
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            const io_uring_cqe& cqe = cqes[head & *cqMask];
+            int index = (int)cqe.user_data;
+            int res = cqe.res;
+            head++;
+            Request& r = requests[index];
+            if (res == -EINTR || res == -EAGAIN) {
+                pushRequest(index);
+            } else if (res < 0) {
+                r.result = res;
+                r.state = STATE_DONE;
+            } else if (res > 0 && r.done + (size_t)res < r.bytes) {
+                r.done += (size_t)res;
+                pushRequest(index);
+            } else {
+                r.done += (size_t)res;
+                r.result = (long)r.done;
+                r.state = STATE_DONE;
+            }
+            completed++;
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return completed;
+    }
+
+    // the ring broke down, nothing pending will complete any more
+    void failPending(int error)
+    {
+        for (size_t i = 0; i < requests.size(); i++) {
+            if (requests[i].state == STATE_PENDING) {
+                requests[i].result = -error;
+                requests[i].state = STATE_DONE;
+            }
+        }
+    }
+#endif
+
+    void submit(int index, int fd, uint64_t offset, size_t bytes, bool write)
+    {
+        Request& r = requests[index];
+        r.fd = fd;
+        r.offset = offset;
+        r.bytes = (std::min)(bytes, bufferBytes);
+        r.done = 0;
+        r.result = 0;
+        r.write = write;
+        if (backend == BACKEND_SYNC) {
+            r.result = transfer(r);
+            r.state = STATE_DONE;
+            return;
+        }
+#ifdef M1_HAVE_IO_URING
+        if (backend == BACKEND_IO_URING) {
+            r.state = STATE_PENDING;
+            pushRequest(index);
+            return;
+        }
+#endif
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            r.state = STATE_PENDING;
+            queue.push_back(index);
+        }
+        wake.notify_one();
+    }
+
+public:
+    AsyncFileIO() {}
+    ~AsyncFileIO() { close(); }
+
+    AsyncFileIO(const AsyncFileIO&) = delete;
+    AsyncFileIO& operator=(const AsyncFileIO&) = delete;
+
+    static const char* backendName(Backend backend)
+    {
+        switch (backend) {
+            case BACKEND_IO_URING: return "io_uring";
+            case BACKEND_THREADS: return "threads";
+            default: return "sync";
+        }
+    }
+
+    /*
+     parseBackend(name, backend)
+     sync, uring (falls back to threads where unavailable) or threads.
+     */
+    static bool parseBackend(const std::string& name, Backend& backend)
+    {
+        if (name == "sync") backend = BACKEND_SYNC;
+        else if (name == "uring" || name == "io_uring") backend = BACKEND_IO_URING;
+        else if (name == "threads") backend = BACKEND_THREADS;
+        else return false;
+        return true;
+    }
+
+    /*
+     setup(backend, numBuffers, bytesPerBuffer)
+     Allocates the buffers and starts the backend, io_uring falls back to
+     threads. Returns false where positional I/O isn't available (Windows),
+     callers then keep their libsndfile path.
+     */
+    bool setup(Backend wanted, int numBuffers, size_t bytesPerBuffer = DEFAULT_BUFFER_BYTES)
+    {
+        close();
+#ifdef _WIN32
+        (void)wanted; (void)numBuffers; (void)bytesPerBuffer;
+        return false;
+#else
+        if (numBuffers <= 0) return false;
+        bufferBytes = (bytesPerBuffer + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        requests.resize(numBuffers);
+        for (int i = 0; i < numBuffers; i++) {
+            requests[i].buffer = allocateBuffer(bufferBytes);
+            if (!requests[i].buffer) {
+                close();
+                return false;
+            }
+        }
+
+#ifdef M1_HAVE_IO_URING
+        if (wanted == BACKEND_IO_URING && setupRing((unsigned)numBuffers)) {
+            backend = BACKEND_IO_URING;
+            return true;
+        }
+#endif
+        if (wanted == BACKEND_SYNC) {
+            backend = BACKEND_SYNC;
+            return true;
+        }
+        backend = BACKEND_THREADS;
+        stopping = false;
+        int numWorkers = numBuffers < MAX_WORKERS ? numBuffers : MAX_WORKERS;
+        for (int i = 0; i < numWorkers; i++) {
+            workers.emplace_back(&AsyncFileIO::workerLoop, this);
+        }
+        return true;
+#endif
+    }
+
+    /*
+     close()
+     Waits for everything in flight, then releases the buffers.
+     */
+    void close()
+    {
+        for (size_t i = 0; i < requests.size(); i++) {
+            wait((int)i);
+        }
+        if (!workers.empty()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+            workers.clear();
+        }
+#ifdef M1_HAVE_IO_URING
+        closeRing();
+#endif
+        for (size_t i = 0; i < requests.size(); i++) {
+            if (requests[i].buffer) freeBuffer(requests[i].buffer);
+        }
+        requests.clear();
+        reserved = 0;
+        backend = BACKEND_SYNC;
+    }
+
+    Backend getBackend() const { return backend; }
+    size_t getBufferBytes() const { return bufferBytes; }
+    int getNumBuffers() const { return (int)requests.size(); }
+
+    bool hasRegisteredBuffers() const
+    {
+#ifdef M1_HAVE_IO_URING
+        return registered;
+#else
+        return false;
+#endif
+    }
+
+    /*
+     reserveBuffers(count)
+     Hands out `count` buffers for one file, returns the first index or -1
+     once the buffers are used up.
+     */
+    int reserveBuffers(int count)
+    {
+        if (count <= 0 || reserved + count > (int)requests.size()) return -1;
+        int first = reserved;
+        reserved += count;
+        return first;
+    }
+
+    unsigned char* buffer(int index) { return requests[index].buffer; }
+
+    /*
+     submitRead(index, fd, offset, bytes) / submitWrite(index, fd, offset, bytes)
+     Queue a transfer of up to getBufferBytes() between buffer `index` and
+     the file. The buffer must not be touched until wait() returned.
+     */
+    void submitRead(int index, int fd, uint64_t offset, size_t bytes) { submit(index, fd, offset, bytes, false); }
+    void submitWrite(int index, int fd, uint64_t offset, size_t bytes) { submit(index, fd, offset, bytes, true); }
+
+    /*
+     flush()
+     Hands everything queued since the last call to the kernel at once.
+     */
+    void flush()
+    {
+#ifdef M1_HAVE_IO_URING
+        if (backend == BACKEND_IO_URING && toSubmit > 0 && !enter(0)) {
+            failPending(errno);
+        }
+#endif
+    }
+
+    bool isPending(int index)
+    {
+#ifdef M1_HAVE_IO_URING
+        if (backend == BACKEND_IO_URING) {
+            reap();
+            return requests[index].state == STATE_PENDING;
+        }
+#endif
+        std::lock_guard<std::mutex> lock(mutex);
+        return requests[index].state == STATE_PENDING;
+    }
+
+    /*
+     wait(index)
+     Blocks until the transfer of buffer `index` finished and returns the
+     bytes moved (short only at the end of a file) or -errno. Returns 0
+     for a buffer with nothing submitted.
+     */
+    long wait(int index)
+    {
+        Request& r = requests[index];
+#ifdef M1_HAVE_IO_URING
+        if (backend == BACKEND_IO_URING) {
+            while (r.state == STATE_PENDING) {
+                reap();
+                if (r.state != STATE_PENDING) break;
+                if (!enter(1)) failPending(errno);
+            }
+            long result = r.state == STATE_DONE ? r.result : 0;
+            r.state = STATE_IDLE;
+            return result;
+        }
+#endif
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]() { return r.state != STATE_PENDING; });
+        long result = r.state == STATE_DONE ? r.result : 0;
+        r.state = STATE_IDLE;
+        return result;
+    }
+};
+
+#endif /* AsyncFileIO_h */
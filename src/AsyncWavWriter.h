@@ -0,0 +1,357 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef AsyncWavWriter_h
+#define AsyncWavWriter_h
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "AsyncFileIO.h"
+#include "PcmQuantizer.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ AsyncWavWriter
+ PCM WAV file written through an AsyncFileIO queue. Samples are quantized
+ straight into one of the file's queue buffers and a buffer is only
+ submitted once it is full, so the file sees a few large writes in flight
+ instead of one small blocking write per processing block.
+
+ The header is written last, on close(), once the length is known. It is
+ padded with a JUNK chunk so the samples start on a 4KB boundary; every
+ write but the last one is then aligned, which O_DIRECT needs. Files over
+ 4GB become RF64, the `ds64` chunk takes the front of the padding.
+ */
+class AsyncWavWriter
+{
+    AsyncFileIO* io = nullptr;
+    int fd = -1;
+    int firstBuffer = 0;
+    int numBuffers = 0;
+    int current = 0;         // buffer being filled, relative to firstBuffer
+    size_t fill = 0;         // bytes in the current buffer
+    std::vector<size_t> inFlight; // bytes submitted from each buffer
+    std::vector<unsigned char> straddle; // a frame split over two buffers
+    bool failed = false;
+    bool direct = false;
+
+    int channels = 0;
+    int sampleRate = 0;
+    int bitDepth = 0;
+    std::string comment;
+    uint64_t preallocated = 0;
+    uint64_t dataOffset = 0;
+    uint64_t dataBytes = 0;  // submitted so far
+
+    static const uint64_t DATA_ALIGNMENT = AsyncFileIO::ALIGNMENT;
+
+    static void put16(std::vector<unsigned char>& out, uint32_t v)
+    {
+        out.push_back((unsigned char)(v & 0xff));
+        out.push_back((unsigned char)((v >> 8) & 0xff));
+    }
+
+    static void put32(std::vector<unsigned char>& out, uint32_t v)
+    {
+        put16(out, v & 0xffff);
+        put16(out, v >> 16);
+    }
+
+    static void put64(std::vector<unsigned char>& out, uint64_t v)
+    {
+        put32(out, (uint32_t)(v & 0xffffffff));
+        put32(out, (uint32_t)(v >> 32));
+    }
+
+    static void putId(std::vector<unsigned char>& out, const char* id)
+    {
+        out.insert(out.end(), id, id + 4);
+    }
+
+    static void putJunk(std::vector<unsigned char>& out, uint64_t bytes)
+    {
+        putId(out, "JUNK");
+        put32(out, (uint32_t)(bytes - 8));
+        out.insert(out.end(), (size_t)(bytes - 8), 0);
+    }
+
+    std::vector<unsigned char> infoChunk() const
+    {
+        std::vector<unsigned char> info;
+        if (!comment.empty()) {
+            std::string text = comment;
+            text.push_back('\0');
+            if (text.size() & 1) text.push_back('\0');
+            putId(info, "LIST");
+            put32(info, (uint32_t)(4 + 8 + text.size()));
+            putId(info, "INFO");
+            putId(info, "ICMT");
+            put32(info, (uint32_t)text.size());
+            info.insert(info.end(), text.begin(), text.end());
+        }
+        return info;
+    }
+
+    // RIFF + ds64/JUNK padding + fmt + LIST + data header, a multiple of 4KB
+    std::vector<unsigned char> header(uint64_t totalDataBytes) const
+    {
+        std::vector<unsigned char> info = infoChunk();
+        uint64_t fixedBytes = 12 + 24 + info.size() + 8;
+        uint64_t headerBytes = (fixedBytes + 36 + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+        uint64_t padding = headerBytes - fixedBytes;
+        // room for ds64 plus a JUNK chunk behind it, which can't be under 8 bytes
+        if (padding > 36 && padding < 36 + 8) {
+            headerBytes += DATA_ALIGNMENT;
+            padding += DATA_ALIGNMENT;
+        }
+        uint64_t riffSize = headerBytes - 8 + totalDataBytes + (totalDataBytes & 1);
+        bool rf64 = riffSize > 0xFFFFFFFFull;
+
+        std::vector<unsigned char> out;
+        putId(out, rf64 ? "RF64" : "RIFF");
+        put32(out, rf64 ? 0xFFFFFFFF : (uint32_t)riffSize);
+        putId(out, "WAVE");
+        if (rf64) {
+            putId(out, "ds64");
+            put32(out, 28);
+            put64(out, riffSize);
+            put64(out, totalDataBytes);
+            put64(out, totalDataBytes / (channels * (bitDepth / 8)));
+            put32(out, 0); // no table entries
+            if (padding > 36) putJunk(out, padding - 36);
+        } else {
+            putJunk(out, padding);
+        }
+        putId(out, "fmt ");
+        put32(out, 16);
+        put16(out, 1); // WAVE_FORMAT_PCM
+        put16(out, (uint32_t)channels);
+        put32(out, (uint32_t)sampleRate);
+        put32(out, (uint32_t)(sampleRate * channels * (bitDepth / 8)));
+        put16(out, (uint32_t)(channels * (bitDepth / 8)));
+        put16(out, (uint32_t)bitDepth);
+        out.insert(out.end(), info.begin(), info.end());
+        putId(out, "data");
+        put32(out, rf64 ? 0xFFFFFFFF : (uint32_t)totalDataBytes);
+        return out;
+    }
+
+    bool writeAt(const unsigned char* data, size_t bytes, uint64_t offset)
+    {
+#ifdef _WIN32
+        (void)data; (void)bytes; (void)offset;
+        return false;
+#else
+        while (bytes > 0) {
+            ssize_t written = pwrite(fd, data, bytes, (off_t)offset);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) return false;
+            data += written;
+            bytes -= (size_t)written;
+            offset += (uint64_t)written;
+        }
+        return true;
+#endif
+    }
+
+    // the header size is known once the comment is
+    void start()
+    {
+        dataOffset = header(0).size();
+    }
+
+    // reserves the file for a header without a long comment and `frames`
+    void preallocate(long long frames)
+    {
+#if defined(__linux__)
+        uint64_t bytes = (uint64_t)frames * channels * (bitDepth / 8);
+        uint64_t fileBytes = DATA_ALIGNMENT + bytes + (bytes & 1);
+        // no zero filling fallback like posix_fallocate, just skip it where unsupported
+        if (fallocate(fd, 0, 0, (off_t)fileBytes) == 0) preallocated = fileBytes;
+#else
+        (void)frames;
+#endif
+    }
+
+    // hands the current buffer to the queue and moves on to the next one
+    bool submitCurrent()
+    {
+        if (fill == 0) return true;
+        io->submitWrite(firstBuffer + current, fd, dataOffset + dataBytes, fill);
+        inFlight[current] = fill;
+        dataBytes += fill;
+        fill = 0;
+        current = (current + 1) % numBuffers;
+        // the next buffer may still be on its way to the disk
+        return finish(current);
+    }
+
+    bool finish(int buffer)
+    {
+        long result = io->wait(firstBuffer + buffer);
+        if (result < 0 || (size_t)result != inFlight[buffer]) failed = true;
+        inFlight[buffer] = 0;
+        return !failed;
+    }
+
+public:
+    AsyncWavWriter() {}
+    ~AsyncWavWriter() { close(); }
+
+    AsyncWavWriter(const AsyncWavWriter&) = delete;
+    AsyncWavWriter& operator=(const AsyncWavWriter&) = delete;
+
+    /*
+     open(path, channels, sampleRate, bitDepth, io, numBuffers, frames, directIO)
+     Creates the file and takes `numBuffers` of the queue's buffers, one is
+     filled while the others are written. With the expected length in
+     `frames` the file is preallocated, `directIO` bypasses the page cache
+     where the file system allows it. setComment() can follow until the
+     first frames are written.
+     */
+    bool open(const std::string& path, int numChannels, int rate, int bits, AsyncFileIO& queue, int buffers, long long frames = 0, bool directIO = false)
+    {
+        close();
+#ifdef _WIN32
+        (void)path; (void)numChannels; (void)rate; (void)bits; (void)queue; (void)buffers; (void)frames; (void)directIO;
+        return false;
+#else
+        if (bits != 16 && bits != 24 && bits != 32) return false;
+        size_t frameBytes = (size_t)numChannels * (bits / 8);
+        if (buffers < 1 || frameBytes == 0) return false;
+        firstBuffer = queue.reserveBuffers(buffers);
+        if (firstBuffer < 0) return false;
+        direct = false;
+#ifdef O_DIRECT
+        if (directIO) {
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+            direct = fd >= 0;
+        }
+#endif
+        if (fd < 0) fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+#if defined(__APPLE__)
+        if (directIO) direct = fcntl(fd, F_NOCACHE, 1) == 0;
+#endif
+        io = &queue;
+        numBuffers = buffers;
+        inFlight.assign(buffers, 0);
+        straddle.resize(frameBytes);
+        current = 0;
+        fill = 0;
+        failed = false;
+        channels = numChannels;
+        sampleRate = rate;
+        bitDepth = bits;
+        comment.clear();
+        preallocated = 0;
+        dataOffset = 0;
+        dataBytes = 0;
+        if (frames > 0) preallocate(frames);
+        return true;
+#endif
+    }
+
+    void setComment(const std::string& text) { comment = text; }
+
+    /*
+     writeFrames(interleaved, frames, quantizer)
+     Quantizes `frames` interleaved frames into the file's buffers, full
+     buffers are submitted but not flushed to the kernel; call the queue's
+     flush() once all files of a block were written.
+     */
+    bool writeFrames(const float* interleaved, int frames, PcmQuantizer& quantizer)
+    {
+        if (fd < 0 || failed) return false;
+        if (quantizer.getBytesPerSample() != bitDepth / 8) return false;
+        if (dataOffset == 0) start();
+        size_t frameBytes = (size_t)channels * (bitDepth / 8);
+        size_t bufferBytes = io->getBufferBytes();
+        while (frames > 0) {
+            unsigned char* dst = io->buffer(firstBuffer + current) + fill;
+            int fit = (int)((bufferBytes - fill) / frameBytes);
+            if (fit == 0) {
+                // buffers stay full size for aligned writes, so a frame may span two
+                quantizer.quantize(interleaved, 1, straddle.data());
+                size_t head = bufferBytes - fill;
+                memcpy(dst, straddle.data(), head);
+                fill = bufferBytes;
+                if (!submitCurrent()) return false;
+                memcpy(io->buffer(firstBuffer + current), straddle.data() + head, frameBytes - head);
+                fill = frameBytes - head;
+                interleaved += channels;
+                frames--;
+                continue;
+            }
+            int n = frames < fit ? frames : fit;
+            quantizer.quantize(interleaved, n, dst);
+            fill += (size_t)n * frameBytes;
+            interleaved += (size_t)n * channels;
+            frames -= n;
+            if (fill == bufferBytes && !submitCurrent()) return false;
+        }
+        return true;
+    }
+
+    /*
+     close()
+     Writes what is left, waits for the queue and writes the header.
+     Returns false if any write failed.
+     */
+    bool close()
+    {
+        if (fd < 0) return true;
+        if (dataOffset == 0) start();
+        bool ok = !failed;
+        for (int i = 0; i < numBuffers; i++) {
+            if (i != current && !finish(i)) ok = false;
+        }
+#if defined(O_DIRECT)
+        // the tail and the header aren't whole blocks
+        if (direct) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+#endif
+        if (ok && fill > 0) {
+            io->submitWrite(firstBuffer + current, fd, dataOffset + dataBytes, fill);
+            io->flush();
+            inFlight[current] = fill;
+            dataBytes += fill;
+            fill = 0;
+            ok = finish(current);
+        }
+        if (ok && (dataBytes & 1)) {
+            unsigned char pad = 0;
+            ok = writeAt(&pad, 1, dataOffset + dataBytes);
+        }
+        if (ok) {
+            std::vector<unsigned char> bytes = header(dataBytes);
+            ok = bytes.size() == dataOffset && writeAt(bytes.data(), bytes.size(), 0);
+        }
+#ifndef _WIN32
+        uint64_t fileBytes = dataOffset + dataBytes + (dataBytes & 1);
+        if (ok && preallocated != fileBytes && preallocated > 0) {
+            ok = ftruncate(fd, (off_t)fileBytes) == 0;
+        }
+        ::close(fd);
+#endif
+        fd = -1;
+        io = nullptr;
+        return ok;
+    }
+
+    bool isOpened() const { return fd >= 0; }
+    bool isDirect() const { return direct; }
+    bool isPreallocated() const { return preallocated > 0; }
+    int getChannels() const { return channels; }
+    int getSampleRate() const { return sampleRate; }
+    int getBitDepth() const { return bitDepth; }
+};
+
+#endif /* AsyncWavWriter_h */
@@ -0,0 +1,107 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef BlockSizeTuner_h
+#define BlockSizeTuner_h
+
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+/*
+ BlockSizeTuner
+ Picks the processing block size by timing the per-block work on synthetic
+ buffers with the job's real input/output channel counts.
+ Each candidate processes the same number of frames and the size with the
+ lowest cost per frame wins. A larger block has to be at least 2% cheaper
+ than the current best to be preferred, so timing noise doesn't trade
+ latency for nothing.
+ */
+class BlockSizeTuner
+{
+public:
+    // processes `frames` frames from the planar `in` buffers into `out` and `interleaved`
+    typedef std::function<void(float** in, float** out, float* interleaved, int frames)> ProcessFn;
+
+    struct Result {
+        int blockSize;
+        double nsPerFrame;
+    };
+
+private:
+    std::vector<int> candidates;
+    long long framesPerCandidate;
+    std::vector<Result> results;
+
+public:
+    BlockSizeTuner() : framesPerCandidate(1 << 18)
+    {
+        for (int size = 256; size <= 65536; size *= 2) {
+            candidates.push_back(size);
+        }
+    }
+
+    void setCandidates(const std::vector<int>& sizes)
+    {
+        candidates = sizes;
+    }
+
+    void setFramesPerCandidate(long long frames)
+    {
+        framesPerCandidate = frames;
+    }
+
+    const std::vector<Result>& getResults() const
+    {
+        return results;
+    }
+
+    /*
+     tune(inChannels, outChannels, process)
+     Times every candidate block size and returns the fastest one.
+     */
+    int tune(int inChannels, int outChannels, ProcessFn process)
+    {
+        results.clear();
+        int best = candidates.empty() ? 512 : candidates[0];
+        double bestCost = 0.0;
+
+        for (size_t c = 0; c < candidates.size(); c++) {
+            int blockSize = candidates[c];
+            std::vector<float> inBuffers((size_t)inChannels * blockSize);
+            std::vector<float> outBuffers((size_t)outChannels * blockSize);
+            std::vector<float> interleaved((size_t)outChannels * blockSize);
+            std::vector<float*> inPtrs(inChannels), outPtrs(outChannels);
+            for (int i = 0; i < inChannels; i++) inPtrs[i] = &inBuffers[(size_t)i * blockSize];
+            for (int i = 0; i < outChannels; i++) outPtrs[i] = &outBuffers[(size_t)i * blockSize];
+            // low level signal, so nothing in the chain hits a denormal or silence shortcut
+            for (size_t i = 0; i < inBuffers.size(); i++) inBuffers[i] = 0.25f * (float)sin(0.01 * (double)i);
+
+            long long blocks = framesPerCandidate / blockSize;
+            if (blocks < 2) blocks = 2;
+
+            // warm up caches and any lazily sized internal buffers
+            process(inPtrs.data(), outPtrs.data(), interleaved.data(), blockSize);
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (long long b = 0; b < blocks; b++) {
+                process(inPtrs.data(), outPtrs.data(), interleaved.data(), blockSize);
+            }
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+            Result result;
+            result.blockSize = blockSize;
+            result.nsPerFrame = ns / (double)(blocks * blockSize);
+            results.push_back(result);
+
+            if (c == 0 || result.nsPerFrame < bestCost * 0.98) {
+                bestCost = result.nsPerFrame;
+                best = blockSize;
+            }
+        }
+        return best;
+    }
+};
+
+#endif /* BlockSizeTuner_h */
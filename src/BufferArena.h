@@ -0,0 +1,140 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef BufferArena_h
+#define BufferArena_h
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+/*
+ BufferArena
+ One 64-byte aligned allocation that owns every per-job sample buffer
+ (reader scratch, pipeline planes, interleaved output).
+
+ Usage per job:
+     arena.reset(totalFloats);        // grows only when a job needs more
+     float* buf = arena.allocate(n);  // 64-byte aligned, padded to 16 floats
+     arena.allocatePlanes(ptrs, channels, frames);
+
+ The memory is kept between jobs, so batch runs don't reallocate once the
+ largest job has been seen. Planes are padded to a whole number of cache
+ lines so SIMD kernels can use aligned loads and run past the last frame.
+ */
+class BufferArena
+{
+public:
+    static const size_t ALIGNMENT = 64;                            // bytes
+    static const size_t ALIGN_FLOATS = ALIGNMENT / sizeof(float);
+
+private:
+    float* base = nullptr;
+    size_t capacity = 0; // in floats
+    size_t used = 0;     // in floats
+
+    static float* allocateAligned(size_t floats)
+    {
+        void* ptr = nullptr;
+#ifdef _WIN32
+        ptr = _aligned_malloc(floats * sizeof(float), ALIGNMENT);
+#else
+        if (posix_memalign(&ptr, ALIGNMENT, floats * sizeof(float)) != 0) ptr = nullptr;
+#endif
+        if (!ptr) throw std::bad_alloc();
+        return (float*)ptr;
+    }
+
+    static void freeAligned(float* ptr)
+    {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+public:
+    BufferArena() {}
+    ~BufferArena() { if (base) freeAligned(base); }
+
+    BufferArena(const BufferArena&) = delete;
+    BufferArena& operator=(const BufferArena&) = delete;
+
+    // number of floats a buffer of `floats` occupies once padded
+    static size_t padded(size_t floats)
+    {
+        return (floats + ALIGN_FLOATS - 1) / ALIGN_FLOATS * ALIGN_FLOATS;
+    }
+
+    // floats needed for `channels` planes of `frames`
+    static size_t planesSize(int channels, int frames)
+    {
+        return (size_t)channels * padded((size_t)frames);
+    }
+
+    /*
+     reset(floats)
+     Releases all allocations and makes sure `floats` floats are available.
+     The backing memory is only reallocated when it has to grow.
+     The reserved region is zeroed.
+     */
+    void reset(size_t floats)
+    {
+        floats = padded(floats);
+        if (floats > capacity) {
+            if (base) freeAligned(base);
+            base = nullptr;
+            capacity = 0;
+            base = allocateAligned(floats);
+            capacity = floats;
+        }
+        used = 0;
+        if (floats) memset(base, 0, floats * sizeof(float));
+    }
+
+    // frees the backing memory, the next reset() allocates again
+    void release()
+    {
+        if (base) freeAligned(base);
+        base = nullptr;
+        capacity = 0;
+        used = 0;
+    }
+
+    float* allocate(size_t floats)
+    {
+        floats = padded(floats);
+        if (used + floats > capacity) throw std::bad_alloc();
+        float* ptr = base + used;
+        used += floats;
+        return ptr;
+    }
+
+    /*
+     allocatePlanes(ptrs, channels, frames)
+     Carves `channels` aligned planes of `frames` frames and stores their
+     pointers in `ptrs`. Returns the plane stride in floats.
+     */
+    size_t allocatePlanes(std::vector<float*>& ptrs, int channels, int frames)
+    {
+        size_t stride = padded((size_t)frames);
+        float* planes = allocate((size_t)channels * stride);
+        ptrs.resize(channels);
+        for (int i = 0; i < channels; i++) {
+            ptrs[i] = planes + (size_t)i * stride;
+        }
+        return stride;
+    }
+
+    size_t getCapacity() const { return capacity; }
+    size_t getUsed() const { return used; }
+};
+
+#endif /* BufferArena_h */
@@ -0,0 +1,165 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef CpuFeatures_h
+#define CpuFeatures_h
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define M1_ARCH_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define M1_ARCH_NEON 1
+#include <arm_neon.h>
+#endif
+
+// SSE2 is part of the x86-64 baseline and of every 32-bit target we ship
+#if defined(M1_ARCH_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define M1_HAS_SSE 1
+#endif
+
+// Per-function ISA targets so AVX2/AVX-512 kernels can live next to the
+// baseline code and be selected at runtime without global compiler flags
+#if defined(M1_ARCH_X86) && (defined(__GNUC__) || defined(__clang__))
+#define M1_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define M1_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#define M1_HAS_AVX2 1
+#define M1_HAS_AVX512 1
+#elif defined(M1_ARCH_X86) && defined(_MSC_VER)
+#define M1_TARGET_AVX2
+#define M1_TARGET_AVX512
+#define M1_HAS_AVX2 1
+#define M1_HAS_AVX512 1
+#endif
+
+/*
+ CpuFeatures
+ Runtime instruction set detection used to dispatch the SIMD kernels.
+ The `M1_TRANSCODE_SIMD` environment variable (scalar, sse, avx2, avx512,
+ neon) caps the level that gets selected, which is handy for comparing
+ kernels on the same machine.
+ */
+class CpuFeatures
+{
+public:
+    enum SimdLevel {
+        SIMD_SCALAR = 0,
+        SIMD_SSE,
+        SIMD_NEON,
+        SIMD_AVX2,
+        SIMD_AVX512
+    };
+
+private:
+    SimdLevel detected = SIMD_SCALAR;
+    SimdLevel active = SIMD_SCALAR;
+
+#if defined(M1_ARCH_X86)
+    static void cpuid(int leaf, int subleaf, unsigned int regs[4])
+    {
+#if defined(_MSC_VER)
+        int r[4];
+        __cpuidex(r, leaf, subleaf);
+        for (int i = 0; i < 4; i++) regs[i] = (unsigned int)r[i];
+#else
+        __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    static unsigned long long xgetbv()
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        unsigned int eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return ((unsigned long long)edx << 32) | eax;
+#endif
+    }
+#endif
+
+    CpuFeatures()
+    {
+#if defined(M1_HAS_SSE)
+        detected = SIMD_SSE;
+        unsigned int regs[4];
+        cpuid(0, 0, regs);
+        unsigned int maxLeaf = regs[0];
+        cpuid(1, 0, regs);
+        bool osxsave = (regs[2] & (1u << 27)) != 0;
+        bool fma = (regs[2] & (1u << 12)) != 0;
+        bool avx = (regs[2] & (1u << 28)) != 0; // a hypervisor can mask it and still report leaf 7
+        if (osxsave && maxLeaf >= 7) {
+            unsigned long long xcr0 = xgetbv();
+            bool ymmState = (xcr0 & 0x6) == 0x6;
+            bool zmmState = (xcr0 & 0xE6) == 0xE6;
+            cpuid(7, 0, regs);
+            bool avx2 = (regs[1] & (1u << 5)) != 0;
+            bool avx512f = (regs[1] & (1u << 16)) != 0;
+            if (ymmState && avx && avx2 && fma) detected = SIMD_AVX2;
+            if (zmmState && avx512f && detected == SIMD_AVX2) detected = SIMD_AVX512;
+        }
+#elif defined(M1_ARCH_NEON)
+        detected = SIMD_NEON;
+#endif
+        active = detected;
+
+        const char* env = getenv("M1_TRANSCODE_SIMD");
+        if (env) {
+            SimdLevel cap = parseLevel(env, detected);
+            if (cap < active) active = cap;
+        }
+    }
+
+public:
+    static CpuFeatures& get()
+    {
+        static CpuFeatures instance;
+        return instance;
+    }
+
+    static SimdLevel parseLevel(const char* name, SimdLevel fallback)
+    {
+        if (strcmp(name, "scalar") == 0) return SIMD_SCALAR;
+        if (strcmp(name, "sse") == 0) return SIMD_SSE;
+        if (strcmp(name, "neon") == 0) return SIMD_NEON;
+        if (strcmp(name, "avx2") == 0) return SIMD_AVX2;
+        if (strcmp(name, "avx512") == 0) return SIMD_AVX512;
+        return fallback;
+    }
+
+    static const char* levelName(SimdLevel level)
+    {
+        switch (level) {
+            case SIMD_SSE: return "sse";
+            case SIMD_NEON: return "neon";
+            case SIMD_AVX2: return "avx2";
+            case SIMD_AVX512: return "avx512";
+            default: return "scalar";
+        }
+    }
+
+    SimdLevel getDetectedLevel() const { return detected; }
+    SimdLevel getLevel() const { return active; }
+
+    /*
+     setLevel(level)
+     Restricts dispatch to `level`; requests above what the CPU supports are
+     clamped to the detected level.
+     */
+    void setLevel(SimdLevel level)
+    {
+        active = level > detected ? detected : level;
+    }
+};
+
+#endif /* CpuFeatures_h */
@@ -0,0 +1,162 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef FixedMatrixKernels_h
+#define FixedMatrixKernels_h
+
+#include "MatrixKernel.h"
+
+/*
+ FixedMatrixKernels
+ Matrix kernels compiled for fixed channel counts, for the conversions
+ that take most of the processing time. With `In` and `Out` known to the
+ compiler the loops unroll completely and one accumulator per output
+ channel stays in a register: every input sample is loaded exactly once
+ and feeds all outputs, and each output is stored once, with no row
+ blocking or loop overhead left.
+
+ That needs the 32 vector registers of AVX-512 and AArch64 NEON. With 16
+ registers (SSE, AVX2) the outputs have to be split into groups again and
+ the blocked generic kernel measured just as fast, so those levels (and
+ scalar) keep it.
+
+ The registry maps format pairs to their specialization; find() resolves
+ the names with getFormatFromString(), anything not listed keeps using
+ the generic MatrixKernel. Only pairs the bench shows clearly ahead of
+ the generic kernel are listed, and a specialization only replaces the
+ dense strategy: sparse and permute matrices keep theirs.
+ */
+class FixedMatrixKernels
+{
+    template <int In, int Out>
+    static void tail(const float* coeffs, const float* const* in, float* const* out, int first, int frames)
+    {
+        for (int j = first; j < frames; j++) {
+            float x[In];
+            for (int i = 0; i < In; i++) x[i] = in[i][j];
+            for (int o = 0; o < Out; o++) {
+                const float* row = coeffs + o * In;
+                float sum = 0.0f;
+                for (int i = 0; i < In; i++) sum += row[i] * x[i];
+                out[o][j] = sum;
+            }
+        }
+    }
+
+#if defined(M1_HAS_AVX512)
+    template <int In, int Out>
+    M1_TARGET_AVX512 static void processAVX512(const float* coeffs, int, int, const float* const* in, float* const* out, int frames)
+    {
+        int j = 0;
+        for (; j + 32 <= frames; j += 32) {
+            __m512 acc0[Out], acc1[Out];
+            for (int o = 0; o < Out; o++) acc0[o] = acc1[o] = _mm512_setzero_ps();
+            for (int i = 0; i < In; i++) {
+                __m512 x0 = _mm512_loadu_ps(in[i] + j);
+                __m512 x1 = _mm512_loadu_ps(in[i] + j + 16);
+                for (int o = 0; o < Out; o++) {
+                    __m512 c = _mm512_set1_ps(coeffs[o * In + i]);
+                    acc0[o] = _mm512_fmadd_ps(c, x0, acc0[o]);
+                    acc1[o] = _mm512_fmadd_ps(c, x1, acc1[o]);
+                }
+            }
+            for (int o = 0; o < Out; o++) {
+                _mm512_storeu_ps(out[o] + j, acc0[o]);
+                _mm512_storeu_ps(out[o] + j + 16, acc1[o]);
+            }
+        }
+        for (; j < frames; j += 16) {
+            int n = frames - j < 16 ? frames - j : 16;
+            __mmask16 mask = (__mmask16)((1u << n) - 1);
+            __m512 acc[Out];
+            for (int o = 0; o < Out; o++) acc[o] = _mm512_setzero_ps();
+            for (int i = 0; i < In; i++) {
+                __m512 x = _mm512_maskz_loadu_ps(mask, in[i] + j);
+                for (int o = 0; o < Out; o++) acc[o] = _mm512_fmadd_ps(_mm512_set1_ps(coeffs[o * In + i]), x, acc[o]);
+            }
+            for (int o = 0; o < Out; o++) _mm512_mask_storeu_ps(out[o] + j, mask, acc[o]);
+        }
+    }
+#endif
+
+#if defined(M1_ARCH_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+    template <int In, int Out>
+    static void processNEON(const float* coeffs, int, int, const float* const* in, float* const* out, int frames)
+    {
+        int j = 0;
+        for (; j + 4 <= frames; j += 4) {
+            float32x4_t acc[Out];
+            for (int o = 0; o < Out; o++) acc[o] = vdupq_n_f32(0.0f);
+            for (int i = 0; i < In; i++) {
+                float32x4_t x = vld1q_f32(in[i] + j);
+                for (int o = 0; o < Out; o++) acc[o] = vfmaq_n_f32(acc[o], x, coeffs[o * In + i]);
+            }
+            for (int o = 0; o < Out; o++) vst1q_f32(out[o] + j, acc[o]);
+        }
+        tail<In, Out>(coeffs, in, out, j, frames);
+    }
+#endif
+
+    // nullptr where the generic kernel is as fast
+    template <int In, int Out>
+    static MatrixKernel::ProcessFn getProcess(CpuFeatures::SimdLevel level)
+    {
+#if defined(M1_HAS_AVX512)
+        if (level >= CpuFeatures::SIMD_AVX512) return &processAVX512<In, Out>;
+#endif
+#if defined(M1_ARCH_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+        if (level == CpuFeatures::SIMD_NEON) return &processNEON<In, Out>;
+#endif
+        (void)level;
+        return nullptr;
+    }
+
+public:
+    struct Entry {
+        const char* inFormat;
+        const char* outFormat;
+        int inChannels;
+        int outChannels;
+        MatrixKernel::ProcessFn (*getProcess)(CpuFeatures::SimdLevel level);
+    };
+
+    static const Entry* getEntries(int& numEntries)
+    {
+        static const Entry entries[] = {
+            { "M1Spatial-8", "5.1.4_M", 8, 10, &getProcess<8, 10> },
+            { "M1Spatial-14", "7.1.2_M", 14, 10, &getProcess<14, 10> },
+        };
+        numEntries = (int)(sizeof(entries) / sizeof(entries[0]));
+        return entries;
+    }
+
+    /*
+     find(m1transcode, inFmt, outFmt)
+     Specialization for a pair of format IDs, or nullptr.
+     */
+    template <typename Transcode>
+    static const Entry* find(Transcode& m1transcode, int inFmt, int outFmt)
+    {
+        int numEntries = 0;
+        const Entry* entries = getEntries(numEntries);
+        for (int e = 0; e < numEntries; e++) {
+            if (m1transcode.getFormatFromString((char*)entries[e].inFormat) == inFmt
+                && m1transcode.getFormatFromString((char*)entries[e].outFormat) == outFmt) {
+                return &entries[e];
+            }
+        }
+        return nullptr;
+    }
+
+    /*
+     apply(kernel, entry)
+     Switches a kernel whose matrix is set to the specialization, at the
+     kernel's instruction set. Returns false when that level has none.
+     */
+    static bool apply(MatrixKernel& kernel, const Entry& entry)
+    {
+        return kernel.setFixedProcess(entry.getProcess(kernel.getLevel()), entry.inChannels, entry.outChannels);
+    }
+};
+
+#endif /* FixedMatrixKernels_h */
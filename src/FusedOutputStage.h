@@ -0,0 +1,292 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef FusedOutputStage_h
+#define FusedOutputStage_h
+
+#include <cmath>
+#include <vector>
+
+#include "BufferArena.h"
+#include "InterleaveKernels.h"
+#include "MatrixKernel.h"
+
+/*
+ FusedOutputStage
+ Output side of a block in one walk over the samples: matrix conversion,
+ master gain, peak tracking and interleaving into the writer's buffer.
+
+ The separate steps each stream the whole set of output planes through
+ memory (processConversion writes them, processMasterGain rewrites them,
+ processNormalization reads them again and the multiplexer reads them a
+ last time). Here the block is converted a tile of frames at a time into
+ a small scratch that stays in L1, and gain, peak and interleave run on
+ that tile, so the output is only written once, already interleaved.
+
+ The interleaved layout matches the transcoder's file buffer: one region
+ of `fileChannels * frames` samples per output file. Gain and peak run at
+ the kernel's instruction set; worthIt() says which conversions use the
+ stage at all.
+ */
+class FusedOutputStage
+{
+    static const int TILE_FLOATS = 4096; // 16KB of converted output per tile
+
+    const MatrixKernel* kernel = nullptr;
+    std::vector<float*> tile;
+    std::vector<const float*> inTile;
+    int tileFrames = 0;
+    int fileChannels = 0;
+    int numFiles = 0;
+
+    // scales `samples` in place and returns the larger of `peak` and their absolute peak
+    typedef float (*GainPeakFn)(float* samples, int count, float gain, float peak);
+    GainPeakFn gainPeak = nullptr;
+
+    static float gainPeakTail(float* samples, int j, int count, float gain, float peak)
+    {
+        for (; j < count; j++) {
+            samples[j] *= gain;
+            float a = std::fabs(samples[j]);
+            if (a > peak) peak = a;
+        }
+        return peak;
+    }
+
+    static float gainPeakScalar(float* samples, int count, float gain, float peak)
+    {
+        return gainPeakTail(samples, 0, count, gain, peak);
+    }
+
+#if defined(M1_HAS_SSE)
+    static float gainPeakSSE(float* samples, int count, float gain, float peak)
+    {
+        int j = 0;
+        // four running maxima, one would serialize on the max latency
+        const __m128 g = _mm_set1_ps(gain);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        __m128 p0 = _mm_set1_ps(peak), p1 = p0, p2 = p0, p3 = p0;
+        for (; j + 16 <= count; j += 16) {
+            __m128 x0 = _mm_mul_ps(_mm_load_ps(samples + j), g);
+            __m128 x1 = _mm_mul_ps(_mm_load_ps(samples + j + 4), g);
+            __m128 x2 = _mm_mul_ps(_mm_load_ps(samples + j + 8), g);
+            __m128 x3 = _mm_mul_ps(_mm_load_ps(samples + j + 12), g);
+            _mm_store_ps(samples + j, x0);
+            _mm_store_ps(samples + j + 4, x1);
+            _mm_store_ps(samples + j + 8, x2);
+            _mm_store_ps(samples + j + 12, x3);
+            p0 = _mm_max_ps(p0, _mm_and_ps(x0, absMask));
+            p1 = _mm_max_ps(p1, _mm_and_ps(x1, absMask));
+            p2 = _mm_max_ps(p2, _mm_and_ps(x2, absMask));
+            p3 = _mm_max_ps(p3, _mm_and_ps(x3, absMask));
+        }
+        __m128 p = _mm_max_ps(_mm_max_ps(p0, p1), _mm_max_ps(p2, p3));
+        float lanes[4];
+        _mm_storeu_ps(lanes, p);
+        for (int k = 0; k < 4; k++) peak = lanes[k] > peak ? lanes[k] : peak;
+        return gainPeakTail(samples, j, count, gain, peak);
+    }
+#endif
+
+#if defined(M1_HAS_AVX2)
+    M1_TARGET_AVX2 static float gainPeakAVX2(float* samples, int count, float gain, float peak)
+    {
+        int j = 0;
+        const __m256 g = _mm256_set1_ps(gain);
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        __m256 p0 = _mm256_set1_ps(peak), p1 = p0, p2 = p0, p3 = p0;
+        for (; j + 32 <= count; j += 32) {
+            __m256 x0 = _mm256_mul_ps(_mm256_load_ps(samples + j), g);
+            __m256 x1 = _mm256_mul_ps(_mm256_load_ps(samples + j + 8), g);
+            __m256 x2 = _mm256_mul_ps(_mm256_load_ps(samples + j + 16), g);
+            __m256 x3 = _mm256_mul_ps(_mm256_load_ps(samples + j + 24), g);
+            _mm256_store_ps(samples + j, x0);
+            _mm256_store_ps(samples + j + 8, x1);
+            _mm256_store_ps(samples + j + 16, x2);
+            _mm256_store_ps(samples + j + 24, x3);
+            p0 = _mm256_max_ps(p0, _mm256_and_ps(x0, absMask));
+            p1 = _mm256_max_ps(p1, _mm256_and_ps(x1, absMask));
+            p2 = _mm256_max_ps(p2, _mm256_and_ps(x2, absMask));
+            p3 = _mm256_max_ps(p3, _mm256_and_ps(x3, absMask));
+        }
+        // tiles are multiples of 16 frames, so one more half step is common
+        for (; j + 8 <= count; j += 8) {
+            __m256 x = _mm256_mul_ps(_mm256_load_ps(samples + j), g);
+            _mm256_store_ps(samples + j, x);
+            p0 = _mm256_max_ps(p0, _mm256_and_ps(x, absMask));
+        }
+        __m256 p = _mm256_max_ps(_mm256_max_ps(p0, p1), _mm256_max_ps(p2, p3));
+        __m128 q = _mm_max_ps(_mm256_castps256_ps128(p), _mm256_extractf128_ps(p, 1));
+        float lanes[4];
+        _mm_storeu_ps(lanes, q);
+        for (int k = 0; k < 4; k++) peak = lanes[k] > peak ? lanes[k] : peak;
+        return gainPeakTail(samples, j, count, gain, peak);
+    }
+#endif
+
+#if defined(M1_HAS_AVX512)
+    // GCC 12 warns that the unmasked max and extract forms read an
+    // uninitialized register (their pass-through operand is
+    // _mm512_undefined_ps), so these use the masked ones with every lane set
+    M1_TARGET_AVX512 static __m512 maxAVX512(__m512 a, __m512 b)
+    {
+        return _mm512_mask_max_ps(a, (__mmask16)0xffff, a, b);
+    }
+
+    // 256-bit half of `v`; _mm512_extractf32x8_ps would need AVX512DQ
+    M1_TARGET_AVX512 static __m256 halfAVX512(__m512 v, int upper)
+    {
+        __m512d d = _mm512_castps_pd(v);
+        __m256d h = upper ? _mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), (__mmask8)0xf, d, 1)
+                          : _mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), (__mmask8)0xf, d, 0);
+        return _mm256_castpd_ps(h);
+    }
+
+    M1_TARGET_AVX512 static float gainPeakAVX512(float* samples, int count, float gain, float peak)
+    {
+        int j = 0;
+        const __m512 g = _mm512_set1_ps(gain);
+        __m512 p0 = _mm512_set1_ps(peak), p1 = p0, p2 = p0, p3 = p0;
+        for (; j + 64 <= count; j += 64) {
+            __m512 x0 = _mm512_mul_ps(_mm512_load_ps(samples + j), g);
+            __m512 x1 = _mm512_mul_ps(_mm512_load_ps(samples + j + 16), g);
+            __m512 x2 = _mm512_mul_ps(_mm512_load_ps(samples + j + 32), g);
+            __m512 x3 = _mm512_mul_ps(_mm512_load_ps(samples + j + 48), g);
+            _mm512_store_ps(samples + j, x0);
+            _mm512_store_ps(samples + j + 16, x1);
+            _mm512_store_ps(samples + j + 32, x2);
+            _mm512_store_ps(samples + j + 48, x3);
+            p0 = maxAVX512(p0, _mm512_abs_ps(x0));
+            p1 = maxAVX512(p1, _mm512_abs_ps(x1));
+            p2 = maxAVX512(p2, _mm512_abs_ps(x2));
+            p3 = maxAVX512(p3, _mm512_abs_ps(x3));
+        }
+        for (; j + 16 <= count; j += 16) {
+            __m512 x = _mm512_mul_ps(_mm512_load_ps(samples + j), g);
+            _mm512_store_ps(samples + j, x);
+            p0 = maxAVX512(p0, _mm512_abs_ps(x));
+        }
+        __m512 p = maxAVX512(maxAVX512(p0, p1), maxAVX512(p2, p3));
+        __m256 h = _mm256_max_ps(halfAVX512(p, 0), halfAVX512(p, 1));
+        __m128 q = _mm_max_ps(_mm256_castps256_ps128(h), _mm256_extractf128_ps(h, 1));
+        float lanes[4];
+        _mm_storeu_ps(lanes, q);
+        for (int k = 0; k < 4; k++) peak = lanes[k] > peak ? lanes[k] : peak;
+        return gainPeakTail(samples, j, count, gain, peak);
+    }
+#endif
+
+#if defined(M1_ARCH_NEON)
+    static float gainPeakNEON(float* samples, int count, float gain, float peak)
+    {
+        int j = 0;
+        float32x4_t p0 = vdupq_n_f32(peak), p1 = p0;
+        for (; j + 8 <= count; j += 8) {
+            float32x4_t x0 = vmulq_n_f32(vld1q_f32(samples + j), gain);
+            float32x4_t x1 = vmulq_n_f32(vld1q_f32(samples + j + 4), gain);
+            vst1q_f32(samples + j, x0);
+            vst1q_f32(samples + j + 4, x1);
+            p0 = vmaxq_f32(p0, vabsq_f32(x0));
+            p1 = vmaxq_f32(p1, vabsq_f32(x1));
+        }
+        float lanes[4];
+        vst1q_f32(lanes, vmaxq_f32(p0, p1));
+        for (int k = 0; k < 4; k++) peak = lanes[k] > peak ? lanes[k] : peak;
+        return gainPeakTail(samples, j, count, gain, peak);
+    }
+#endif
+
+    static GainPeakFn selectGainPeak(CpuFeatures::SimdLevel level)
+    {
+#if defined(M1_HAS_AVX512)
+        if (level >= CpuFeatures::SIMD_AVX512) return &gainPeakAVX512;
+#endif
+#if defined(M1_HAS_AVX2)
+        if (level >= CpuFeatures::SIMD_AVX2) return &gainPeakAVX2;
+#endif
+#if defined(M1_HAS_SSE)
+        if (level >= CpuFeatures::SIMD_SSE) return &gainPeakSSE;
+#endif
+#if defined(M1_ARCH_NEON)
+        if (level == CpuFeatures::SIMD_NEON) return &gainPeakNEON;
+#endif
+        (void)level;
+        return &gainPeakScalar;
+    }
+
+public:
+    /*
+     worthIt(kernel, fileChannels)
+     Whether fusing beats the separate passes for this conversion. The
+     bench only has it ahead at AVX2 and AVX-512, for 4 to 16 outputs
+     whose files have a specialised interleave kernel: stereo gains
+     nothing, SSE and wider outputs lose to the separate passes (the tiles
+     get short and the generic interleave loop runs once per tile).
+     */
+    static bool worthIt(const MatrixKernel& matrixKernel, int fileChannels)
+    {
+        int outChannels = matrixKernel.getOutputChannels();
+        return matrixKernel.getLevel() >= CpuFeatures::SIMD_AVX2 && outChannels >= 4 && outChannels <= 16
+            && InterleaveKernels::getInterleave(fileChannels, matrixKernel.getLevel()) != nullptr;
+    }
+
+    // floats setup() takes from the arena
+    static size_t arenaSize(int outChannels)
+    {
+        return BufferArena::planesSize(outChannels, getTileFrames(outChannels));
+    }
+
+    // frames per tile, a multiple of the 16 frame SIMD width
+    static int getTileFrames(int outChannels)
+    {
+        int frames = TILE_FLOATS / (outChannels > 0 ? outChannels : 1) / 16 * 16;
+        return frames < 16 ? 16 : (frames > 256 ? 256 : frames);
+    }
+
+    /*
+     setup(arena, kernel, fileChannels, numFiles)
+     Carves the tile scratch from the job's arena. `kernel` has to stay
+     set up for as long as the stage is used.
+     */
+    void setup(BufferArena& arena, const MatrixKernel& matrixKernel, int numFileChannels, int numOutFiles)
+    {
+        kernel = &matrixKernel;
+        fileChannels = numFileChannels;
+        numFiles = numOutFiles;
+        tileFrames = getTileFrames(kernel->getOutputChannels());
+        arena.allocatePlanes(tile, kernel->getOutputChannels(), tileFrames);
+        inTile.resize(kernel->getInputChannels());
+        gainPeak = selectGainPeak(kernel->getLevel());
+    }
+
+    int getTileFrames() const { return tileFrames; }
+
+    /*
+     process(in, frames, gain, interleaved)
+     Converts `frames` frames of the planar input, applies `gain` and
+     interleaves the result into `interleaved`, which may be null when
+     only the peak is wanted. Returns the absolute peak after gain.
+     */
+    float process(const float* const* in, int frames, float gain, float* interleaved)
+    {
+        float peak = 0.0f;
+        int outChannels = fileChannels * numFiles;
+        for (int j = 0; j < frames; j += tileFrames) {
+            int count = frames - j < tileFrames ? frames - j : tileFrames;
+            for (size_t i = 0; i < inTile.size(); i++) inTile[i] = in[i] + j;
+            kernel->process(inTile.data(), tile.data(), count);
+
+            for (int c = 0; c < outChannels; c++) {
+                peak = gainPeak(tile[c], count, gain, peak);
+            }
+            if (!interleaved) continue;
+            for (int file = 0; file < numFiles; file++) {
+                float* dst = interleaved + (size_t)file * fileChannels * frames + (size_t)j * fileChannels;
+                InterleaveKernels::interleave(tile.data() + file * fileChannels, fileChannels, dst, count);
+            }
+        }
+        return peak;
+    }
+};
+
+#endif /* FusedOutputStage_h */
@@ -0,0 +1,258 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef InputPrefetcher_h
+#define InputPrefetcher_h
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ InputPrefetcher
+ Reads ahead on several input files at once. Every file gets a small ring
+ of planar chunks that a few worker threads keep filled, so a session
+ with dozens of mono stems waits on the slowest file rather than on the
+ sum of all of them, which matters most on network storage.
+
+ A file is read by at most one worker at a time, in order, through the
+ caller's read function; the consumer then copies frames out of the
+ filled chunks. Reader exceptions are rethrown by read().
+
+   prefetcher.setup(channels, chunkFrames, chunksPerFile, threads, readFn);
+   prefetcher.read(file, planes, offset, frames);   // consumer thread
+   prefetcher.pause(); seek the files; prefetcher.resume();
+ */
+class InputPrefetcher
+{
+public:
+    // reads up to `frames` frames of `file` into planes[channel][0..], returns the frames read
+    typedef std::function<int(int file, float** planes, int frames)> ReadFunction;
+
+private:
+    struct Chunk {
+        std::vector<float> samples;
+        std::vector<float*> planes;
+        int frames = 0;
+    };
+
+    struct Source {
+        int channels = 0;
+        std::vector<Chunk> chunks;
+        std::deque<int> filled;   // in file order
+        std::deque<int> free;
+        int readPos = 0;          // frames taken from filled.front()
+        bool scheduled = false;   // queued for or owned by a worker
+        bool ended = false;       // a read came back short
+    };
+
+    std::vector<Source> sources;
+    int chunkFrames = 0;
+    ReadFunction readFn;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work;  // sources queued, pausing or stopping
+    std::condition_variable ready; // chunks filled
+    std::condition_variable idle;  // no read in flight
+    std::deque<int> queue;         // sources with free chunks
+    int busy = 0;
+    bool paused = false;
+    bool stopping = false;
+    std::exception_ptr error;
+
+    // with the lock held
+    void schedule(int index)
+    {
+        Source& source = sources[index];
+        if (source.scheduled || source.ended || paused || source.free.empty()) return;
+        source.scheduled = true;
+        queue.push_back(index);
+        work.notify_one();
+    }
+
+    void workerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            work.wait(lock, [&]() { return stopping || (!paused && !queue.empty()); });
+            if (stopping) return;
+            int index = queue.front();
+            queue.pop_front();
+            Source& source = sources[index];
+            int slot = source.free.front();
+            source.free.pop_front();
+            Chunk& chunk = source.chunks[slot];
+            busy++;
+
+            lock.unlock();
+            int frames = 0;
+            std::exception_ptr failure;
+            try {
+                frames = readFn(index, chunk.planes.data(), chunkFrames);
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            lock.lock();
+
+            busy--;
+            chunk.frames = frames;
+            if (failure) {
+                if (!error) error = failure;
+                source.free.push_front(slot);
+                source.ended = true;
+            } else {
+                source.filled.push_back(slot);
+                if (frames < chunkFrames) source.ended = true;
+            }
+            // files take turns, so one fast file doesn't hog the workers
+            source.scheduled = false;
+            schedule(index);
+            ready.notify_all();
+            if (busy == 0) idle.notify_all();
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+        workers.clear();
+    }
+
+public:
+    InputPrefetcher() {}
+    ~InputPrefetcher() { stop(); }
+
+    InputPrefetcher(const InputPrefetcher&) = delete;
+    InputPrefetcher& operator=(const InputPrefetcher&) = delete;
+
+    static size_t requiredFloats(const std::vector<int>& channels, int chunkFrames, int chunksPerFile)
+    {
+        size_t floats = 0;
+        for (size_t i = 0; i < channels.size(); i++) floats += (size_t)channels[i] * chunkFrames * chunksPerFile;
+        return floats;
+    }
+
+    /*
+     setup(channels, chunkFrames, chunksPerFile, numThreads, read)
+     One source per entry of `channels`. Reading ahead starts right away
+     from wherever the files are positioned.
+     */
+    void setup(const std::vector<int>& channels, int frames, int chunksPerFile, int numThreads, ReadFunction read)
+    {
+        stop();
+        stopping = false;
+        paused = false;
+        busy = 0;
+        error = nullptr;
+        queue.clear();
+        chunkFrames = frames;
+        readFn = read;
+        sources.clear();
+        sources.resize(channels.size());
+        for (size_t i = 0; i < channels.size(); i++) {
+            Source& source = sources[i];
+            source.channels = channels[i];
+            source.chunks.resize(chunksPerFile);
+            for (int c = 0; c < chunksPerFile; c++) {
+                Chunk& chunk = source.chunks[c];
+                chunk.samples.resize((size_t)channels[i] * chunkFrames);
+                chunk.planes.resize(channels[i]);
+                for (int k = 0; k < channels[i]; k++) chunk.planes[k] = chunk.samples.data() + (size_t)k * chunkFrames;
+                source.free.push_back(c);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < sources.size(); i++) schedule((int)i);
+        }
+        numThreads = (std::max)(1, (std::min)(numThreads, (int)sources.size()));
+        for (int i = 0; i < numThreads; i++) {
+            workers.emplace_back(&InputPrefetcher::workerLoop, this);
+        }
+    }
+
+    int getNumThreads() const { return (int)workers.size(); }
+    int getChunkFrames() const { return chunkFrames; }
+
+    /*
+     read(file, planes, offset, frames)
+     Copies up to `frames` frames of `file` into planes[channel][offset + n],
+     waiting for the workers where needed. Returns fewer only at the end
+     of the file.
+     */
+    int read(int file, float** planes, int offset, int frames)
+    {
+        Source& source = sources[file];
+        int done = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (done < frames) {
+            ready.wait(lock, [&]() { return error || !source.filled.empty() || (source.ended && !source.scheduled); });
+            if (error) std::rethrow_exception(error);
+            if (source.filled.empty()) break;
+
+            // filled chunks are left alone by the workers
+            const Chunk& chunk = source.chunks[source.filled.front()];
+            int n = (std::min)(frames - done, chunk.frames - source.readPos);
+            lock.unlock();
+            for (int k = 0; k < source.channels; k++) {
+                memcpy(planes[k] + offset + done, chunk.planes[k] + source.readPos, (size_t)n * sizeof(float));
+            }
+            lock.lock();
+
+            source.readPos += n;
+            done += n;
+            if (source.readPos == chunk.frames) {
+                source.free.push_back(source.filled.front());
+                source.filled.pop_front();
+                source.readPos = 0;
+                schedule(file);
+            }
+        }
+        return done;
+    }
+
+    /*
+     pause()
+     Waits for the reads in flight and drops everything read ahead, the
+     files can be seeked until resume().
+     */
+    void pause()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        paused = true;
+        queue.clear();
+        idle.wait(lock, [&]() { return busy == 0; });
+        for (size_t i = 0; i < sources.size(); i++) {
+            Source& source = sources[i];
+            while (!source.filled.empty()) {
+                source.free.push_back(source.filled.front());
+                source.filled.pop_front();
+            }
+            source.readPos = 0;
+            source.scheduled = false;
+            source.ended = false;
+        }
+    }
+
+    void resume()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        paused = false;
+        error = nullptr;
+        for (size_t i = 0; i < sources.size(); i++) schedule((int)i);
+    }
+};
+
+#endif /* InputPrefetcher_h */
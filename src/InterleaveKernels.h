@@ -0,0 +1,405 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef InterleaveKernels_h
+#define InterleaveKernels_h
+
+#include "CpuFeatures.h"
+
+/*
+ InterleaveKernels
+ Converts between interleaved file frames and the planar process buffers.
+
+ deinterleave(src, channels, dst, offset, frames):
+     dst[k][offset + j] = src[j * channels + k]
+ interleave(src, channels, dst, frames):
+     dst[j * channels + k] = src[k][j]
+
+ Channel counts 2, 4, 8, 10, 12, 14 and 16 get kernels with the channel
+ count fixed at compile time, built from 4x4 (SSE/NEON) or 8x4 (AVX2)
+ register transposes plus a two channel tail. Everything else uses the
+ generic strided loop. The instruction set is picked once through
+ CpuFeatures.
+ */
+class InterleaveKernels
+{
+public:
+    typedef void (*DeinterleaveFn)(const float* src, float* const* dst, int offset, int frames);
+    typedef void (*InterleaveFn)(const float* const* src, float* dst, int frames);
+
+private:
+    // -- scalar -------------------------------------------------------
+
+    static void deinterleaveGeneric(const float* src, int channels, float* const* dst, int offset, int frames)
+    {
+        for (int j = 0; j < frames; j++) {
+            for (int k = 0; k < channels; k++) {
+                dst[k][offset + j] = *src++;
+            }
+        }
+    }
+
+    static void interleaveGeneric(const float* const* src, int channels, float* dst, int frames)
+    {
+        for (int j = 0; j < frames; j++) {
+            for (int k = 0; k < channels; k++) {
+                *dst++ = src[k][j];
+            }
+        }
+    }
+
+    template <int C>
+    static void deinterleaveScalar(const float* src, float* const* dst, int offset, int frames)
+    {
+        deinterleaveGeneric(src, C, dst, offset, frames);
+    }
+
+    template <int C>
+    static void interleaveScalar(const float* const* src, float* dst, int frames)
+    {
+        interleaveGeneric(src, C, dst, frames);
+    }
+
+    // -- SSE ----------------------------------------------------------
+
+#if defined(M1_HAS_SSE)
+    // four frames starting at `f`, channels g..C-1 of which at most 3 remain
+    template <int C>
+    static inline void deinterleaveTailSSE(const float* f, float* const* dst, int g, int pos)
+    {
+        for (; g + 2 <= C; g += 2) {
+            __m128 v0 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(f + g)), (const __m64*)(f + C + g));
+            __m128 v1 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(f + 2 * C + g)), (const __m64*)(f + 3 * C + g));
+            _mm_storeu_ps(dst[g] + pos, _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(dst[g + 1] + pos, _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+        for (; g < C; g++) {
+            for (int r = 0; r < 4; r++) dst[g][pos + r] = f[r * C + g];
+        }
+    }
+
+    template <int C>
+    static inline void interleaveTailSSE(const float* const* src, float* f, int g, int j)
+    {
+        for (; g + 2 <= C; g += 2) {
+            __m128 a = _mm_loadu_ps(src[g] + j);
+            __m128 b = _mm_loadu_ps(src[g + 1] + j);
+            __m128 lo = _mm_unpacklo_ps(a, b);
+            __m128 hi = _mm_unpackhi_ps(a, b);
+            _mm_storel_pi((__m64*)(f + g), lo);
+            _mm_storeh_pi((__m64*)(f + C + g), lo);
+            _mm_storel_pi((__m64*)(f + 2 * C + g), hi);
+            _mm_storeh_pi((__m64*)(f + 3 * C + g), hi);
+        }
+        for (; g < C; g++) {
+            for (int r = 0; r < 4; r++) f[r * C + g] = src[g][j + r];
+        }
+    }
+
+    template <int C>
+    static void deinterleaveSSE(const float* src, float* const* dst, int offset, int frames)
+    {
+        int j = 0;
+        for (; j + 4 <= frames; j += 4) {
+            const float* f = src + j * C;
+            int pos = offset + j;
+            int g = 0;
+            for (; g + 4 <= C; g += 4) {
+                __m128 r0 = _mm_loadu_ps(f + g);
+                __m128 r1 = _mm_loadu_ps(f + C + g);
+                __m128 r2 = _mm_loadu_ps(f + 2 * C + g);
+                __m128 r3 = _mm_loadu_ps(f + 3 * C + g);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                _mm_storeu_ps(dst[g] + pos, r0);
+                _mm_storeu_ps(dst[g + 1] + pos, r1);
+                _mm_storeu_ps(dst[g + 2] + pos, r2);
+                _mm_storeu_ps(dst[g + 3] + pos, r3);
+            }
+            deinterleaveTailSSE<C>(f, dst, g, pos);
+        }
+        deinterleaveGeneric(src + j * C, C, dst, offset + j, frames - j);
+    }
+
+    template <int C>
+    static void interleaveSSE(const float* const* src, float* dst, int frames)
+    {
+        int j = 0;
+        for (; j + 4 <= frames; j += 4) {
+            float* f = dst + j * C;
+            int g = 0;
+            for (; g + 4 <= C; g += 4) {
+                __m128 r0 = _mm_loadu_ps(src[g] + j);
+                __m128 r1 = _mm_loadu_ps(src[g + 1] + j);
+                __m128 r2 = _mm_loadu_ps(src[g + 2] + j);
+                __m128 r3 = _mm_loadu_ps(src[g + 3] + j);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                _mm_storeu_ps(f + g, r0);
+                _mm_storeu_ps(f + C + g, r1);
+                _mm_storeu_ps(f + 2 * C + g, r2);
+                _mm_storeu_ps(f + 3 * C + g, r3);
+            }
+            interleaveTailSSE<C>(src, f, g, j);
+        }
+        const float* rest[C];
+        for (int k = 0; k < C; k++) rest[k] = src[k] + j;
+        interleaveGeneric(rest, C, dst + j * C, frames - j);
+    }
+#endif
+
+    // -- AVX2 ---------------------------------------------------------
+
+#if defined(M1_HAS_AVX2)
+    template <int C>
+    M1_TARGET_AVX2 static void deinterleaveAVX2(const float* src, float* const* dst, int offset, int frames)
+    {
+        int j = 0;
+        for (; j + 8 <= frames; j += 8) {
+            const float* f = src + j * C;
+            int pos = offset + j;
+            int g = 0;
+            for (; g + 4 <= C; g += 4) {
+                // row r holds frame r in the low lane and frame r + 4 in the high lane
+                __m256 r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f + g)), _mm_loadu_ps(f + 4 * C + g), 1);
+                __m256 r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f + C + g)), _mm_loadu_ps(f + 5 * C + g), 1);
+                __m256 r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f + 2 * C + g)), _mm_loadu_ps(f + 6 * C + g), 1);
+                __m256 r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(f + 3 * C + g)), _mm_loadu_ps(f + 7 * C + g), 1);
+                __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+                __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+                __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+                __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+                _mm256_storeu_ps(dst[g] + pos, _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)));
+                _mm256_storeu_ps(dst[g + 1] + pos, _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2)));
+                _mm256_storeu_ps(dst[g + 2] + pos, _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)));
+                _mm256_storeu_ps(dst[g + 3] + pos, _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2)));
+            }
+            if (g < C) {
+                deinterleaveTailSSE<C>(f, dst, g, pos);
+                deinterleaveTailSSE<C>(f + 4 * C, dst, g, pos + 4);
+            }
+        }
+        deinterleaveSSE<C>(src + j * C, dst, offset + j, frames - j);
+    }
+
+    template <int C>
+    M1_TARGET_AVX2 static void interleaveAVX2(const float* const* src, float* dst, int frames)
+    {
+        int j = 0;
+        for (; j + 8 <= frames; j += 8) {
+            float* f = dst + j * C;
+            int g = 0;
+            for (; g + 4 <= C; g += 4) {
+                __m256 r0 = _mm256_loadu_ps(src[g] + j);
+                __m256 r1 = _mm256_loadu_ps(src[g + 1] + j);
+                __m256 r2 = _mm256_loadu_ps(src[g + 2] + j);
+                __m256 r3 = _mm256_loadu_ps(src[g + 3] + j);
+                __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+                __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+                __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+                __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+                // each result holds frame r in the low lane and frame r + 4 in the high lane
+                __m256 c0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 c1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+                __m256 c2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 c3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+                _mm_storeu_ps(f + g, _mm256_castps256_ps128(c0));
+                _mm_storeu_ps(f + C + g, _mm256_castps256_ps128(c1));
+                _mm_storeu_ps(f + 2 * C + g, _mm256_castps256_ps128(c2));
+                _mm_storeu_ps(f + 3 * C + g, _mm256_castps256_ps128(c3));
+                _mm_storeu_ps(f + 4 * C + g, _mm256_extractf128_ps(c0, 1));
+                _mm_storeu_ps(f + 5 * C + g, _mm256_extractf128_ps(c1, 1));
+                _mm_storeu_ps(f + 6 * C + g, _mm256_extractf128_ps(c2, 1));
+                _mm_storeu_ps(f + 7 * C + g, _mm256_extractf128_ps(c3, 1));
+            }
+            if (g < C) {
+                interleaveTailSSE<C>(src, f, g, j);
+                interleaveTailSSE<C>(src, f + 4 * C, g, j + 4);
+            }
+        }
+        const float* rest[C];
+        for (int k = 0; k < C; k++) rest[k] = src[k] + j;
+        interleaveSSE<C>(rest, dst + j * C, frames - j);
+    }
+#endif
+
+    // -- NEON ---------------------------------------------------------
+
+#if defined(M1_ARCH_NEON)
+    static inline void transposeNEON(float32x4_t& r0, float32x4_t& r1, float32x4_t& r2, float32x4_t& r3)
+    {
+        float32x4x2_t p01 = vtrnq_f32(r0, r1);
+        float32x4x2_t p23 = vtrnq_f32(r2, r3);
+        r0 = vcombine_f32(vget_low_f32(p01.val[0]), vget_low_f32(p23.val[0]));
+        r1 = vcombine_f32(vget_low_f32(p01.val[1]), vget_low_f32(p23.val[1]));
+        r2 = vcombine_f32(vget_high_f32(p01.val[0]), vget_high_f32(p23.val[0]));
+        r3 = vcombine_f32(vget_high_f32(p01.val[1]), vget_high_f32(p23.val[1]));
+    }
+
+    template <int C>
+    static void deinterleaveNEON(const float* src, float* const* dst, int offset, int frames)
+    {
+        int j = 0;
+        for (; j + 4 <= frames; j += 4) {
+            const float* f = src + j * C;
+            int pos = offset + j;
+            int g = 0;
+            for (; g + 4 <= C; g += 4) {
+                float32x4_t r0 = vld1q_f32(f + g);
+                float32x4_t r1 = vld1q_f32(f + C + g);
+                float32x4_t r2 = vld1q_f32(f + 2 * C + g);
+                float32x4_t r3 = vld1q_f32(f + 3 * C + g);
+                transposeNEON(r0, r1, r2, r3);
+                vst1q_f32(dst[g] + pos, r0);
+                vst1q_f32(dst[g + 1] + pos, r1);
+                vst1q_f32(dst[g + 2] + pos, r2);
+                vst1q_f32(dst[g + 3] + pos, r3);
+            }
+            for (; g + 2 <= C; g += 2) {
+                float32x4_t v0 = vcombine_f32(vld1_f32(f + g), vld1_f32(f + C + g));
+                float32x4_t v1 = vcombine_f32(vld1_f32(f + 2 * C + g), vld1_f32(f + 3 * C + g));
+                float32x4x2_t u = vuzpq_f32(v0, v1);
+                vst1q_f32(dst[g] + pos, u.val[0]);
+                vst1q_f32(dst[g + 1] + pos, u.val[1]);
+            }
+            for (; g < C; g++) {
+                for (int r = 0; r < 4; r++) dst[g][pos + r] = f[r * C + g];
+            }
+        }
+        deinterleaveGeneric(src + j * C, C, dst, offset + j, frames - j);
+    }
+
+    template <int C>
+    static void interleaveNEON(const float* const* src, float* dst, int frames)
+    {
+        int j = 0;
+        for (; j + 4 <= frames; j += 4) {
+            float* f = dst + j * C;
+            int g = 0;
+            for (; g + 4 <= C; g += 4) {
+                float32x4_t r0 = vld1q_f32(src[g] + j);
+                float32x4_t r1 = vld1q_f32(src[g + 1] + j);
+                float32x4_t r2 = vld1q_f32(src[g + 2] + j);
+                float32x4_t r3 = vld1q_f32(src[g + 3] + j);
+                transposeNEON(r0, r1, r2, r3);
+                vst1q_f32(f + g, r0);
+                vst1q_f32(f + C + g, r1);
+                vst1q_f32(f + 2 * C + g, r2);
+                vst1q_f32(f + 3 * C + g, r3);
+            }
+            for (; g + 2 <= C; g += 2) {
+                float32x4x2_t z = vzipq_f32(vld1q_f32(src[g] + j), vld1q_f32(src[g + 1] + j));
+                vst1_f32(f + g, vget_low_f32(z.val[0]));
+                vst1_f32(f + C + g, vget_high_f32(z.val[0]));
+                vst1_f32(f + 2 * C + g, vget_low_f32(z.val[1]));
+                vst1_f32(f + 3 * C + g, vget_high_f32(z.val[1]));
+            }
+            for (; g < C; g++) {
+                for (int r = 0; r < 4; r++) f[r * C + g] = src[g][j + r];
+            }
+        }
+        const float* rest[C];
+        for (int k = 0; k < C; k++) rest[k] = src[k] + j;
+        interleaveGeneric(rest, C, dst + j * C, frames - j);
+    }
+#endif
+
+    // -- dispatch -----------------------------------------------------
+
+    template <int C>
+    static DeinterleaveFn selectDeinterleave(CpuFeatures::SimdLevel level)
+    {
+#if defined(M1_HAS_AVX2)
+        if (level >= CpuFeatures::SIMD_AVX2) return &deinterleaveAVX2<C>;
+#endif
+#if defined(M1_HAS_SSE)
+        if (level >= CpuFeatures::SIMD_SSE) return &deinterleaveSSE<C>;
+#endif
+#if defined(M1_ARCH_NEON)
+        if (level == CpuFeatures::SIMD_NEON) return &deinterleaveNEON<C>;
+#endif
+        (void)level;
+        return &deinterleaveScalar<C>;
+    }
+
+    template <int C>
+    static InterleaveFn selectInterleave(CpuFeatures::SimdLevel level)
+    {
+#if defined(M1_HAS_AVX2)
+        if (level >= CpuFeatures::SIMD_AVX2) return &interleaveAVX2<C>;
+#endif
+#if defined(M1_HAS_SSE)
+        if (level >= CpuFeatures::SIMD_SSE) return &interleaveSSE<C>;
+#endif
+#if defined(M1_ARCH_NEON)
+        if (level == CpuFeatures::SIMD_NEON) return &interleaveNEON<C>;
+#endif
+        (void)level;
+        return &interleaveScalar<C>;
+    }
+
+public:
+    /*
+     getDeinterleave(channels) / getInterleave(channels)
+     Returns the specialised kernel for the active instruction set, or
+     nullptr when the channel count only has the generic loop.
+     */
+    static DeinterleaveFn getDeinterleave(int channels, CpuFeatures::SimdLevel level = CpuFeatures::get().getLevel())
+    {
+        switch (channels) {
+            case 2: return selectDeinterleave<2>(level);
+            case 4: return selectDeinterleave<4>(level);
+            case 8: return selectDeinterleave<8>(level);
+            case 10: return selectDeinterleave<10>(level);
+            case 12: return selectDeinterleave<12>(level);
+            case 14: return selectDeinterleave<14>(level);
+            case 16: return selectDeinterleave<16>(level);
+            default: return nullptr;
+        }
+    }
+
+    static InterleaveFn getInterleave(int channels, CpuFeatures::SimdLevel level = CpuFeatures::get().getLevel())
+    {
+        switch (channels) {
+            case 2: return selectInterleave<2>(level);
+            case 4: return selectInterleave<4>(level);
+            case 8: return selectInterleave<8>(level);
+            case 10: return selectInterleave<10>(level);
+            case 12: return selectInterleave<12>(level);
+            case 14: return selectInterleave<14>(level);
+            case 16: return selectInterleave<16>(level);
+            default: return nullptr;
+        }
+    }
+
+    static void deinterleave(const float* src, int channels, float* const* dst, int offset, int frames)
+    {
+        DeinterleaveFn fn = getDeinterleave(channels);
+        if (fn) {
+            fn(src, dst, offset, frames);
+        } else {
+            deinterleaveGeneric(src, channels, dst, offset, frames);
+        }
+    }
+
+    static void interleave(const float* const* src, int channels, float* dst, int frames)
+    {
+        InterleaveFn fn = getInterleave(channels);
+        if (fn) {
+            fn(src, dst, frames);
+        } else {
+            interleaveGeneric(src, channels, dst, frames);
+        }
+    }
+
+    // reference loops, kept public for the benchmark
+    static void deinterleaveReference(const float* src, int channels, float* const* dst, int offset, int frames)
+    {
+        deinterleaveGeneric(src, channels, dst, offset, frames);
+    }
+
+    static void interleaveReference(const float* const* src, int channels, float* dst, int frames)
+    {
+        interleaveGeneric(src, channels, dst, frames);
+    }
+};
+
+#endif /* InterleaveKernels_h */
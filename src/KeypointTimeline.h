@@ -0,0 +1,147 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef KeypointTimeline_h
+#define KeypointTimeline_h
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "Mach1AudioTimeline.h"
+
+/*
+ KeypointTimeline
+ The keypoints of every ADM/Atmos object, copied once out of the
+ Mach1AudioObjects into flat arrays (sample, x, y, z, each object a range
+ of them) for the custom points sampler.
+
+ The point of an object at a sample is its last keypoint at or before
+ that sample, or its first keypoint before the object starts. Each object
+ keeps a cursor: samples that move forward advance it keypoint by
+ keypoint, which is O(1) per block for a transcode running in order, and
+ samples that go back (a second pass, a seek) binary search.
+ */
+class KeypointTimeline
+{
+    // keypoints of object i are [begin[i], begin[i + 1])
+    std::vector<size_t> begin;
+    std::vector<long long> samples;
+    std::vector<float> x, y, z;
+
+    std::vector<size_t> cursor;  // current keypoint of each object
+    std::vector<Mach1Point3D> points;
+    long long lastSample = 0;
+
+    void setPoint(size_t object)
+    {
+        size_t k = cursor[object];
+        if (k == begin[object + 1]) return; // no keypoints, stays at the origin
+        points[object].x = x[k];
+        points[object].y = y[k];
+        points[object].z = z[k];
+    }
+
+public:
+    /*
+     build(objects)
+     Copies the keypoints of `objects`, each in sample order, and rewinds.
+     */
+    void build(std::vector<Mach1AudioObject>& objects)
+    {
+        size_t numObjects = objects.size();
+        begin.assign(1, 0);
+        samples.clear();
+        x.clear();
+        y.clear();
+        z.clear();
+        for (size_t i = 0; i < numObjects; i++) {
+            std::vector<Mach1KeyPoint> keyPoints = objects[i].getKeyPoints();
+            std::stable_sort(keyPoints.begin(), keyPoints.end(), [](const Mach1KeyPoint& a, const Mach1KeyPoint& b) { return a.sample < b.sample; });
+            for (size_t k = 0; k < keyPoints.size(); k++) {
+                samples.push_back(keyPoints[k].sample);
+                x.push_back(keyPoints[k].point.x);
+                y.push_back(keyPoints[k].point.y);
+                z.push_back(keyPoints[k].point.z);
+            }
+            begin.push_back(samples.size());
+        }
+        cursor.resize(numObjects);
+        points.assign(numObjects, Mach1Point3D());
+        seek(0);
+    }
+
+    int getNumObjects() const { return (int)points.size(); }
+    int getNumKeyPoints(int object) const { return (int)(begin[object + 1] - begin[object]); }
+
+    // sample of the object's first keypoint, where its audio starts
+    long long getStartSample(int object) const
+    {
+        return getNumKeyPoints(object) > 0 ? samples[begin[object]] : 0;
+    }
+
+    // every sample where some object's point changes, in order
+    std::vector<long long> getBoundaries() const
+    {
+        std::vector<long long> boundaries(samples);
+        std::sort(boundaries.begin(), boundaries.end());
+        boundaries.erase(std::unique(boundaries.begin(), boundaries.end()), boundaries.end());
+        return boundaries;
+    }
+
+    Mach1Point3D getFirstPoint(int object) const
+    {
+        Mach1Point3D point = Mach1Point3D();
+        if (getNumKeyPoints(object) > 0) {
+            size_t k = begin[object];
+            point.x = x[k];
+            point.y = y[k];
+            point.z = z[k];
+        }
+        return point;
+    }
+
+    /*
+     seek(sample)
+     Binary searches every object's keypoint at `sample`.
+     */
+    void seek(long long sample)
+    {
+        for (size_t i = 0; i < cursor.size(); i++) {
+            size_t first = begin[i], last = begin[i + 1];
+            if (first == last) {
+                cursor[i] = last;
+                continue;
+            }
+            // last keypoint at or before `sample`, the first one before the object starts
+            size_t k = std::upper_bound(samples.begin() + first, samples.begin() + last, sample) - samples.begin();
+            cursor[i] = k > first ? k - 1 : first;
+            setPoint(i);
+        }
+        lastSample = sample;
+    }
+
+    /*
+     pointsAt(sample)
+     Points of all objects at `sample`, getNumObjects() of them. The
+     array stays valid until the next call.
+     */
+    Mach1Point3D* pointsAt(long long sample)
+    {
+        if (sample < lastSample) {
+            seek(sample);
+            return points.data();
+        }
+        for (size_t i = 0; i < cursor.size(); i++) {
+            size_t k = cursor[i], last = begin[i + 1];
+            if (k == last || k + 1 == last || samples[k + 1] > sample) continue;
+            while (k + 1 < last && samples[k + 1] <= sample) k++;
+            cursor[i] = k;
+            setPoint(i);
+        }
+        lastSample = sample;
+        return points.data();
+    }
+};
+
+#endif /* KeypointTimeline_h */
@@ -0,0 +1,459 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef MappedAudioReader_h
+#define MappedAudioReader_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "CpuFeatures.h"
+#include "InterleaveKernels.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ MappedAudioReader
+ Zero-copy input backend for RIFF/WAVE, RF64 and BW64 files.
+ The file is memory mapped and the `data` chunk is converted from
+ PCM16/24/32 or float32/64 into planar float buffers without libsndfile's
+ copies: samples are converted in bulk by SIMD kernels into a small
+ interleaved buffer that stays in cache and split into the planes by the
+ SIMD InterleaveKernels.
+
+ open() returns false for anything it does not understand (other containers,
+ compressed formats, platforms without mmap) so callers can fall back to
+ libsndfile. Integer samples are scaled like libsndfile does (1 / 2^(bits-1)).
+ */
+class MappedAudioReader
+{
+public:
+    enum SampleType {
+        SAMPLE_PCM_U8,
+        SAMPLE_PCM_16,
+        SAMPLE_PCM_24,
+        SAMPLE_PCM_32,
+        SAMPLE_FLOAT_32,
+        SAMPLE_FLOAT_64
+    };
+
+private:
+    const unsigned char* map = nullptr;
+    uint64_t mapSize = 0;
+    int fd = -1;
+
+    const unsigned char* data = nullptr; // start of the `data` chunk payload
+    uint64_t numFrames = 0;
+    uint64_t position = 0;               // in frames
+
+    int numChannels = 0;
+    int sampleRate = 0;
+    int bitsPerSample = 0;
+    int blockAlign = 0;
+    SampleType sampleType = SAMPLE_PCM_16;
+
+    static uint16_t readU16(const unsigned char* p)
+    {
+        return (uint16_t)(p[0] | (p[1] << 8));
+    }
+
+    static uint32_t readU32(const unsigned char* p)
+    {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    static uint64_t readU64(const unsigned char* p)
+    {
+        return (uint64_t)readU32(p) | ((uint64_t)readU32(p + 4) << 32);
+    }
+
+    /*
+     parse()
+     Walks the chunk list of the mapped file, picking up `ds64` (RF64/BW64
+     64-bit sizes), `fmt ` and `data`.
+     */
+    bool parse()
+    {
+        if (mapSize < 12) return false;
+        bool isRiff = memcmp(map, "RIFF", 4) == 0;
+        bool isRf64 = memcmp(map, "RF64", 4) == 0 || memcmp(map, "BW64", 4) == 0;
+        if (!(isRiff || isRf64) || memcmp(map + 8, "WAVE", 4) != 0) return false;
+
+        uint64_t ds64DataSize = 0;
+        bool foundFmt = false;
+        uint16_t formatTag = 0;
+        uint64_t pos = 12;
+
+        while (pos + 8 <= mapSize) {
+            const unsigned char* chunk = map + pos;
+            uint64_t chunkSize = readU32(chunk + 4);
+            const unsigned char* payload = chunk + 8;
+
+            if (memcmp(chunk, "ds64", 4) == 0 && chunkSize >= 24 && pos + 8 + 24 <= mapSize) {
+                ds64DataSize = readU64(payload + 8);
+            } else if (memcmp(chunk, "fmt ", 4) == 0 && chunkSize >= 16 && pos + 8 + 16 <= mapSize) {
+                formatTag = readU16(payload);
+                numChannels = readU16(payload + 2);
+                sampleRate = (int)readU32(payload + 4);
+                blockAlign = readU16(payload + 12);
+                bitsPerSample = readU16(payload + 14);
+                // WAVE_FORMAT_EXTENSIBLE: the real format tag leads the subformat GUID
+                if (formatTag == 0xFFFE && chunkSize >= 40 && pos + 8 + 40 <= mapSize) {
+                    formatTag = readU16(payload + 24);
+                }
+                foundFmt = true;
+            } else if (memcmp(chunk, "data", 4) == 0) {
+                if (!foundFmt) return false;
+                uint64_t dataSize = chunkSize;
+                if (isRf64 && chunkSize == 0xFFFFFFFF) {
+                    dataSize = ds64DataSize;
+                }
+                // tolerate truncated files the same way libsndfile does
+                if (pos + 8 + dataSize > mapSize) {
+                    dataSize = mapSize - (pos + 8);
+                }
+                data = payload;
+                return setupSampleType(formatTag, dataSize);
+            }
+
+            if (isRf64 && chunkSize == 0xFFFFFFFF) return false;
+            pos += 8 + chunkSize + (chunkSize & 1); // chunks are word aligned
+        }
+        return false;
+    }
+
+    bool setupSampleType(uint16_t formatTag, uint64_t dataSize)
+    {
+        if (numChannels <= 0 || blockAlign <= 0 || blockAlign != numChannels * ((bitsPerSample + 7) / 8)) return false;
+        if (!parseSampleType(formatTag, bitsPerSample, sampleType)) return false;
+        numFrames = dataSize / blockAlign;
+        position = 0;
+        return true;
+    }
+
+    // interleaved samples converted per pass of convertPlanar
+    static const int CHUNK_SAMPLES = 8192;
+
+    template <typename Convert>
+    static void demux(const unsigned char* src, int channels, int stride, float** planes, int offset, int frames, Convert convert)
+    {
+        for (int j = 0; j < frames; j++) {
+            const unsigned char* frame = src + (size_t)j * stride;
+            for (int k = 0; k < channels; k++) {
+                planes[k][offset + j] = convert(frame, k);
+            }
+        }
+    }
+
+    static float sampleU8(const unsigned char* f, int k) { return ((int)f[k] - 128) * (1.0f / 128.0f); }
+    static float samplePcm16(const unsigned char* f, int k) { return (int16_t)readU16(f + k * 2) * (1.0f / 32768.0f); }
+    static float samplePcm32(const unsigned char* f, int k) { return (float)((int32_t)readU32(f + k * 4) * (1.0 / 2147483648.0)); }
+
+    static float samplePcm24(const unsigned char* f, int k)
+    {
+        const unsigned char* s = f + k * 3;
+        int32_t v = (int32_t)(((uint32_t)s[0] << 8) | ((uint32_t)s[1] << 16) | ((uint32_t)s[2] << 24)) >> 8;
+        return v * (1.0f / 8388608.0f);
+    }
+
+    static float sampleFloat32(const unsigned char* f, int k)
+    {
+        float v;
+        memcpy(&v, f + k * 4, sizeof(v));
+        return v;
+    }
+
+    static float sampleFloat64(const unsigned char* f, int k)
+    {
+        double v;
+        memcpy(&v, f + k * 8, sizeof(v));
+        return (float)v;
+    }
+
+    // contiguous samples, the frame is the whole run
+    static void toFloatScalar(const unsigned char* src, SampleType type, float* dst, size_t samples)
+    {
+        switch (type) {
+            case SAMPLE_PCM_U8: for (size_t i = 0; i < samples; i++) dst[i] = sampleU8(src, (int)i); break;
+            case SAMPLE_PCM_16: for (size_t i = 0; i < samples; i++) dst[i] = samplePcm16(src + 2 * i, 0); break;
+            case SAMPLE_PCM_24: for (size_t i = 0; i < samples; i++) dst[i] = samplePcm24(src + 3 * i, 0); break;
+            case SAMPLE_PCM_32: for (size_t i = 0; i < samples; i++) dst[i] = samplePcm32(src + 4 * i, 0); break;
+            case SAMPLE_FLOAT_32: memcpy(dst, src, samples * sizeof(float)); break;
+            case SAMPLE_FLOAT_64: for (size_t i = 0; i < samples; i++) dst[i] = sampleFloat64(src + 8 * i, 0); break;
+        }
+    }
+
+    // int32 * 2^-31 in float is exact after the one rounding of cvtepi32,
+    // the same value as the double product of samplePcm32
+
+#if defined(M1_HAS_SSE)
+    static size_t toFloatSSE(const unsigned char* src, SampleType type, float* dst, size_t samples)
+    {
+        size_t i = 0;
+        if (type == SAMPLE_PCM_16) {
+            const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+            for (; i + 8 <= samples; i += 8) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(src + 2 * i));
+                __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), v), 16);
+                __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), v), 16);
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+                _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+            }
+        } else if (type == SAMPLE_PCM_32) {
+            const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+            for (; i + 4 <= samples; i += 4) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(src + 4 * i));
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+            }
+        }
+        return i;
+    }
+#endif
+
+#if defined(M1_HAS_AVX2)
+    M1_TARGET_AVX2 static size_t toFloatAVX2(const unsigned char* src, SampleType type, float* dst, size_t samples)
+    {
+        size_t i = 0;
+        if (type == SAMPLE_PCM_16) {
+            const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+            for (; i + 8 <= samples; i += 8) {
+                __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + 2 * i)));
+                _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+            }
+        } else if (type == SAMPLE_PCM_24) {
+            // 4 samples per 128-bit lane, each moved to the top 3 bytes of its
+            // int32 and shifted down with the sign; the two 16 byte loads read
+            // 4 bytes past the 8 samples, so the last ones go the scalar way
+            const __m256 scale = _mm256_set1_ps(1.0f / 8388608.0f);
+            const __m256i spread = _mm256_setr_epi8(
+                -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+            for (; i + 10 <= samples; i += 8) {
+                const unsigned char* p = src + 3 * i;
+                __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)p)), _mm_loadu_si128((const __m128i*)(p + 12)), 1);
+                v = _mm256_srai_epi32(_mm256_shuffle_epi8(v, spread), 8);
+                _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+            }
+        } else if (type == SAMPLE_PCM_32) {
+            const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+            for (; i + 8 <= samples; i += 8) {
+                __m256i v = _mm256_loadu_si256((const __m256i*)(src + 4 * i));
+                _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+            }
+        }
+        return i;
+    }
+#endif
+
+#if defined(M1_ARCH_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+    static size_t toFloatNEON(const unsigned char* src, SampleType type, float* dst, size_t samples)
+    {
+        size_t i = 0;
+        if (type == SAMPLE_PCM_16) {
+            for (; i + 8 <= samples; i += 8) {
+                int16x8_t v = vld1q_s16((const int16_t*)(src + 2 * i));
+                vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), 1.0f / 32768.0f));
+                vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), 1.0f / 32768.0f));
+            }
+        } else if (type == SAMPLE_PCM_32) {
+            for (; i + 4 <= samples; i += 4) {
+                vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32((const int32_t*)(src + 4 * i))), 1.0f / 2147483648.0f));
+            }
+        }
+        return i;
+    }
+#endif
+
+    /*
+     toFloat(src, type, dst, samples)
+     Converts contiguous little endian samples with the kernels of the
+     active instruction set, the remainder and other types in scalar.
+     */
+    static void toFloat(const unsigned char* src, SampleType type, float* dst, size_t samples)
+    {
+        size_t done = 0;
+        CpuFeatures::SimdLevel level = CpuFeatures::get().getLevel();
+        (void)level;
+#if defined(M1_HAS_AVX2)
+        if (level >= CpuFeatures::SIMD_AVX2) done = toFloatAVX2(src, type, dst, samples);
+        else
+#endif
+#if defined(M1_HAS_SSE)
+        if (level >= CpuFeatures::SIMD_SSE) done = toFloatSSE(src, type, dst, samples);
+#endif
+#if defined(M1_ARCH_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+        if (level == CpuFeatures::SIMD_NEON) done = toFloatNEON(src, type, dst, samples);
+#endif
+        size_t bytes = type == SAMPLE_PCM_U8 ? 1 : type == SAMPLE_PCM_16 ? 2 : type == SAMPLE_PCM_24 ? 3 : type == SAMPLE_FLOAT_64 ? 8 : 4;
+        toFloatScalar(src + done * bytes, type, dst + done, samples - done);
+    }
+
+public:
+    MappedAudioReader() {}
+    ~MappedAudioReader() { close(); }
+
+    MappedAudioReader(const MappedAudioReader&) = delete;
+    MappedAudioReader& operator=(const MappedAudioReader&) = delete;
+
+    /*
+     open(path)
+     Maps the file and locates its `fmt ` and `data` chunks.
+     Returns false if the file can't be handled by this backend.
+     */
+    bool open(const std::string& path)
+    {
+        close();
+#ifdef _WIN32
+        (void)path;
+        return false;
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+            close();
+            return false;
+        }
+        mapSize = (uint64_t)st.st_size;
+        void* ptr = mmap(nullptr, (size_t)mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            map = nullptr;
+            close();
+            return false;
+        }
+        map = (const unsigned char*)ptr;
+        madvise(ptr, (size_t)mapSize, MADV_SEQUENTIAL);
+
+        if (!parse()) {
+            close();
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        if (map) munmap((void*)map, (size_t)mapSize);
+        if (fd >= 0) ::close(fd);
+#endif
+        map = nullptr;
+        mapSize = 0;
+        fd = -1;
+        data = nullptr;
+        numFrames = 0;
+        position = 0;
+    }
+
+    bool isOpened() const { return data != nullptr; }
+    int channels() const { return numChannels; }
+    int samplerate() const { return sampleRate; }
+    uint64_t frames() const { return numFrames; }
+    SampleType getSampleType() const { return sampleType; }
+    int getBlockAlign() const { return blockAlign; }
+    uint64_t getDataOffset() const { return data ? (uint64_t)(data - map) : 0; } // of the `data` payload
+
+    void seek(uint64_t frame)
+    {
+        position = frame < numFrames ? frame : numFrames;
+    }
+
+    /*
+     parseSampleType(formatTag, bitsPerSample, type)
+     Sample type of a `fmt ` chunk's PCM (1) or IEEE float (3) format tag.
+     */
+    static bool parseSampleType(uint16_t formatTag, int bitsPerSample, SampleType& type)
+    {
+        if (formatTag == 1) {
+            if (bitsPerSample == 8) type = SAMPLE_PCM_U8;
+            else if (bitsPerSample == 16) type = SAMPLE_PCM_16;
+            else if (bitsPerSample == 24) type = SAMPLE_PCM_24;
+            else if (bitsPerSample == 32) type = SAMPLE_PCM_32;
+            else return false;
+        } else if (formatTag == 3) {
+            if (bitsPerSample == 32) type = SAMPLE_FLOAT_32;
+            else if (bitsPerSample == 64) type = SAMPLE_FLOAT_64;
+            else return false;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    /*
+     convertPlanar(src, type, channels, stride, planes, offset, frames)
+     Converts `frames` interleaved frames of `stride` bytes into
+     planes[channel][offset + n]. `stride` is the frame size of the
+     sample type, as setupSampleType checks.
+
+     Mono converts straight into its plane. Channel counts with a SIMD
+     deinterleave kernel convert a chunk at a time into an interleaved
+     float buffer that stays in cache and split it with the kernel (float32
+     splits straight from the source when it is aligned); the others, and
+     types without a vector conversion, use the per sample loop, which
+     converts on the way.
+     */
+    static void convertPlanar(const unsigned char* src, SampleType type, int channels, int stride, float** planes, int offset, int frames)
+    {
+        if (frames <= 0) return;
+        if (channels == 1) {
+            toFloat(src, type, planes[0] + offset, (size_t)frames);
+            return;
+        }
+
+        // without vector kernels (and for 24-bit below AVX2) converting and
+        // splitting in two passes loses to converting on the way
+        CpuFeatures::SimdLevel level = CpuFeatures::get().getLevel();
+        bool bulk = type == SAMPLE_PCM_24 ? level >= CpuFeatures::SIMD_AVX2 : level != CpuFeatures::SIMD_SCALAR;
+        InterleaveKernels::DeinterleaveFn split = InterleaveKernels::getDeinterleave(channels);
+        if (split && bulk && channels <= CHUNK_SAMPLES) {
+            if (type == SAMPLE_FLOAT_32 && ((uintptr_t)src % sizeof(float)) == 0) {
+                split((const float*)src, planes, offset, frames);
+                return;
+            }
+            float scratch[CHUNK_SAMPLES];
+            int chunkFrames = CHUNK_SAMPLES / channels;
+            for (int done = 0; done < frames; done += chunkFrames) {
+                int n = (std::min)(chunkFrames, frames - done);
+                toFloat(src + (size_t)done * stride, type, scratch, (size_t)n * channels);
+                split(scratch, planes, offset + done, n);
+            }
+            return;
+        }
+
+        switch (type) {
+            case SAMPLE_PCM_U8: demux(src, channels, stride, planes, offset, frames, sampleU8); break;
+            case SAMPLE_PCM_16: demux(src, channels, stride, planes, offset, frames, samplePcm16); break;
+            case SAMPLE_PCM_24: demux(src, channels, stride, planes, offset, frames, samplePcm24); break;
+            case SAMPLE_PCM_32: demux(src, channels, stride, planes, offset, frames, samplePcm32); break;
+            case SAMPLE_FLOAT_32: demux(src, channels, stride, planes, offset, frames, sampleFloat32); break;
+            case SAMPLE_FLOAT_64: demux(src, channels, stride, planes, offset, frames, sampleFloat64); break;
+        }
+    }
+
+    /*
+     readPlanar(planes, offset, frames)
+     Converts up to `frames` frames from the current position into
+     planes[channel][offset + n] and advances. Returns the frames read.
+     */
+    int readPlanar(float** planes, int offset, int frames)
+    {
+        uint64_t available = numFrames - position;
+        if ((uint64_t)frames > available) frames = (int)available;
+        if (frames <= 0) return 0;
+
+        convertPlanar(data + position * blockAlign, sampleType, numChannels, blockAlign, planes, offset, frames);
+        position += frames;
+        return frames;
+    }
+};
+
+#endif /* MappedAudioReader_h */
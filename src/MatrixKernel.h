@@ -0,0 +1,558 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef MatrixKernel_h
+#define MatrixKernel_h
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "CpuFeatures.h"
+#include "BufferArena.h"
+
+/*
+ MatrixKernel
+ Planar matrix conversion, the work Mach1Transcode::processConversion()
+ does for a fixed conversion matrix:
+
+     out[o][j] = sum over i of coeffs[o][i] * in[i][j]
+
+ The matrix from getMatrixConversion() (rows are output channels,
+ LAYOUT_OUT_IN) is copied once into a flat, 64-byte aligned row-major block. The SIMD
+ kernels compute four output rows at a time over 2 vectors of frames,
+ so each input load feeds eight accumulators and every coefficient is a
+ broadcast from the flat block. The instruction set is picked once through
+ CpuFeatures; the scalar loop is the reference.
+
+ Many conversions are mostly zeros (channel beds into M1Spatial, format
+ pairs with passthrough channels), so setMatrix() also counts the non
+ zero coefficients and picks a strategy:
+     dense    - the blocked kernels above
+     sparse   - per output row, gathers only the inputs it uses (CSR)
+     permute  - every output is one input, a scaled input or silence,
+                done with copies and single multiplies
+ A kernel specialized for the channel counts (FixedMatrixKernels) can be
+ set on top with setFixedProcess().
+ */
+class MatrixKernel
+{
+public:
+    typedef void (*ProcessFn)(const float* coeffs, int inChannels, int outChannels, const float* const* in, float* const* out, int frames);
+    typedef void (*GatherFn)(const int* rowStart, const int* columns, const float* values, int outChannels, const float* const* in, float* const* out, int frames);
+
+    enum Strategy {
+        STRATEGY_DENSE = 0,
+        STRATEGY_SPARSE,
+        STRATEGY_PERMUTE,
+        STRATEGY_FIXED
+    };
+
+    // how the rows of a matrix handed to setMatrix() are laid out
+    enum Layout {
+        LAYOUT_OUT_IN = 0, // matrix[out][in], as Mach1Transcode::getMatrixConversion() returns it
+        LAYOUT_IN_OUT      // matrix[in][out]
+    };
+
+    // coefficients below -180dB are treated as zero
+    static constexpr float ZERO_THRESHOLD = 1e-9f;
+
+private:
+    BufferArena storage;
+    float* coeffs = nullptr;
+    int inChannels = 0;
+    int outChannels = 0;
+    ProcessFn fn = nullptr;
+    CpuFeatures::SimdLevel level = CpuFeatures::SIMD_SCALAR;
+
+    // non zero coefficients of each output row, CSR layout
+    std::vector<int> rowStart;
+    std::vector<int> columns;
+    std::vector<float> values;
+    GatherFn gatherFn = nullptr;
+    ProcessFn fixedFn = nullptr;
+    Strategy strategy = STRATEGY_DENSE;
+
+    // -- scalar -------------------------------------------------------
+
+    static void processScalar(const float* coeffs, int inChannels, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        for (int o = 0; o < outChannels; o++) {
+            const float* row = coeffs + (size_t)o * inChannels;
+            float* dst = out[o];
+            for (int j = 0; j < frames; j++) dst[j] = 0.0f;
+            for (int i = 0; i < inChannels; i++) {
+                const float c = row[i];
+                const float* src = in[i];
+                for (int j = 0; j < frames; j++) dst[j] += c * src[j];
+            }
+        }
+    }
+
+    // frames [first, frames) of rows [o, o + rows), for the SIMD tails
+    static void rowsTail(const float* coeffs, int inChannels, int o, int rows, const float* const* in, float* const* out, int first, int frames)
+    {
+        for (int r = o; r < o + rows; r++) {
+            const float* row = coeffs + (size_t)r * inChannels;
+            for (int j = first; j < frames; j++) {
+                float sum = 0.0f;
+                for (int i = 0; i < inChannels; i++) sum += row[i] * in[i][j];
+                out[r][j] = sum;
+            }
+        }
+    }
+
+    // -- SSE ----------------------------------------------------------
+
+#if defined(M1_HAS_SSE)
+    template <int R>
+    static void rowsSSE(const float* coeffs, int inChannels, int o, const float* const* in, float* const* out, int frames)
+    {
+        const float* rows = coeffs + (size_t)o * inChannels;
+        int j = 0;
+        for (; j + 8 <= frames; j += 8) {
+            __m128 acc0[R], acc1[R];
+            for (int r = 0; r < R; r++) acc0[r] = acc1[r] = _mm_setzero_ps();
+            for (int i = 0; i < inChannels; i++) {
+                __m128 x0 = _mm_loadu_ps(in[i] + j);
+                __m128 x1 = _mm_loadu_ps(in[i] + j + 4);
+                for (int r = 0; r < R; r++) {
+                    __m128 c = _mm_set1_ps(rows[r * inChannels + i]);
+                    acc0[r] = _mm_add_ps(acc0[r], _mm_mul_ps(c, x0));
+                    acc1[r] = _mm_add_ps(acc1[r], _mm_mul_ps(c, x1));
+                }
+            }
+            for (int r = 0; r < R; r++) {
+                _mm_storeu_ps(out[o + r] + j, acc0[r]);
+                _mm_storeu_ps(out[o + r] + j + 4, acc1[r]);
+            }
+        }
+        rowsTail(coeffs, inChannels, o, R, in, out, j, frames);
+    }
+
+    static void processSSE(const float* coeffs, int inChannels, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        int o = 0;
+        for (; o + 4 <= outChannels; o += 4) rowsSSE<4>(coeffs, inChannels, o, in, out, frames);
+        for (; o < outChannels; o++) rowsSSE<1>(coeffs, inChannels, o, in, out, frames);
+    }
+#endif
+
+    // -- AVX2 ---------------------------------------------------------
+
+#if defined(M1_HAS_AVX2)
+    template <int R>
+    M1_TARGET_AVX2 static void rowsAVX2(const float* coeffs, int inChannels, int o, const float* const* in, float* const* out, int frames)
+    {
+        const float* rows = coeffs + (size_t)o * inChannels;
+        int j = 0;
+        for (; j + 16 <= frames; j += 16) {
+            __m256 acc0[R], acc1[R];
+            for (int r = 0; r < R; r++) acc0[r] = acc1[r] = _mm256_setzero_ps();
+            for (int i = 0; i < inChannels; i++) {
+                __m256 x0 = _mm256_loadu_ps(in[i] + j);
+                __m256 x1 = _mm256_loadu_ps(in[i] + j + 8);
+                for (int r = 0; r < R; r++) {
+                    __m256 c = _mm256_broadcast_ss(rows + r * inChannels + i);
+                    acc0[r] = _mm256_fmadd_ps(c, x0, acc0[r]);
+                    acc1[r] = _mm256_fmadd_ps(c, x1, acc1[r]);
+                }
+            }
+            for (int r = 0; r < R; r++) {
+                _mm256_storeu_ps(out[o + r] + j, acc0[r]);
+                _mm256_storeu_ps(out[o + r] + j + 8, acc1[r]);
+            }
+        }
+        for (; j + 8 <= frames; j += 8) {
+            __m256 acc[R];
+            for (int r = 0; r < R; r++) acc[r] = _mm256_setzero_ps();
+            for (int i = 0; i < inChannels; i++) {
+                __m256 x = _mm256_loadu_ps(in[i] + j);
+                for (int r = 0; r < R; r++) {
+                    acc[r] = _mm256_fmadd_ps(_mm256_broadcast_ss(rows + r * inChannels + i), x, acc[r]);
+                }
+            }
+            for (int r = 0; r < R; r++) _mm256_storeu_ps(out[o + r] + j, acc[r]);
+        }
+        rowsTail(coeffs, inChannels, o, R, in, out, j, frames);
+    }
+
+    M1_TARGET_AVX2 static void processAVX2(const float* coeffs, int inChannels, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        int o = 0;
+        for (; o + 4 <= outChannels; o += 4) rowsAVX2<4>(coeffs, inChannels, o, in, out, frames);
+        for (; o < outChannels; o++) rowsAVX2<1>(coeffs, inChannels, o, in, out, frames);
+    }
+#endif
+
+    // -- AVX-512 ------------------------------------------------------
+
+#if defined(M1_HAS_AVX512)
+    template <int R>
+    M1_TARGET_AVX512 static void rowsAVX512(const float* coeffs, int inChannels, int o, const float* const* in, float* const* out, int frames)
+    {
+        const float* rows = coeffs + (size_t)o * inChannels;
+        int j = 0;
+        for (; j + 32 <= frames; j += 32) {
+            __m512 acc0[R], acc1[R];
+            for (int r = 0; r < R; r++) acc0[r] = acc1[r] = _mm512_setzero_ps();
+            for (int i = 0; i < inChannels; i++) {
+                __m512 x0 = _mm512_loadu_ps(in[i] + j);
+                __m512 x1 = _mm512_loadu_ps(in[i] + j + 16);
+                for (int r = 0; r < R; r++) {
+                    __m512 c = _mm512_set1_ps(rows[r * inChannels + i]);
+                    acc0[r] = _mm512_fmadd_ps(c, x0, acc0[r]);
+                    acc1[r] = _mm512_fmadd_ps(c, x1, acc1[r]);
+                }
+            }
+            for (int r = 0; r < R; r++) {
+                _mm512_storeu_ps(out[o + r] + j, acc0[r]);
+                _mm512_storeu_ps(out[o + r] + j + 16, acc1[r]);
+            }
+        }
+        // masked loads and stores cover the last partial vectors
+        for (; j < frames; j += 16) {
+            int n = frames - j < 16 ? frames - j : 16;
+            __mmask16 mask = (__mmask16)((1u << n) - 1);
+            __m512 acc[R];
+            for (int r = 0; r < R; r++) acc[r] = _mm512_setzero_ps();
+            for (int i = 0; i < inChannels; i++) {
+                __m512 x = _mm512_maskz_loadu_ps(mask, in[i] + j);
+                for (int r = 0; r < R; r++) {
+                    acc[r] = _mm512_fmadd_ps(_mm512_set1_ps(rows[r * inChannels + i]), x, acc[r]);
+                }
+            }
+            for (int r = 0; r < R; r++) _mm512_mask_storeu_ps(out[o + r] + j, mask, acc[r]);
+        }
+    }
+
+    M1_TARGET_AVX512 static void processAVX512(const float* coeffs, int inChannels, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        int o = 0;
+        for (; o + 4 <= outChannels; o += 4) rowsAVX512<4>(coeffs, inChannels, o, in, out, frames);
+        for (; o < outChannels; o++) rowsAVX512<1>(coeffs, inChannels, o, in, out, frames);
+    }
+#endif
+
+    // -- NEON ---------------------------------------------------------
+
+#if defined(M1_ARCH_NEON)
+    static inline float32x4_t fmaNEON(float32x4_t acc, float32x4_t a, float32x4_t b)
+    {
+#if defined(__aarch64__) || defined(_M_ARM64)
+        return vfmaq_f32(acc, a, b);
+#else
+        return vmlaq_f32(acc, a, b);
+#endif
+    }
+
+    template <int R>
+    static void rowsNEON(const float* coeffs, int inChannels, int o, const float* const* in, float* const* out, int frames)
+    {
+        const float* rows = coeffs + (size_t)o * inChannels;
+        int j = 0;
+        for (; j + 8 <= frames; j += 8) {
+            float32x4_t acc0[R], acc1[R];
+            for (int r = 0; r < R; r++) acc0[r] = acc1[r] = vdupq_n_f32(0.0f);
+            for (int i = 0; i < inChannels; i++) {
+                float32x4_t x0 = vld1q_f32(in[i] + j);
+                float32x4_t x1 = vld1q_f32(in[i] + j + 4);
+                for (int r = 0; r < R; r++) {
+                    float32x4_t c = vdupq_n_f32(rows[r * inChannels + i]);
+                    acc0[r] = fmaNEON(acc0[r], c, x0);
+                    acc1[r] = fmaNEON(acc1[r], c, x1);
+                }
+            }
+            for (int r = 0; r < R; r++) {
+                vst1q_f32(out[o + r] + j, acc0[r]);
+                vst1q_f32(out[o + r] + j + 4, acc1[r]);
+            }
+        }
+        rowsTail(coeffs, inChannels, o, R, in, out, j, frames);
+    }
+
+    static void processNEON(const float* coeffs, int inChannels, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        int o = 0;
+        for (; o + 4 <= outChannels; o += 4) rowsNEON<4>(coeffs, inChannels, o, in, out, frames);
+        for (; o < outChannels; o++) rowsNEON<1>(coeffs, inChannels, o, in, out, frames);
+    }
+#endif
+
+    // -- sparse and permute -------------------------------------------
+
+    static void gatherScalar(const int* rowStart, const int* columns, const float* values, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        for (int o = 0; o < outChannels; o++) {
+            float* dst = out[o];
+            for (int j = 0; j < frames; j++) dst[j] = 0.0f;
+            for (int k = rowStart[o]; k < rowStart[o + 1]; k++) {
+                const float c = values[k];
+                const float* src = in[columns[k]];
+                for (int j = 0; j < frames; j++) dst[j] += c * src[j];
+            }
+        }
+    }
+
+    static void gatherTail(const int* rowStart, const int* columns, const float* values, int o, const float* const* in, float* const* out, int first, int frames)
+    {
+        for (int j = first; j < frames; j++) {
+            float sum = 0.0f;
+            for (int k = rowStart[o]; k < rowStart[o + 1]; k++) sum += values[k] * in[columns[k]][j];
+            out[o][j] = sum;
+        }
+    }
+
+    static void processPermute(const int* rowStart, const int* columns, const float* values, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        for (int o = 0; o < outChannels; o++) {
+            float* dst = out[o];
+            if (rowStart[o] == rowStart[o + 1]) {
+                memset(dst, 0, (size_t)frames * sizeof(float));
+                continue;
+            }
+            const float c = values[rowStart[o]];
+            const float* src = in[columns[rowStart[o]]];
+            if (c == 1.0f) {
+                if (dst != src) memcpy(dst, src, (size_t)frames * sizeof(float));
+            } else {
+                for (int j = 0; j < frames; j++) dst[j] = c * src[j];
+            }
+        }
+    }
+
+#if defined(M1_HAS_SSE)
+    static void gatherSSE(const int* rowStart, const int* columns, const float* values, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        for (int o = 0; o < outChannels; o++) {
+            int j = 0;
+            for (; j + 8 <= frames; j += 8) {
+                __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+                for (int k = rowStart[o]; k < rowStart[o + 1]; k++) {
+                    __m128 c = _mm_set1_ps(values[k]);
+                    const float* src = in[columns[k]] + j;
+                    acc0 = _mm_add_ps(acc0, _mm_mul_ps(c, _mm_loadu_ps(src)));
+                    acc1 = _mm_add_ps(acc1, _mm_mul_ps(c, _mm_loadu_ps(src + 4)));
+                }
+                _mm_storeu_ps(out[o] + j, acc0);
+                _mm_storeu_ps(out[o] + j + 4, acc1);
+            }
+            gatherTail(rowStart, columns, values, o, in, out, j, frames);
+        }
+    }
+#endif
+
+#if defined(M1_HAS_AVX2)
+    M1_TARGET_AVX2 static void gatherAVX2(const int* rowStart, const int* columns, const float* values, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        for (int o = 0; o < outChannels; o++) {
+            int j = 0;
+            for (; j + 16 <= frames; j += 16) {
+                __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+                for (int k = rowStart[o]; k < rowStart[o + 1]; k++) {
+                    __m256 c = _mm256_broadcast_ss(values + k);
+                    const float* src = in[columns[k]] + j;
+                    acc0 = _mm256_fmadd_ps(c, _mm256_loadu_ps(src), acc0);
+                    acc1 = _mm256_fmadd_ps(c, _mm256_loadu_ps(src + 8), acc1);
+                }
+                _mm256_storeu_ps(out[o] + j, acc0);
+                _mm256_storeu_ps(out[o] + j + 8, acc1);
+            }
+            gatherTail(rowStart, columns, values, o, in, out, j, frames);
+        }
+    }
+#endif
+
+#if defined(M1_ARCH_NEON)
+    static void gatherNEON(const int* rowStart, const int* columns, const float* values, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        for (int o = 0; o < outChannels; o++) {
+            int j = 0;
+            for (; j + 8 <= frames; j += 8) {
+                float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+                for (int k = rowStart[o]; k < rowStart[o + 1]; k++) {
+                    float32x4_t c = vdupq_n_f32(values[k]);
+                    const float* src = in[columns[k]] + j;
+                    acc0 = fmaNEON(acc0, c, vld1q_f32(src));
+                    acc1 = fmaNEON(acc1, c, vld1q_f32(src + 4));
+                }
+                vst1q_f32(out[o] + j, acc0);
+                vst1q_f32(out[o] + j + 4, acc1);
+            }
+            gatherTail(rowStart, columns, values, o, in, out, j, frames);
+        }
+    }
+#endif
+
+    // row gathers are bound by loads, AVX-512 gains nothing over AVX2 here
+    static GatherFn getGather(CpuFeatures::SimdLevel level)
+    {
+#if defined(M1_HAS_AVX2)
+        if (level >= CpuFeatures::SIMD_AVX2) return &gatherAVX2;
+#endif
+#if defined(M1_HAS_SSE)
+        if (level >= CpuFeatures::SIMD_SSE) return &gatherSSE;
+#endif
+#if defined(M1_ARCH_NEON)
+        if (level == CpuFeatures::SIMD_NEON) return &gatherNEON;
+#endif
+        (void)level;
+        return &gatherScalar;
+    }
+
+public:
+    MatrixKernel() {}
+
+    MatrixKernel(const MatrixKernel&) = delete;
+    MatrixKernel& operator=(const MatrixKernel&) = delete;
+
+    static ProcessFn getProcess(CpuFeatures::SimdLevel level = CpuFeatures::get().getLevel())
+    {
+#if defined(M1_HAS_AVX512)
+        if (level >= CpuFeatures::SIMD_AVX512) return &processAVX512;
+#endif
+#if defined(M1_HAS_AVX2)
+        if (level >= CpuFeatures::SIMD_AVX2) return &processAVX2;
+#endif
+#if defined(M1_HAS_SSE)
+        if (level >= CpuFeatures::SIMD_SSE) return &processSSE;
+#endif
+#if defined(M1_ARCH_NEON)
+        if (level == CpuFeatures::SIMD_NEON) return &processNEON;
+#endif
+        (void)level;
+        return &processScalar;
+    }
+
+    /*
+     setMatrix(matrix, inChannels, outChannels, layout)
+     Copies a conversion matrix into the flat layout. `layout` says which
+     way round the rows are, getMatrixConversion() matrices are
+     LAYOUT_OUT_IN. Returns false when the shape doesn't match the layout
+     and channel counts.
+     */
+    bool setMatrix(const std::vector<std::vector<float>>& matrix, int numInChannels, int numOutChannels, Layout layout, CpuFeatures::SimdLevel simdLevel = CpuFeatures::get().getLevel())
+    {
+        fn = nullptr;
+        fixedFn = nullptr;
+        if (numInChannels <= 0 || numOutChannels <= 0) return false;
+
+        bool rowsAreOutputs = layout == LAYOUT_OUT_IN;
+        int numRows = rowsAreOutputs ? numOutChannels : numInChannels;
+        int rowSize = rowsAreOutputs ? numInChannels : numOutChannels;
+        if ((int)matrix.size() != numRows) return false;
+        for (size_t r = 0; r < matrix.size(); r++) {
+            if ((int)matrix[r].size() != rowSize) return false;
+        }
+
+        inChannels = numInChannels;
+        outChannels = numOutChannels;
+        storage.reset((size_t)inChannels * outChannels);
+        coeffs = storage.allocate((size_t)inChannels * outChannels);
+        for (int o = 0; o < outChannels; o++) {
+            for (int i = 0; i < inChannels; i++) {
+                coeffs[(size_t)o * inChannels + i] = rowsAreOutputs ? matrix[o][i] : matrix[i][o];
+            }
+        }
+        level = simdLevel;
+        fn = getProcess(level);
+
+        rowStart.assign(1, 0);
+        columns.clear();
+        values.clear();
+        bool permutation = true;
+        for (int o = 0; o < outChannels; o++) {
+            for (int i = 0; i < inChannels; i++) {
+                float c = coeffs[(size_t)o * inChannels + i];
+                if (std::fabs(c) < ZERO_THRESHOLD) continue;
+                columns.push_back(i);
+                values.push_back(c);
+            }
+            if ((int)columns.size() - rowStart.back() > 1) permutation = false;
+            rowStart.push_back((int)columns.size());
+        }
+
+        // the dense kernels share each input load between four rows, the
+        // gather loads every input it uses, so it wins below half density
+        if (permutation) strategy = STRATEGY_PERMUTE;
+        else if (columns.size() * 2 <= (size_t)inChannels * outChannels) strategy = STRATEGY_SPARSE;
+        else strategy = STRATEGY_DENSE;
+        gatherFn = strategy == STRATEGY_PERMUTE ? &processPermute : getGather(level);
+        return true;
+    }
+
+    /*
+     setFixedProcess(process, inChannels, outChannels)
+     Uses a kernel compiled for these channel counts instead of the dense
+     one. Sparse and permute matrices keep the strategy setMatrix() picked,
+     which skips the zeros the fixed kernel would multiply; returns false
+     for them.
+     */
+    bool setFixedProcess(ProcessFn process, int numInChannels, int numOutChannels)
+    {
+        if (!isReady() || !process || numInChannels != inChannels || numOutChannels != outChannels) return false;
+        if (strategy != STRATEGY_DENSE) return false;
+        fixedFn = process;
+        strategy = STRATEGY_FIXED;
+        return true;
+    }
+
+    /*
+     setStrategy(strategy)
+     Overrides the strategy setMatrix() picked, e.g. to compare them.
+     Permute is only possible when every output uses at most one input,
+     fixed only after setFixedProcess().
+     */
+    bool setStrategy(Strategy newStrategy)
+    {
+        if (!isReady()) return false;
+        if (newStrategy == STRATEGY_FIXED && !fixedFn) return false;
+        if (newStrategy == STRATEGY_PERMUTE) {
+            for (int o = 0; o < outChannels; o++) {
+                if (rowStart[o + 1] - rowStart[o] > 1) return false;
+            }
+        }
+        strategy = newStrategy;
+        gatherFn = strategy == STRATEGY_PERMUTE ? &processPermute : getGather(level);
+        return true;
+    }
+
+    static const char* strategyName(Strategy strategy)
+    {
+        switch (strategy) {
+        case STRATEGY_SPARSE: return "sparse";
+        case STRATEGY_PERMUTE: return "permute";
+        case STRATEGY_FIXED: return "fixed";
+        default: return "dense";
+        }
+    }
+
+    bool isReady() const { return fn != nullptr; }
+    int getInputChannels() const { return inChannels; }
+    int getOutputChannels() const { return outChannels; }
+    CpuFeatures::SimdLevel getLevel() const { return level; }
+    Strategy getStrategy() const { return strategy; }
+    int getNumNonZeros() const { return (int)columns.size(); }
+
+    // flat row-major coefficients, outChannels rows of inChannels
+    const float* getCoefficients() const { return coeffs; }
+
+    void process(const float* const* in, float* const* out, int frames) const
+    {
+        if (strategy == STRATEGY_DENSE) {
+            fn(coeffs, inChannels, outChannels, in, out, frames);
+        } else if (strategy == STRATEGY_FIXED) {
+            fixedFn(coeffs, inChannels, outChannels, in, out, frames);
+        } else {
+            gatherFn(rowStart.data(), columns.data(), values.data(), outChannels, in, out, frames);
+        }
+    }
+
+    // reference loop, kept public for the benchmark
+    void processReference(const float* const* in, float* const* out, int frames) const
+    {
+        processScalar(coeffs, inChannels, outChannels, in, out, frames);
+    }
+};
+
+#endif /* MatrixKernel_h */
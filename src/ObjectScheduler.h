@@ -0,0 +1,98 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef ObjectScheduler_h
+#define ObjectScheduler_h
+
+#include <algorithm>
+#include <vector>
+
+/*
+ ObjectScheduler
+ Working set of the timeline objects that have audio in a block. An
+ object sounds from its start sample for the length of its file; before
+ and after that it is neither read, zero-filled nor converted.
+
+ Objects are kept sorted by start, so a transcode running forward only
+ looks at the objects that start or end in each block, which keeps
+ sessions with hundreds of mostly silent objects cheap. Going back (a
+ second pass) rebuilds the set.
+ */
+class ObjectScheduler
+{
+    std::vector<long long> starts;
+    std::vector<long long> ends;
+    std::vector<int> byStart;   // object indices in start order
+    size_t nextStart = 0;       // first entry of byStart not started yet
+    std::vector<int> active;    // in index order
+    long long position = 0;     // start of the last block asked for
+    long long sessionEnd = 0;
+    int maxActive = 0;
+
+public:
+    /*
+     setup(starts, frames)
+     Start sample and length in frames of every object.
+     */
+    void setup(const std::vector<long long>& objectStarts, const std::vector<long long>& objectFrames)
+    {
+        starts = objectStarts;
+        ends.resize(starts.size());
+        byStart.resize(starts.size());
+        sessionEnd = 0;
+        for (size_t i = 0; i < starts.size(); i++) {
+            ends[i] = starts[i] + objectFrames[i];
+            sessionEnd = (std::max)(sessionEnd, ends[i]);
+            byStart[i] = (int)i;
+        }
+        std::stable_sort(byStart.begin(), byStart.end(), [&](int a, int b) { return starts[a] < starts[b]; });
+        rewind();
+    }
+
+    void rewind()
+    {
+        nextStart = 0;
+        active.clear();
+        position = 0;
+    }
+
+    int getNumObjects() const { return (int)starts.size(); }
+    long long getStart(int object) const { return starts[object]; }
+    long long getEnd(int object) const { return ends[object]; }
+
+    // end of the last object, the length of the session
+    long long getSessionEnd() const { return sessionEnd; }
+
+    // most objects active in one block so far
+    int getMaxActive() const { return maxActive; }
+
+    /*
+     activeIn(first, frames)
+     Objects with audio in [first, first + frames), in index order.
+     */
+    const std::vector<int>& activeIn(long long first, int frames)
+    {
+        if (first < position) rewind();
+        position = first;
+        long long last = first + frames;
+
+        bool changed = false;
+        size_t kept = 0;
+        for (size_t i = 0; i < active.size(); i++) {
+            if (ends[active[i]] > first) active[kept++] = active[i];
+        }
+        active.resize(kept);
+        while (nextStart < byStart.size() && starts[byStart[nextStart]] < last) {
+            int object = byStart[nextStart++];
+            if (ends[object] > first) {
+                active.push_back(object);
+                changed = true;
+            }
+        }
+        if (changed) std::sort(active.begin(), active.end());
+        maxActive = (std::max)(maxActive, (int)active.size());
+        return active;
+    }
+};
+
+#endif /* ObjectScheduler_h */
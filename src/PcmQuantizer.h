@@ -0,0 +1,397 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef PcmQuantizer_h
+#define PcmQuantizer_h
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "CpuFeatures.h"
+
+/*
+ PcmQuantizer
+ Interleaved float to little endian 16, 24 or 32 bit PCM bytes, ready to
+ be written to the data chunk as is.
+
+ Without dither the result is bit exact with libsndfile's clipping
+ conversions (SFC_SET_CLIPPING), so switching a writer over to raw PCM
+ doesn't change any output. Dither is added at the target word length:
+     tpdf    - triangular dither of +-1 LSB, decorrelates the rounding
+               error from the signal
+     shaped  - tpdf with first order error feedback, which moves the
+               requantization noise up towards Nyquist
+ Dither only applies to 16 and 24 bit; 32 bit is already finer than the
+ float mantissa.
+
+ Samples are converted in chunks that stay in L1, with SSE2/AVX2/NEON
+ conversion kernels picked through CpuFeatures. Noise shaping keeps one
+ error per channel and runs across the channels of each frame.
+ */
+class PcmQuantizer
+{
+public:
+    enum Dither {
+        DITHER_NONE = 0,
+        DITHER_TPDF,
+        DITHER_SHAPED
+    };
+
+private:
+    static const int CHUNK = 1024; // samples converted per pass
+
+    int channels = 0;
+    int bitDepth = 16;
+    Dither dither = DITHER_NONE;
+    CpuFeatures::SimdLevel level = CpuFeatures::SIMD_SCALAR;
+    uint32_t seeds[4];          // xorshift state per SIMD lane
+    uint32_t scalarSeed;        // and for the scalar path
+    std::vector<float> error;   // last requantization error per channel, in LSB
+    int32_t ints[CHUNK];
+
+    // -- reference ----------------------------------------------------
+
+    // libsndfile's f2s / f2i clip conversions, 24 bit keeps the top three bytes
+    static inline int32_t clipRound(float sample, int bits)
+    {
+        if (bits == 16) {
+            float scaled = sample * (1.0f * 0x8000);
+            if (scaled >= (1.0f * 0x7FFF)) return 0x7FFF;
+            if (scaled <= (-8.0f * 0x1000)) return -0x7FFF - 1;
+            return (int32_t)lrintf(scaled);
+        }
+        float scaled = sample * (8.0f * 0x10000000);
+        if (scaled >= (1.0f * 0x7FFFFFFF)) return 0x7FFFFFFF;
+        if (scaled <= (-8.0f * 0x10000000)) return INT32_MIN;
+        return (int32_t)lrintf(scaled);
+    }
+
+    static inline uint32_t xorshift(uint32_t& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // uniform in [-0.5, 0.5) from the top 23 bits
+    static inline float uniform(uint32_t bits)
+    {
+        uint32_t mantissa = (bits >> 9) | 0x3f800000u;
+        float f;
+        memcpy(&f, &mantissa, sizeof(f));
+        return f - 1.5f;
+    }
+
+    // full scale in LSB and the shift that puts a sample in the top bits
+    static inline float fullScale(int bits) { return bits == 16 ? 32768.0f : 8388608.0f; }
+    static inline int alignShift(int bits) { return bits == 16 ? 0 : 8; }
+
+    // -- no dither ----------------------------------------------------
+
+    static void toIntScalar(const float* src, int count, int bits, int32_t* dst)
+    {
+        for (int i = 0; i < count; i++) dst[i] = clipRound(src[i], bits);
+    }
+
+#if defined(M1_HAS_SSE)
+    static void toIntSSE(const float* src, int count, int bits, int32_t* dst)
+    {
+        int i = 0;
+        if (bits == 16) {
+            const __m128 norm = _mm_set1_ps(1.0f * 0x8000);
+            const __m128 hi = _mm_set1_ps(1.0f * 0x7FFF);
+            const __m128 lo = _mm_set1_ps(-8.0f * 0x1000);
+            for (; i + 4 <= count; i += 4) {
+                __m128 x = _mm_mul_ps(_mm_loadu_ps(src + i), norm);
+                x = _mm_max_ps(_mm_min_ps(x, hi), lo);
+                _mm_storeu_si128((__m128i*)(dst + i), _mm_cvtps_epi32(x));
+            }
+        } else {
+            // cvtps gives 0x80000000 above 2^31, flipping it gives INT32_MAX
+            const __m128 norm = _mm_set1_ps(8.0f * 0x10000000);
+            for (; i + 4 <= count; i += 4) {
+                __m128 x = _mm_mul_ps(_mm_loadu_ps(src + i), norm);
+                __m128i over = _mm_castps_si128(_mm_cmpge_ps(x, norm));
+                _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(_mm_cvtps_epi32(x), over));
+            }
+        }
+        toIntScalar(src + i, count - i, bits, dst + i);
+    }
+#endif
+
+#if defined(M1_HAS_AVX2)
+    M1_TARGET_AVX2 static void toIntAVX2(const float* src, int count, int bits, int32_t* dst)
+    {
+        int i = 0;
+        if (bits == 16) {
+            const __m256 norm = _mm256_set1_ps(1.0f * 0x8000);
+            const __m256 hi = _mm256_set1_ps(1.0f * 0x7FFF);
+            const __m256 lo = _mm256_set1_ps(-8.0f * 0x1000);
+            for (; i + 8 <= count; i += 8) {
+                __m256 x = _mm256_mul_ps(_mm256_loadu_ps(src + i), norm);
+                x = _mm256_max_ps(_mm256_min_ps(x, hi), lo);
+                _mm256_storeu_si256((__m256i*)(dst + i), _mm256_cvtps_epi32(x));
+            }
+        } else {
+            const __m256 norm = _mm256_set1_ps(8.0f * 0x10000000);
+            for (; i + 8 <= count; i += 8) {
+                __m256 x = _mm256_mul_ps(_mm256_loadu_ps(src + i), norm);
+                __m256i over = _mm256_castps_si256(_mm256_cmp_ps(x, norm, _CMP_GE_OQ));
+                _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(_mm256_cvtps_epi32(x), over));
+            }
+        }
+        toIntScalar(src + i, count - i, bits, dst + i);
+    }
+#endif
+
+#if defined(M1_ARCH_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+    static void toIntNEON(const float* src, int count, int bits, int32_t* dst)
+    {
+        int i = 0;
+        if (bits == 16) {
+            const float32x4_t hi = vdupq_n_f32(1.0f * 0x7FFF);
+            const float32x4_t lo = vdupq_n_f32(-8.0f * 0x1000);
+            for (; i + 4 <= count; i += 4) {
+                float32x4_t x = vmulq_n_f32(vld1q_f32(src + i), 1.0f * 0x8000);
+                x = vmaxq_f32(vminq_f32(x, hi), lo);
+                vst1q_s32(dst + i, vcvtnq_s32_f32(x));
+            }
+        } else {
+            // the conversion saturates, which is the clipping libsndfile does
+            for (; i + 4 <= count; i += 4) {
+                vst1q_s32(dst + i, vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), 8.0f * 0x10000000)));
+            }
+        }
+        toIntScalar(src + i, count - i, bits, dst + i);
+    }
+#endif
+
+    void toInt(const float* src, int count, int32_t* dst) const
+    {
+#if defined(M1_HAS_AVX2)
+        if (level >= CpuFeatures::SIMD_AVX2) return toIntAVX2(src, count, bitDepth, dst);
+#endif
+#if defined(M1_HAS_SSE)
+        if (level >= CpuFeatures::SIMD_SSE) return toIntSSE(src, count, bitDepth, dst);
+#endif
+#if defined(M1_ARCH_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+        if (level == CpuFeatures::SIMD_NEON) return toIntNEON(src, count, bitDepth, dst);
+#endif
+        toIntScalar(src, count, bitDepth, dst);
+    }
+
+    // -- dither -------------------------------------------------------
+
+    // `first` is the channel of src[0]
+    void ditherScalar(const float* src, int count, int first, int32_t* dst)
+    {
+        const float scale = fullScale(bitDepth);
+        const float hi = scale - 1.0f, lo = -scale;
+        const int shift = alignShift(bitDepth);
+        const bool shaped = dither == DITHER_SHAPED;
+        int c = first;
+        for (int i = 0; i < count; i++) {
+            float v = src[i] * scale;
+            if (shaped) v -= error[c];
+            float d = uniform(xorshift(scalarSeed)) + uniform(xorshift(scalarSeed));
+            float y = v + d;
+            y = y > hi ? hi : (y < lo ? lo : y);
+            y = (float)lrintf(y);
+            if (shaped) {
+                float e = y - v;
+                error[c] = e > 2.0f ? 2.0f : (e < -2.0f ? -2.0f : e);
+            }
+            dst[i] = (int32_t)((uint32_t)(int32_t)y << shift);
+            if (++c == channels) c = 0;
+        }
+    }
+
+#if defined(M1_HAS_SSE)
+    inline __m128 tpdfSSE(__m128i& state)
+    {
+        __m128 d = _mm_setzero_ps();
+        for (int k = 0; k < 2; k++) {
+            state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+            state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+            state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+            __m128i mantissa = _mm_or_si128(_mm_srli_epi32(state, 9), _mm_set1_epi32(0x3f800000));
+            d = _mm_add_ps(d, _mm_sub_ps(_mm_castsi128_ps(mantissa), _mm_set1_ps(1.5f)));
+        }
+        return d;
+    }
+
+    // tpdf over consecutive samples, channels don't matter
+    void ditherTPDFSSE(const float* src, int count, int32_t* dst)
+    {
+        const float scale = fullScale(bitDepth);
+        const __m128 norm = _mm_set1_ps(scale);
+        const __m128 hi = _mm_set1_ps(scale - 1.0f), lo = _mm_set1_ps(-scale);
+        const int shift = alignShift(bitDepth);
+        __m128i state = _mm_loadu_si128((const __m128i*)seeds);
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128 y = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + i), norm), tpdfSSE(state));
+            y = _mm_max_ps(_mm_min_ps(y, hi), lo);
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_slli_epi32(_mm_cvtps_epi32(y), shift));
+        }
+        _mm_storeu_si128((__m128i*)seeds, state);
+        ditherScalar(src + i, count - i, 0, dst + i);
+    }
+
+    // shaped dither, four channels of a frame at a time
+    void ditherShapedSSE(const float* src, int count, int32_t* dst)
+    {
+        const float scale = fullScale(bitDepth);
+        const __m128 norm = _mm_set1_ps(scale);
+        const __m128 hi = _mm_set1_ps(scale - 1.0f), lo = _mm_set1_ps(-scale);
+        const __m128 eMax = _mm_set1_ps(2.0f), eMin = _mm_set1_ps(-2.0f);
+        const int shift = alignShift(bitDepth);
+        __m128i state = _mm_loadu_si128((const __m128i*)seeds);
+        for (int f = 0; f + channels <= count; f += channels) {
+            int c = 0;
+            for (; c + 4 <= channels; c += 4) {
+                __m128 v = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(src + f + c), norm), _mm_loadu_ps(error.data() + c));
+                __m128 y = _mm_max_ps(_mm_min_ps(_mm_add_ps(v, tpdfSSE(state)), hi), lo);
+                __m128i q = _mm_cvtps_epi32(y);
+                __m128 e = _mm_sub_ps(_mm_cvtepi32_ps(q), v);
+                _mm_storeu_ps(error.data() + c, _mm_max_ps(_mm_min_ps(e, eMax), eMin));
+                _mm_storeu_si128((__m128i*)(dst + f + c), _mm_slli_epi32(q, shift));
+            }
+            if (c < channels) ditherScalar(src + f + c, channels - c, c, dst + f + c);
+        }
+        _mm_storeu_si128((__m128i*)seeds, state);
+    }
+#endif
+
+    // -- packing ------------------------------------------------------
+
+    static void pack(const int32_t* src, int count, int bits, unsigned char* dst)
+    {
+        if (bits == 32) {
+            memcpy(dst, src, (size_t)count * 4); // little endian hosts
+            return;
+        }
+        int i = 0;
+        if (bits == 16) {
+#if defined(M1_HAS_SSE)
+            for (; i + 8 <= count; i += 8) {
+                __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+                __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 4));
+                _mm_storeu_si128((__m128i*)(dst + 2 * i), _mm_packs_epi32(a, b));
+            }
+#endif
+            for (; i < count; i++) {
+                int16_t v = (int16_t)src[i];
+                memcpy(dst + 2 * i, &v, 2);
+            }
+            return;
+        }
+        // 24 bit: 4 byte stores that overlap by one, the last sample byte by byte
+        for (; i + 1 < count; i++) {
+            uint32_t v = (uint32_t)src[i] >> 8;
+            memcpy(dst + 3 * i, &v, 4);
+        }
+        for (; i < count; i++) {
+            uint32_t v = (uint32_t)src[i] >> 8;
+            dst[3 * i] = (unsigned char)(v & 0xff);
+            dst[3 * i + 1] = (unsigned char)((v >> 8) & 0xff);
+            dst[3 * i + 2] = (unsigned char)((v >> 16) & 0xff);
+        }
+    }
+
+public:
+    PcmQuantizer() { seed(0); }
+
+    static const char* ditherName(Dither dither)
+    {
+        switch (dither) {
+        case DITHER_TPDF: return "tpdf";
+        case DITHER_SHAPED: return "shaped";
+        default: return "none";
+        }
+    }
+
+    static bool parseDither(const std::string& name, Dither& dither)
+    {
+        if (name == "none" || name == "off") dither = DITHER_NONE;
+        else if (name == "tpdf") dither = DITHER_TPDF;
+        else if (name == "shaped") dither = DITHER_SHAPED;
+        else return false;
+        return true;
+    }
+
+    /*
+     setup(channels, bitDepth, dither, simdLevel)
+     Returns false for word lengths other than 16, 24 and 32 bit.
+     */
+    bool setup(int numChannels, int bits, Dither ditherMode = DITHER_NONE, CpuFeatures::SimdLevel simdLevel = CpuFeatures::get().getLevel())
+    {
+        if (bits != 16 && bits != 24 && bits != 32) return false;
+        channels = numChannels;
+        bitDepth = bits;
+        dither = bits == 32 ? DITHER_NONE : ditherMode;
+        level = simdLevel;
+        error.assign(channels + 4, 0.0f);
+        return true;
+    }
+
+    // dither noise sequence, e.g. one per segment of a file
+    void seed(uint32_t value)
+    {
+        for (int k = 0; k < 5; k++) {
+            uint32_t s = 0x9E3779B9u * (value * 5 + k + 1);
+            if (!s) s = 1;
+            if (k < 4) seeds[k] = s;
+            else scalarSeed = s;
+        }
+    }
+
+    int getBitDepth() const { return bitDepth; }
+    int getBytesPerSample() const { return bitDepth / 8; }
+    Dither getDither() const { return dither; }
+
+    /*
+     quantize(interleaved, frames, dst)
+     Converts whole frames, `dst` needs frames * channels * bytes per sample.
+     */
+    void quantize(const float* interleaved, int frames, unsigned char* dst)
+    {
+        const int bytes = getBytesPerSample();
+        const int total = frames * channels;
+        // chunks hold whole frames so the shaped path sees complete frames
+        const int step = channels > 0 && channels <= CHUNK ? CHUNK / channels * channels : CHUNK;
+        for (int i = 0; i < total; i += step) {
+            int count = total - i < step ? total - i : step;
+            if (dither == DITHER_NONE) {
+                toInt(interleaved + i, count, ints);
+            }
+#if defined(M1_HAS_SSE)
+            else if (level >= CpuFeatures::SIMD_SSE && dither == DITHER_TPDF) {
+                ditherTPDFSSE(interleaved + i, count, ints);
+            } else if (level >= CpuFeatures::SIMD_SSE && dither == DITHER_SHAPED) {
+                ditherShapedSSE(interleaved + i, count, ints);
+            }
+#endif
+            else {
+                ditherScalar(interleaved + i, count, 0, ints);
+            }
+            pack(ints, count, bitDepth, dst + (size_t)i * bytes);
+        }
+    }
+
+    // reference conversion without dither, kept public for the benchmark
+    static void quantizeReference(const float* src, size_t samples, int bits, unsigned char* dst)
+    {
+        const int bytes = bits / 8;
+        for (size_t i = 0; i < samples; i++) {
+            uint32_t v = (uint32_t)clipRound(src[i], bits) >> (bits == 24 ? 8 : 0);
+            for (int b = 0; b < bytes; b++) dst[bytes * i + b] = (unsigned char)((v >> (8 * b)) & 0xff);
+        }
+    }
+};
+
+#endif /* PcmQuantizer_h */
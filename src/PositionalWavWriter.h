@@ -0,0 +1,200 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef PositionalWavWriter_h
+#define PositionalWavWriter_h
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "PcmQuantizer.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ PositionalWavWriter
+ PCM WAV file whose length is known up front: the header is written and
+ the whole file preallocated on create(), after which any thread may write
+ frames at any frame offset with pwrite(). Several threads can fill
+ disjoint ranges of one file at the same time.
+
+ Samples are converted by the caller's PcmQuantizer, which without dither
+ matches what SndfileHandle would have written with SFC_SET_CLIPPING.
+ Files over 4GB are written as RF64. create() returns false where
+ positional writes aren't available (Windows).
+ */
+class PositionalWavWriter
+{
+    int fd = -1;
+    int channels = 0;
+    int bytesPerSample = 0;
+    long long totalFrames = 0;
+    uint64_t dataOffset = 0;
+
+    static void put16(std::vector<unsigned char>& out, uint32_t v)
+    {
+        out.push_back((unsigned char)(v & 0xff));
+        out.push_back((unsigned char)((v >> 8) & 0xff));
+    }
+
+    static void put32(std::vector<unsigned char>& out, uint32_t v)
+    {
+        put16(out, v & 0xffff);
+        put16(out, v >> 16);
+    }
+
+    static void put64(std::vector<unsigned char>& out, uint64_t v)
+    {
+        put32(out, (uint32_t)(v & 0xffffffff));
+        put32(out, (uint32_t)(v >> 32));
+    }
+
+    static void putId(std::vector<unsigned char>& out, const char* id)
+    {
+        out.insert(out.end(), id, id + 4);
+    }
+
+    bool writeAll(const unsigned char* data, size_t bytes, uint64_t offset)
+    {
+#ifdef _WIN32
+        (void)data; (void)bytes; (void)offset;
+        return false;
+#else
+        while (bytes > 0) {
+            ssize_t written = pwrite(fd, data, bytes, (off_t)offset);
+            if (written <= 0) return false;
+            data += written;
+            bytes -= (size_t)written;
+            offset += (uint64_t)written;
+        }
+        return true;
+#endif
+    }
+
+public:
+    PositionalWavWriter() {}
+    ~PositionalWavWriter() { close(); }
+
+    PositionalWavWriter(const PositionalWavWriter&) = delete;
+    PositionalWavWriter& operator=(const PositionalWavWriter&) = delete;
+
+    /*
+     create(path, channels, sampleRate, bitDepth, frames, comment)
+     Writes the header for `frames` frames and reserves the data region.
+     `comment` is stored as an INFO/ICMT string like SF_STR_COMMENT.
+     */
+    bool create(const std::string& path, int numChannels, int sampleRate, int bitDepth, long long frames, const std::string& comment = "")
+    {
+        close();
+#ifdef _WIN32
+        (void)path; (void)numChannels; (void)sampleRate; (void)bitDepth; (void)frames; (void)comment;
+        return false;
+#else
+        if (bitDepth != 16 && bitDepth != 24 && bitDepth != 32) return false;
+        channels = numChannels;
+        bytesPerSample = bitDepth / 8;
+        totalFrames = frames;
+        uint64_t dataBytes = (uint64_t)frames * channels * bytesPerSample;
+
+        std::vector<unsigned char> info;
+        if (!comment.empty()) {
+            std::string text = comment;
+            text.push_back('\0');
+            if (text.size() & 1) text.push_back('\0');
+            putId(info, "LIST");
+            put32(info, (uint32_t)(4 + 8 + text.size()));
+            putId(info, "INFO");
+            putId(info, "ICMT");
+            put32(info, (uint32_t)text.size());
+            info.insert(info.end(), text.begin(), text.end());
+        }
+
+        uint64_t headerBytes = 12 + 8 + 16 + info.size() + 8;
+        bool rf64 = headerBytes + dataBytes > 0xFFFFFFFFull;
+        if (rf64) headerBytes += 8 + 28;
+        uint64_t riffSize = headerBytes - 8 + dataBytes + (dataBytes & 1);
+
+        std::vector<unsigned char> header;
+        putId(header, rf64 ? "RF64" : "RIFF");
+        put32(header, rf64 ? 0xFFFFFFFF : (uint32_t)riffSize);
+        putId(header, "WAVE");
+        if (rf64) {
+            putId(header, "ds64");
+            put32(header, 28);
+            put64(header, riffSize);
+            put64(header, dataBytes);
+            put64(header, (uint64_t)frames);
+            put32(header, 0); // no table entries
+        }
+        putId(header, "fmt ");
+        put32(header, 16);
+        put16(header, 1); // WAVE_FORMAT_PCM
+        put16(header, (uint32_t)channels);
+        put32(header, (uint32_t)sampleRate);
+        put32(header, (uint32_t)(sampleRate * channels * bytesPerSample));
+        put16(header, (uint32_t)(channels * bytesPerSample));
+        put16(header, (uint32_t)bitDepth);
+        header.insert(header.end(), info.begin(), info.end());
+        putId(header, "data");
+        put32(header, rf64 ? 0xFFFFFFFF : (uint32_t)dataBytes);
+        dataOffset = header.size();
+
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        uint64_t fileBytes = dataOffset + dataBytes + (dataBytes & 1);
+#if defined(__linux__)
+        if (posix_fallocate(fd, 0, (off_t)fileBytes) != 0) {
+            close();
+            return false;
+        }
+#else
+        if (ftruncate(fd, (off_t)fileBytes) != 0) {
+            close();
+            return false;
+        }
+#endif
+        if (!writeAll(header.data(), header.size(), 0)) {
+            close();
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        if (fd >= 0) ::close(fd);
+#endif
+        fd = -1;
+    }
+
+    bool isOpened() const { return fd >= 0; }
+    int getChannels() const { return channels; }
+    long long getFrames() const { return totalFrames; }
+
+    /*
+     writeFrames(frameOffset, interleaved, frames, quantizer, scratch)
+     Converts and writes `frames` interleaved frames at `frameOffset`.
+     The quantizer (set up for this file's channels and bit depth) and
+     `scratch` belong to the caller, so concurrent writers don't share
+     any state.
+     */
+    bool writeFrames(long long frameOffset, const float* interleaved, int frames, PcmQuantizer& quantizer, std::vector<unsigned char>& scratch)
+    {
+        if (frames <= 0) return true;
+        if (frameOffset < 0 || frameOffset + frames > totalFrames) return false;
+        if (quantizer.getBytesPerSample() != bytesPerSample) return false;
+        size_t bytes = (size_t)frames * channels * bytesPerSample;
+        if (scratch.size() < bytes) scratch.resize(bytes);
+        quantizer.quantize(interleaved, frames, scratch.data());
+        return writeAll(scratch.data(), bytes, dataOffset + (uint64_t)frameOffset * channels * bytesPerSample);
+    }
+};
+
+#endif /* PositionalWavWriter_h */
@@ -0,0 +1,185 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef RampMatrixKernel_h
+#define RampMatrixKernel_h
+
+#include "CpuFeatures.h"
+
+/*
+ RampMatrixKernel
+ Planar matrix conversion whose coefficients move linearly from frame to
+ frame, for matrices that change over time (moving timeline objects):
+
+     out[o][j] = sum over i of (start[o][i] + j * step[o][i]) * in[i][j]
+
+ `start` and `step` are flat row-major blocks like MatrixKernel's. The
+ SIMD kernels build the coefficients of a vector of frames with one
+ multiply-add from a frame index vector and work on four output rows at
+ a time, so each input load is shared as in the fixed matrix kernels.
+ The instruction set is picked once through CpuFeatures; the scalar loop
+ is the reference.
+ */
+class RampMatrixKernel
+{
+public:
+    typedef void (*ProcessFn)(const float* start, const float* step, int inChannels, int outChannels, const float* const* in, float* const* out, int frames);
+
+private:
+    // -- scalar -------------------------------------------------------
+
+    static void processScalar(const float* start, const float* step, int inChannels, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        rowsTail(start, step, inChannels, 0, outChannels, in, out, 0, frames);
+    }
+
+    // frames [first, frames) of rows [o, o + rows), for the SIMD tails
+    static void rowsTail(const float* start, const float* step, int inChannels, int o, int rows, const float* const* in, float* const* out, int first, int frames)
+    {
+        for (int r = o; r < o + rows; r++) {
+            const float* c0 = start + (size_t)r * inChannels;
+            const float* dc = step + (size_t)r * inChannels;
+            for (int j = first; j < frames; j++) {
+                float sum = 0.0f;
+                for (int i = 0; i < inChannels; i++) sum += (c0[i] + (float)j * dc[i]) * in[i][j];
+                out[r][j] = sum;
+            }
+        }
+    }
+
+    // -- SSE ----------------------------------------------------------
+
+#if defined(M1_HAS_SSE)
+    template <int R>
+    static void rowsSSE(const float* start, const float* step, int inChannels, int o, const float* const* in, float* const* out, int frames)
+    {
+        const float* c0 = start + (size_t)o * inChannels;
+        const float* dc = step + (size_t)o * inChannels;
+        const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+        int j = 0;
+        for (; j + 4 <= frames; j += 4) {
+            __m128 index = _mm_add_ps(_mm_set1_ps((float)j), lanes);
+            __m128 acc[R];
+            for (int r = 0; r < R; r++) acc[r] = _mm_setzero_ps();
+            for (int i = 0; i < inChannels; i++) {
+                __m128 x = _mm_loadu_ps(in[i] + j);
+                for (int r = 0; r < R; r++) {
+                    __m128 c = _mm_add_ps(_mm_set1_ps(c0[r * inChannels + i]), _mm_mul_ps(_mm_set1_ps(dc[r * inChannels + i]), index));
+                    acc[r] = _mm_add_ps(acc[r], _mm_mul_ps(c, x));
+                }
+            }
+            for (int r = 0; r < R; r++) _mm_storeu_ps(out[o + r] + j, acc[r]);
+        }
+        rowsTail(start, step, inChannels, o, R, in, out, j, frames);
+    }
+
+    static void processSSE(const float* start, const float* step, int inChannels, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        int o = 0;
+        for (; o + 4 <= outChannels; o += 4) rowsSSE<4>(start, step, inChannels, o, in, out, frames);
+        for (; o < outChannels; o++) rowsSSE<1>(start, step, inChannels, o, in, out, frames);
+    }
+#endif
+
+    // -- AVX2 ---------------------------------------------------------
+
+#if defined(M1_HAS_AVX2)
+    template <int R>
+    M1_TARGET_AVX2 static void rowsAVX2(const float* start, const float* step, int inChannels, int o, const float* const* in, float* const* out, int frames)
+    {
+        const float* c0 = start + (size_t)o * inChannels;
+        const float* dc = step + (size_t)o * inChannels;
+        const __m256 lanes = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+        int j = 0;
+        for (; j + 8 <= frames; j += 8) {
+            __m256 index = _mm256_add_ps(_mm256_set1_ps((float)j), lanes);
+            __m256 acc[R];
+            for (int r = 0; r < R; r++) acc[r] = _mm256_setzero_ps();
+            for (int i = 0; i < inChannels; i++) {
+                __m256 x = _mm256_loadu_ps(in[i] + j);
+                for (int r = 0; r < R; r++) {
+                    __m256 c = _mm256_fmadd_ps(_mm256_broadcast_ss(dc + r * inChannels + i), index, _mm256_broadcast_ss(c0 + r * inChannels + i));
+                    acc[r] = _mm256_fmadd_ps(c, x, acc[r]);
+                }
+            }
+            for (int r = 0; r < R; r++) _mm256_storeu_ps(out[o + r] + j, acc[r]);
+        }
+        rowsTail(start, step, inChannels, o, R, in, out, j, frames);
+    }
+
+    M1_TARGET_AVX2 static void processAVX2(const float* start, const float* step, int inChannels, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        int o = 0;
+        for (; o + 4 <= outChannels; o += 4) rowsAVX2<4>(start, step, inChannels, o, in, out, frames);
+        for (; o < outChannels; o++) rowsAVX2<1>(start, step, inChannels, o, in, out, frames);
+    }
+#endif
+
+    // -- NEON ---------------------------------------------------------
+
+#if defined(M1_ARCH_NEON)
+    static inline float32x4_t fmaNEON(float32x4_t acc, float32x4_t a, float32x4_t b)
+    {
+#if defined(__aarch64__) || defined(_M_ARM64)
+        return vfmaq_f32(acc, a, b);
+#else
+        return vmlaq_f32(acc, a, b);
+#endif
+    }
+
+    template <int R>
+    static void rowsNEON(const float* start, const float* step, int inChannels, int o, const float* const* in, float* const* out, int frames)
+    {
+        const float* c0 = start + (size_t)o * inChannels;
+        const float* dc = step + (size_t)o * inChannels;
+        const float laneValues[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+        const float32x4_t lanes = vld1q_f32(laneValues);
+        int j = 0;
+        for (; j + 4 <= frames; j += 4) {
+            float32x4_t index = vaddq_f32(vdupq_n_f32((float)j), lanes);
+            float32x4_t acc[R];
+            for (int r = 0; r < R; r++) acc[r] = vdupq_n_f32(0.0f);
+            for (int i = 0; i < inChannels; i++) {
+                float32x4_t x = vld1q_f32(in[i] + j);
+                for (int r = 0; r < R; r++) {
+                    float32x4_t c = fmaNEON(vdupq_n_f32(c0[r * inChannels + i]), vdupq_n_f32(dc[r * inChannels + i]), index);
+                    acc[r] = fmaNEON(acc[r], c, x);
+                }
+            }
+            for (int r = 0; r < R; r++) vst1q_f32(out[o + r] + j, acc[r]);
+        }
+        rowsTail(start, step, inChannels, o, R, in, out, j, frames);
+    }
+
+    static void processNEON(const float* start, const float* step, int inChannels, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        int o = 0;
+        for (; o + 4 <= outChannels; o += 4) rowsNEON<4>(start, step, inChannels, o, in, out, frames);
+        for (; o < outChannels; o++) rowsNEON<1>(start, step, inChannels, o, in, out, frames);
+    }
+#endif
+
+public:
+    static ProcessFn getProcess(CpuFeatures::SimdLevel level = CpuFeatures::get().getLevel())
+    {
+#if defined(M1_HAS_AVX2)
+        if (level >= CpuFeatures::SIMD_AVX2) return &processAVX2;
+#endif
+#if defined(M1_HAS_SSE)
+        if (level >= CpuFeatures::SIMD_SSE) return &processSSE;
+#endif
+#if defined(M1_ARCH_NEON)
+        if (level == CpuFeatures::SIMD_NEON) return &processNEON;
+#endif
+        (void)level;
+        return &processScalar;
+    }
+
+    // reference loop, kept public for the benchmark
+    static void processReference(const float* start, const float* step, int inChannels, int outChannels, const float* const* in, float* const* out, int frames)
+    {
+        processScalar(start, step, inChannels, outChannels, in, out, frames);
+    }
+};
+
+#endif /* RampMatrixKernel_h */
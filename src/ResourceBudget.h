@@ -0,0 +1,99 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef ResourceBudget_h
+#define ResourceBudget_h
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+/*
+ ResourceBudget
+ Counting limit shared by concurrent jobs, used for in-flight buffer bytes
+ and open file handles. acquire() blocks until the amount fits under the
+ limit. A request larger than the whole limit is let through once nothing
+ else is held, so an oversized job runs alone instead of never.
+ A limit of 0 means unlimited.
+ */
+class ResourceBudget
+{
+    mutable std::mutex mutex;
+    std::condition_variable released;
+    size_t limit;
+    size_t used = 0;
+    size_t peak = 0;
+
+public:
+    explicit ResourceBudget(size_t maxAmount = 0) : limit(maxAmount) {}
+
+    ResourceBudget(const ResourceBudget&) = delete;
+    ResourceBudget& operator=(const ResourceBudget&) = delete;
+
+    void acquire(size_t amount)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (limit > 0) {
+            released.wait(lock, [&]() { return used == 0 || used + amount <= limit; });
+        }
+        used += amount;
+        if (used > peak) peak = used;
+    }
+
+    void release(size_t amount)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            used -= amount;
+        }
+        released.notify_all();
+    }
+
+    size_t getLimit() const { return limit; }
+    size_t getPeak() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return peak;
+    }
+
+    // open file handles this process may use, leaving some for stdio and libraries
+    static size_t defaultFileLimit()
+    {
+#ifndef _WIN32
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur > 64) {
+            return (size_t)rl.rlim_cur - 32;
+        }
+#endif
+        return 0;
+    }
+
+    /*
+     Reservation
+     Holds an amount of a budget for its lifetime, does nothing without a budget.
+     */
+    class Reservation
+    {
+        ResourceBudget* budget;
+        size_t amount;
+
+    public:
+        Reservation(ResourceBudget* resourceBudget, size_t reserved) : budget(resourceBudget), amount(reserved)
+        {
+            if (budget) budget->acquire(amount);
+        }
+        ~Reservation()
+        {
+            if (budget) budget->release(amount);
+        }
+
+        Reservation(const Reservation&) = delete;
+        Reservation& operator=(const Reservation&) = delete;
+    };
+};
+
+#endif /* ResourceBudget_h */
@@ -0,0 +1,159 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef RingBuffer_h
+#define RingBuffer_h
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+/*
+ RingBuffer<T>
+ Bounded single-producer / single-consumer lock-free queue used to hand
+ blocks between the reader, transcode and writer stages.
+ Capacity is rounded up to the next power of two; exactly one thread may
+ push and exactly one thread may pop. The blocking calls spin briefly and
+ then sleep on a condition variable, so a stage waiting on disk I/O
+ doesn't hold a core.
+ */
+template <typename T>
+class RingBuffer
+{
+    std::vector<T> slots;
+    size_t mask;
+
+    // keep producer and consumer indices on separate cache lines
+    char pad0[64];
+    std::atomic<size_t> head; // next slot to pop (consumer)
+    char pad1[64];
+    std::atomic<size_t> tail; // next slot to push (producer)
+    char pad2[64];
+
+    // tries before a blocking call goes to sleep
+    static const int SPIN_TRIES = 64;
+
+    std::mutex waitMutex;
+    std::condition_variable changed; // a slot was pushed or popped, or wake()
+    std::atomic<int> waiters;
+
+    void notifyWaiters()
+    {
+        // pairs with the increment in waitUntil, so a sleeper can't miss this
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(waitMutex);
+            changed.notify_all();
+        }
+    }
+
+    template <typename Predicate>
+    void waitUntil(Predicate ready, const std::atomic<bool>& abort)
+    {
+        waiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        {
+            std::unique_lock<std::mutex> lock(waitMutex);
+            changed.wait(lock, [&]() { return abort.load(std::memory_order_relaxed) || ready(); });
+        }
+        waiters.fetch_sub(1);
+    }
+
+    bool full() const
+    {
+        return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) == slots.size();
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+    }
+
+public:
+    explicit RingBuffer(size_t capacity = 4) : head(0), tail(0), waiters(0)
+    {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    size_t capacity() const
+    {
+        return slots.size();
+    }
+
+    bool tryPush(const T& item)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size()) {
+            return false; // full
+        }
+        slots[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        notifyWaiters();
+        return true;
+    }
+
+    bool tryPop(T& item)
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false; // empty
+        }
+        item = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        notifyWaiters();
+        return true;
+    }
+
+    /*
+     push(item, abort) / pop(item, abort)
+     Blocking variants that wait while the queue is full/empty.
+     Return false without transferring anything once `abort` is raised;
+     whoever raises it calls wake() so sleeping stages notice.
+     */
+    bool push(const T& item, const std::atomic<bool>& abort)
+    {
+        for (int tries = 0; !tryPush(item); tries++) {
+            if (abort.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            if (tries < SPIN_TRIES) {
+                std::this_thread::yield();
+            } else {
+                waitUntil([&]() { return !full(); }, abort);
+            }
+        }
+        return true;
+    }
+
+    bool pop(T& item, const std::atomic<bool>& abort)
+    {
+        for (int tries = 0; !tryPop(item); tries++) {
+            if (abort.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            if (tries < SPIN_TRIES) {
+                std::this_thread::yield();
+            } else {
+                waitUntil([&]() { return !empty(); }, abort);
+            }
+        }
+        return true;
+    }
+
+    // wakes blocked push/pop calls to check their abort flag
+    void wake()
+    {
+        std::lock_guard<std::mutex> lock(waitMutex);
+        changed.notify_all();
+    }
+};
+
+#endif /* RingBuffer_h */
@@ -0,0 +1,149 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef SpillFile_h
+#define SpillFile_h
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*
+ SpillFile
+ Anonymous, memory mapped scratch file that keeps the converted float
+ planes of a pass so a later pass can reuse them instead of decoding and
+ transcoding the input again.
+
+ The file is unlinked right after creation, so it never outlives the
+ process. Blocks are stored back to back, each as `channels` planes of
+ `blockSize` floats. create() returns false where this isn't supported
+ (no mmap, out of disk space) and callers fall back to re-decoding.
+ */
+class SpillFile
+{
+    float* map = nullptr;
+    size_t mapBytes = 0;
+    int fd = -1;
+    int channels = 0;
+    int blockSize = 0;
+    long long numBlocks = 0;
+    std::vector<int> blockFrames;
+
+public:
+    SpillFile() {}
+    ~SpillFile() { close(); }
+
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator=(const SpillFile&) = delete;
+
+    static uint64_t requiredBytes(int channels, int blockSize, long long numBlocks)
+    {
+        return (uint64_t)channels * blockSize * numBlocks * sizeof(float);
+    }
+
+    // directory for spill files: $TMPDIR, falling back to /tmp
+    static std::string defaultDirectory()
+    {
+        const char* tmp = getenv("TMPDIR");
+        return (tmp && tmp[0]) ? std::string(tmp) : std::string("/tmp");
+    }
+
+    bool create(const std::string& directory, int numChannels, int frames, long long blocks)
+    {
+        close();
+#ifdef _WIN32
+        (void)directory; (void)numChannels; (void)frames; (void)blocks;
+        return false;
+#else
+        uint64_t bytes = requiredBytes(numChannels, frames, blocks);
+        if (bytes == 0 || bytes != (uint64_t)(size_t)bytes) return false;
+
+        std::string path = directory + "/m1-transcode-spill-XXXXXX";
+        std::vector<char> pathBuf(path.begin(), path.end());
+        pathBuf.push_back(0);
+        fd = mkstemp(pathBuf.data());
+        if (fd < 0) return false;
+        unlink(pathBuf.data());
+
+#if defined(__linux__)
+        // reserve the blocks now so running out of disk fails here, not with SIGBUS later
+        if (posix_fallocate(fd, 0, (off_t)bytes) != 0) {
+            close();
+            return false;
+        }
+#else
+        if (ftruncate(fd, (off_t)bytes) != 0) {
+            close();
+            return false;
+        }
+#endif
+        void* ptr = mmap(nullptr, (size_t)bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            close();
+            return false;
+        }
+        madvise(ptr, (size_t)bytes, MADV_SEQUENTIAL);
+
+        map = (float*)ptr;
+        mapBytes = (size_t)bytes;
+        channels = numChannels;
+        blockSize = frames;
+        numBlocks = blocks;
+        blockFrames.assign((size_t)blocks, 0);
+        return true;
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        if (map) munmap(map, mapBytes);
+        if (fd >= 0) ::close(fd);
+#endif
+        map = nullptr;
+        mapBytes = 0;
+        fd = -1;
+        blockFrames.clear();
+    }
+
+    bool isOpened() const { return map != nullptr; }
+    int getChannels() const { return channels; }
+    long long getNumBlocks() const { return numBlocks; }
+
+    float* plane(long long block, int channel)
+    {
+        return map + ((size_t)block * channels + channel) * blockSize;
+    }
+
+    /*
+     writeBlock(index, planes, frames) / readBlock(index, planes)
+     Each block index is only touched by one stage at a time, so the
+     pipelined transcode stage can spill while the reader keeps going.
+     */
+    void writeBlock(long long index, float* const* planes, int frames)
+    {
+        for (int k = 0; k < channels; k++) {
+            memcpy(plane(index, k), planes[k], frames * sizeof(float));
+        }
+        blockFrames[(size_t)index] = frames;
+    }
+
+    int readBlock(long long index, float* const* planes)
+    {
+        int frames = blockFrames[(size_t)index];
+        for (int k = 0; k < channels; k++) {
+            memcpy(planes[k], plane(index, k), frames * sizeof(float));
+        }
+        return frames;
+    }
+};
+
+#endif /* SpillFile_h */
@@ -0,0 +1,244 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef StreamAudioReader_h
+#define StreamAudioReader_h
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "MappedAudioReader.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ StreamAudioReader
+ Input backend for WAV/RF64/BW64 arriving on stdin (`-`) or a FIFO.
+ The header is parsed front to back without seeking, chunks before `data`
+ are skipped by reading them, and samples are converted with the same
+ loops as MappedAudioReader.
+
+ Streaming writers don't know the length up front and leave the RIFF and
+ `data` sizes at 0xFFFFFFFF (or 0); such streams are read until EOF and
+ hasLength() is false. The input can only be read once.
+ */
+class StreamAudioReader
+{
+    int fd = -1;
+    bool ownsFd = false;
+    std::vector<unsigned char> buffer;
+
+    uint64_t numFrames = 0;
+    uint64_t position = 0; // in frames
+    bool knownLength = false;
+    bool opened = false;
+
+    int numChannels = 0;
+    int sampleRate = 0;
+    int bitsPerSample = 0;
+    int blockAlign = 0;
+    MappedAudioReader::SampleType sampleType = MappedAudioReader::SAMPLE_PCM_16;
+
+    static uint16_t readU16(const unsigned char* p)
+    {
+        return (uint16_t)(p[0] | (p[1] << 8));
+    }
+
+    static uint32_t readU32(const unsigned char* p)
+    {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    static uint64_t readU64(const unsigned char* p)
+    {
+        return (uint64_t)readU32(p) | ((uint64_t)readU32(p + 4) << 32);
+    }
+
+    // reads until `bytes` arrived or the stream ended, returns the bytes read
+    size_t readFully(unsigned char* dst, size_t bytes)
+    {
+        size_t total = 0;
+#ifndef _WIN32
+        while (total < bytes) {
+            ssize_t n = ::read(fd, dst + total, bytes - total);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            total += (size_t)n;
+        }
+#else
+        (void)dst; (void)bytes;
+#endif
+        return total;
+    }
+
+    bool skip(uint64_t bytes)
+    {
+        unsigned char discard[4096];
+        while (bytes > 0) {
+            size_t n = bytes < sizeof(discard) ? (size_t)bytes : sizeof(discard);
+            if (readFully(discard, n) != n) return false;
+            bytes -= n;
+        }
+        return true;
+    }
+
+    /*
+     parse()
+     Reads chunk headers up to `data`, picking up `ds64` (RF64/BW64 64-bit
+     sizes) and `fmt ` on the way.
+     */
+    bool parse()
+    {
+        unsigned char header[12];
+        if (readFully(header, 12) != 12) return false;
+        bool isRiff = memcmp(header, "RIFF", 4) == 0;
+        bool isRf64 = memcmp(header, "RF64", 4) == 0 || memcmp(header, "BW64", 4) == 0;
+        if (!(isRiff || isRf64) || memcmp(header + 8, "WAVE", 4) != 0) return false;
+
+        uint64_t ds64DataSize = 0;
+        bool foundFmt = false;
+        uint16_t formatTag = 0;
+        std::vector<unsigned char> payload;
+
+        for (;;) {
+            unsigned char chunk[8];
+            if (readFully(chunk, 8) != 8) return false;
+            uint64_t chunkSize = readU32(chunk + 4);
+
+            if (memcmp(chunk, "data", 4) == 0) {
+                if (!foundFmt) return false;
+                uint64_t dataSize = chunkSize;
+                if (isRf64 && chunkSize == 0xFFFFFFFF) dataSize = ds64DataSize;
+                // sizes a streaming writer couldn't fill in
+                knownLength = !(dataSize == 0 || dataSize == 0xFFFFFFFF || dataSize == 0xFFFFFFFFFFFFFFFFull);
+                if (numChannels <= 0 || blockAlign <= 0 || blockAlign != numChannels * ((bitsPerSample + 7) / 8)) return false;
+                if (!MappedAudioReader::parseSampleType(formatTag, bitsPerSample, sampleType)) return false;
+                numFrames = knownLength ? dataSize / blockAlign : 0;
+                return true;
+            }
+            if (chunkSize == 0xFFFFFFFF) return false;
+
+            bool wanted = memcmp(chunk, "ds64", 4) == 0 || memcmp(chunk, "fmt ", 4) == 0;
+            if (!wanted) {
+                if (!skip(chunkSize + (chunkSize & 1))) return false; // chunks are word aligned
+                continue;
+            }
+            payload.resize((size_t)(chunkSize + (chunkSize & 1)));
+            if (readFully(payload.data(), payload.size()) != payload.size()) return false;
+
+            if (memcmp(chunk, "ds64", 4) == 0 && chunkSize >= 24) {
+                ds64DataSize = readU64(payload.data() + 8);
+            } else if (memcmp(chunk, "fmt ", 4) == 0 && chunkSize >= 16) {
+                formatTag = readU16(payload.data());
+                numChannels = readU16(payload.data() + 2);
+                sampleRate = (int)readU32(payload.data() + 4);
+                blockAlign = readU16(payload.data() + 12);
+                bitsPerSample = readU16(payload.data() + 14);
+                // WAVE_FORMAT_EXTENSIBLE: the real format tag leads the subformat GUID
+                if (formatTag == 0xFFFE && chunkSize >= 40) {
+                    formatTag = readU16(payload.data() + 24);
+                }
+                foundFmt = true;
+            }
+        }
+    }
+
+public:
+    StreamAudioReader() {}
+    ~StreamAudioReader() { close(); }
+
+    StreamAudioReader(const StreamAudioReader&) = delete;
+    StreamAudioReader& operator=(const StreamAudioReader&) = delete;
+
+    /*
+     isStream(path)
+     True for `-` (stdin) and for paths that aren't regular files, like
+     FIFOs, which can't be seeked or mapped.
+     */
+    static bool isStream(const std::string& path)
+    {
+        if (path == "-") return true;
+#ifdef _WIN32
+        return false;
+#else
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && !S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode);
+#endif
+    }
+
+    /*
+     open(path)
+     Opens the stream and reads its header. Returns false for anything
+     but PCM or float WAV/RF64/BW64.
+     */
+    bool open(const std::string& path)
+    {
+        close();
+#ifdef _WIN32
+        (void)path;
+        return false;
+#else
+        if (path == "-") {
+            fd = STDIN_FILENO;
+        } else {
+            fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            ownsFd = true;
+        }
+        if (!parse()) {
+            close();
+            return false;
+        }
+        position = 0;
+        opened = true;
+        return true;
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        if (ownsFd && fd >= 0) ::close(fd);
+#endif
+        fd = -1;
+        ownsFd = false;
+        opened = false;
+        numFrames = 0;
+        position = 0;
+        knownLength = false;
+    }
+
+    bool isOpened() const { return opened; }
+    bool hasLength() const { return knownLength; }
+    int channels() const { return numChannels; }
+    int samplerate() const { return sampleRate; }
+    uint64_t frames() const { return numFrames; } // 0 without a length
+    MappedAudioReader::SampleType getSampleType() const { return sampleType; }
+
+    /*
+     readPlanar(planes, offset, frames)
+     Reads up to `frames` frames into planes[channel][offset + n], blocking
+     until they arrived. Returns fewer only at the end of the stream.
+     */
+    int readPlanar(float** planes, int offset, int frames)
+    {
+        if (!opened || frames <= 0) return 0;
+        if (knownLength && (uint64_t)frames > numFrames - position) frames = (int)(numFrames - position);
+        size_t bytes = (size_t)frames * blockAlign;
+        if (buffer.size() < bytes) buffer.resize(bytes);
+        // a partial frame at the very end is dropped
+        int framesRead = (int)(readFully(buffer.data(), bytes) / blockAlign);
+        MappedAudioReader::convertPlanar(buffer.data(), sampleType, numChannels, blockAlign, planes, offset, framesRead);
+        position += framesRead;
+        return framesRead;
+    }
+};
+
+#endif /* StreamAudioReader_h */
@@ -0,0 +1,297 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef StreamWavWriter_h
+#define StreamWavWriter_h
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "PcmQuantizer.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ StreamWavWriter
+ PCM WAV written front to back to stdout (`-`) or a FIFO, for piping
+ into an encoder without a temporary file.
+
+ The length isn't known when the header goes out, so the RIFF and `data`
+ sizes are written as 0xFFFFFFFF, which readers take as "until EOF", and
+ a 28 byte JUNK chunk is reserved where a `ds64` chunk fits. When the
+ output turns out to be seekable (stdout redirected to a file) close()
+ patches the real sizes in, switching to RF64 past 4GB.
+ */
+class StreamWavWriter
+{
+    int fd = -1;
+    bool ownsFd = false;
+    bool seekable = false;
+    bool headerWritten = false;
+    bool failed = false;
+    int channels = 0;
+    int sampleRate = 0;
+    int bitDepth = 0;
+    std::string comment;
+    uint64_t dataOffset = 0;
+    uint64_t dataBytes = 0;
+
+    static const uint64_t JUNK_OFFSET = 12; // reserved for ds64
+
+    static int& stdoutFd()
+    {
+        static int fd = -1;
+        return fd;
+    }
+
+    static void put16(std::vector<unsigned char>& out, uint32_t v)
+    {
+        out.push_back((unsigned char)(v & 0xff));
+        out.push_back((unsigned char)((v >> 8) & 0xff));
+    }
+
+    static void put32(std::vector<unsigned char>& out, uint32_t v)
+    {
+        put16(out, v & 0xffff);
+        put16(out, v >> 16);
+    }
+
+    static void put64(std::vector<unsigned char>& out, uint64_t v)
+    {
+        put32(out, (uint32_t)(v & 0xffffffff));
+        put32(out, (uint32_t)(v >> 32));
+    }
+
+    static void putId(std::vector<unsigned char>& out, const char* id)
+    {
+        out.insert(out.end(), id, id + 4);
+    }
+
+    bool writeAll(const unsigned char* data, size_t bytes)
+    {
+#ifdef _WIN32
+        (void)data; (void)bytes;
+        return false;
+#else
+        while (bytes > 0) {
+            ssize_t written = ::write(fd, data, bytes);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) return false;
+            data += written;
+            bytes -= (size_t)written;
+        }
+        return true;
+#endif
+    }
+
+    bool patch(uint64_t offset, const std::vector<unsigned char>& bytes)
+    {
+#ifdef _WIN32
+        (void)offset; (void)bytes;
+        return false;
+#else
+        return pwrite(fd, bytes.data(), bytes.size(), (off_t)offset) == (ssize_t)bytes.size();
+#endif
+    }
+
+    bool writeHeader()
+    {
+        std::vector<unsigned char> header;
+        putId(header, "RIFF");
+        put32(header, 0xFFFFFFFF);
+        putId(header, "WAVE");
+        putId(header, "JUNK");
+        put32(header, 28);
+        header.insert(header.end(), 28, 0);
+        putId(header, "fmt ");
+        put32(header, 16);
+        put16(header, 1); // WAVE_FORMAT_PCM
+        put16(header, (uint32_t)channels);
+        put32(header, (uint32_t)sampleRate);
+        put32(header, (uint32_t)(sampleRate * channels * (bitDepth / 8)));
+        put16(header, (uint32_t)(channels * (bitDepth / 8)));
+        put16(header, (uint32_t)bitDepth);
+        if (!comment.empty()) {
+            std::string text = comment;
+            text.push_back('\0');
+            if (text.size() & 1) text.push_back('\0');
+            putId(header, "LIST");
+            put32(header, (uint32_t)(4 + 8 + text.size()));
+            putId(header, "INFO");
+            putId(header, "ICMT");
+            put32(header, (uint32_t)text.size());
+            header.insert(header.end(), text.begin(), text.end());
+        }
+        putId(header, "data");
+        put32(header, 0xFFFFFFFF);
+        dataOffset = header.size();
+        headerWritten = true;
+        return writeAll(header.data(), header.size());
+    }
+
+public:
+    StreamWavWriter() {}
+    ~StreamWavWriter() { close(); }
+
+    StreamWavWriter(const StreamWavWriter&) = delete;
+    StreamWavWriter& operator=(const StreamWavWriter&) = delete;
+
+    /*
+     isStream(path)
+     True for `-` (stdout) and for existing paths that aren't regular
+     files, like FIFOs.
+     */
+    static bool isStream(const std::string& path)
+    {
+        if (path == "-") return true;
+#ifdef _WIN32
+        return false;
+#else
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && !S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode);
+#endif
+    }
+
+    /*
+     claimStdout()
+     Keeps stdout for audio: the original descriptor is saved for `-`
+     outputs and stdout is pointed at stderr, so everything the transcoder
+     prints stays out of the audio stream. Call it before printing.
+     */
+    static void claimStdout()
+    {
+#ifndef _WIN32
+        if (stdoutFd() >= 0) return;
+        fflush(stdout);
+        std::cout.flush();
+        stdoutFd() = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+#endif
+    }
+
+    /*
+     open(path, channels, sampleRate, bitDepth)
+     The header is written with the first frames, so setComment() can
+     still follow.
+     */
+    bool open(const std::string& path, int numChannels, int rate, int bits)
+    {
+        close();
+#ifdef _WIN32
+        (void)path; (void)numChannels; (void)rate; (void)bits;
+        return false;
+#else
+        if (bits != 16 && bits != 24 && bits != 32) return false;
+        if (path == "-") {
+            claimStdout();
+            fd = stdoutFd();
+        } else {
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            ownsFd = true;
+        }
+        if (fd < 0) return false;
+        // a closed pipe should fail the write, not kill the process
+        signal(SIGPIPE, SIG_IGN);
+        struct stat st;
+        seekable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && lseek(fd, 0, SEEK_CUR) == 0;
+        channels = numChannels;
+        sampleRate = rate;
+        bitDepth = bits;
+        comment.clear();
+        dataBytes = 0;
+        failed = false;
+        return true;
+#endif
+    }
+
+    void setComment(const std::string& text) { comment = text; }
+
+    /*
+     close()
+     Finishes the data chunk and, on a seekable output, fills in the sizes.
+     */
+    bool close()
+    {
+        bool ok = !failed;
+        if (fd >= 0) {
+            if (!headerWritten) ok = writeHeader() && ok;
+            if (dataBytes & 1) {
+                unsigned char pad = 0;
+                ok = writeAll(&pad, 1) && ok;
+            }
+            if (seekable && ok) {
+                uint64_t riffSize = dataOffset - 8 + dataBytes + (dataBytes & 1);
+                std::vector<unsigned char> bytes;
+                if (riffSize <= 0xFFFFFFFFull) {
+                    put32(bytes, (uint32_t)riffSize);
+                    ok = patch(4, bytes);
+                    bytes.clear();
+                    put32(bytes, (uint32_t)dataBytes);
+                    ok = ok && patch(dataOffset - 4, bytes);
+                } else {
+                    putId(bytes, "RF64");
+                    put32(bytes, 0xFFFFFFFF);
+                    ok = patch(0, bytes);
+                    bytes.clear();
+                    putId(bytes, "ds64");
+                    put32(bytes, 28);
+                    put64(bytes, riffSize);
+                    put64(bytes, dataBytes);
+                    put64(bytes, dataBytes / (channels * (bitDepth / 8)));
+                    put32(bytes, 0); // no table entries
+                    ok = ok && patch(JUNK_OFFSET, bytes);
+                }
+            }
+#ifndef _WIN32
+            if (ownsFd) ::close(fd);
+#endif
+        }
+        fd = -1;
+        ownsFd = false;
+        headerWritten = false;
+        return ok;
+    }
+
+    bool isOpened() const { return fd >= 0; }
+    bool isSeekable() const { return seekable; }
+    int getChannels() const { return channels; }
+    int getSampleRate() const { return sampleRate; }
+    int getBitDepth() const { return bitDepth; }
+
+    /*
+     writeFrames(interleaved, frames, quantizer, scratch)
+     Converts `frames` interleaved frames with the caller's quantizer, set
+     up for this stream's channels and bit depth, and appends them.
+     */
+    bool writeFrames(const float* interleaved, int frames, PcmQuantizer& quantizer, std::vector<unsigned char>& scratch)
+    {
+        if (fd < 0 || failed) return false;
+        if (quantizer.getBytesPerSample() != bitDepth / 8) return false;
+        if (!headerWritten && !writeHeader()) {
+            failed = true;
+            return false;
+        }
+        if (frames <= 0) return true;
+        size_t bytes = (size_t)frames * channels * (bitDepth / 8);
+        if (scratch.size() < bytes) scratch.resize(bytes);
+        quantizer.quantize(interleaved, frames, scratch.data());
+        if (!writeAll(scratch.data(), bytes)) {
+            failed = true;
+            return false;
+        }
+        dataBytes += bytes;
+        return true;
+    }
+};
+
+#endif /* StreamWavWriter_h */
@@ -0,0 +1,203 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef TimelineMatrix_h
+#define TimelineMatrix_h
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "KeypointTimeline.h"
+#include "MatrixKernel.h"
+#include "RampMatrixKernel.h"
+
+/*
+ TimelineMatrix
+ Time-varying CustomPoints conversion for ADM/Atmos objects. The matrix is
+ computed only at keypoint boundaries (samples where any object has a
+ keypoint) and the coefficients ramp linearly from one boundary's matrix
+ to the next one's sample by sample, so objects glide instead of jumping
+ at block edges and the block size no longer matters for the sound.
+ Before the first and after the last boundary the matrix holds and runs
+ on a plain MatrixKernel.
+
+ Matrices come from the caller's compute function (a transcoder with the
+ points set); moving forward each boundary is computed once, going back
+ (a second pass) searches again. When only some inputs have audio (see
+ ObjectScheduler) the columns of the others are left out of the kernels,
+ so their planes are never read.
+ */
+class TimelineMatrix
+{
+public:
+    // conversion matrix for these object points, rows are output channels
+    typedef std::function<bool(const std::vector<Mach1Point3D>& points, std::vector<std::vector<float>>& matrix)> ComputeFunction;
+
+private:
+    KeypointTimeline keypoints; // own cursors, targets convert concurrently
+    std::vector<long long> boundaries;
+    ComputeFunction compute;
+    int inChannels = 0;
+    int outChannels = 0;
+    RampMatrixKernel::ProcessFn rampFn = nullptr;
+
+    // boundaries[segment] <= sample < boundaries[segment + 1], -1 before
+    // the first boundary, the last index after the last one
+    long long segment = -2;
+    bool ramping = false;
+    std::vector<float> from, to, step, start; // flat row-major
+    long long toBoundary = -1;                // boundary `to` belongs to
+    MatrixKernel scratch;                     // flattens computed matrices
+    MatrixKernel hold;
+    std::vector<std::vector<float>> matrix;
+    std::vector<Mach1Point3D> points;
+    std::vector<const float*> inAt;
+    std::vector<float*> outAt;
+    MatrixKernel::ProcessFn denseFn = nullptr;
+    std::vector<float> columnsStart, columnsStep; // active columns only
+    int numUpdates = 0;
+
+    // copies the active columns of a flat matrix
+    void gatherColumns(const float* flat, const std::vector<int>& columns, std::vector<float>& gathered) const
+    {
+        size_t numColumns = columns.size();
+        gathered.resize((size_t)outChannels * numColumns);
+        for (int o = 0; o < outChannels; o++) {
+            const float* row = flat + (size_t)o * inChannels;
+            for (size_t c = 0; c < numColumns; c++) gathered[(size_t)o * numColumns + c] = row[columns[c]];
+        }
+    }
+
+    // matrix at a boundary, the previous one stays when the conversion fails
+    void matrixAt(long long boundary, std::vector<float>& flat)
+    {
+        long long sample = boundary >= 0 && boundary < (long long)boundaries.size() ? boundaries[boundary] : 0;
+        Mach1Point3D* current = keypoints.pointsAt(sample);
+        points.assign(current, current + keypoints.getNumObjects());
+        if (compute(points, matrix) && scratch.setMatrix(matrix, inChannels, outChannels, MatrixKernel::LAYOUT_OUT_IN)) {
+            flat.assign(scratch.getCoefficients(), scratch.getCoefficients() + (size_t)inChannels * outChannels);
+        }
+        numUpdates++;
+    }
+
+    void setHold(const std::vector<float>& flat)
+    {
+        std::vector<std::vector<float>> rows(outChannels);
+        for (int o = 0; o < outChannels; o++) rows[o].assign(flat.begin() + (size_t)o * inChannels, flat.begin() + (size_t)(o + 1) * inChannels);
+        hold.setMatrix(rows, inChannels, outChannels, MatrixKernel::LAYOUT_OUT_IN);
+    }
+
+    void locate(long long sample)
+    {
+        long long last = (long long)boundaries.size() - 1;
+        long long found = (long long)(std::upper_bound(boundaries.begin(), boundaries.end(), sample) - boundaries.begin()) - 1;
+        if (found == segment) return;
+
+        // the matrix at the next boundary was computed for the segment before
+        if (found > 0 && found == segment + 1 && toBoundary == found) {
+            from.swap(to);
+        } else {
+            matrixAt(found < 0 ? 0 : found, from);
+        }
+        toBoundary = -1;
+        segment = found;
+        ramping = found >= 0 && found < last;
+        if (!ramping) {
+            setHold(from);
+            return;
+        }
+        to = from;
+        matrixAt(found + 1, to);
+        toBoundary = found + 1;
+        double length = (double)(boundaries[found + 1] - boundaries[found]);
+        for (size_t k = 0; k < from.size(); k++) step[k] = (float)((to[k] - from[k]) / length);
+    }
+
+public:
+    /*
+     setup(timeline, inChannels, outChannels, compute)
+     Returns false when the matrix at the first boundary can't be
+     computed with these channel counts.
+     */
+    bool setup(const KeypointTimeline& timeline, int numInChannels, int numOutChannels, ComputeFunction computeFunction)
+    {
+        keypoints = timeline;
+        boundaries = keypoints.getBoundaries();
+        compute = computeFunction;
+        inChannels = numInChannels;
+        outChannels = numOutChannels;
+        rampFn = RampMatrixKernel::getProcess();
+        denseFn = MatrixKernel::getProcess();
+        size_t size = (size_t)inChannels * outChannels;
+        step.assign(size, 0.0f);
+        start.assign(size, 0.0f);
+        inAt.resize(inChannels);
+        outAt.resize(outChannels);
+        segment = -2;
+        toBoundary = -1;
+        numUpdates = 0;
+
+        from.clear();
+        matrixAt(0, from);
+        if (from.size() != size) return false;
+        segment = -2;
+        return true;
+    }
+
+    int getNumBoundaries() const { return (int)boundaries.size(); }
+    int getNumUpdates() const { return numUpdates; }
+    int getInputChannels() const { return inChannels; }
+    int getOutputChannels() const { return outChannels; }
+
+    /*
+     process(in, out, sample, frames, activePlanes)
+     Converts `frames` frames starting at timeline position `sample`. With
+     `activePlanes` only those inputs are converted, the rest count as
+     silent.
+     */
+    void process(const float* const* in, float* const* out, long long sample, int frames, const std::vector<int>* activePlanes = nullptr)
+    {
+        bool gather = activePlanes && (int)activePlanes->size() < inChannels;
+        if (gather && activePlanes->empty()) {
+            for (int o = 0; o < outChannels; o++) memset(out[o], 0, (size_t)frames * sizeof(float));
+            return;
+        }
+        int numColumns = gather ? (int)activePlanes->size() : inChannels;
+
+        int done = 0;
+        while (done < frames) {
+            long long position = sample + done;
+            locate(position);
+
+            // up to the next boundary
+            long long next = -1;
+            if (segment + 1 < (long long)boundaries.size()) next = boundaries[segment + 1];
+            int n = frames - done;
+            if (next >= 0 && next - position < n) n = (int)(next - position);
+
+            for (int i = 0; i < numColumns; i++) inAt[i] = in[gather ? (*activePlanes)[i] : i] + done;
+            for (int o = 0; o < outChannels; o++) outAt[o] = out[o] + done;
+            if (ramping) {
+                double offset = (double)(position - boundaries[segment]);
+                for (size_t k = 0; k < start.size(); k++) start[k] = (float)(from[k] + offset * step[k]);
+                if (gather) {
+                    gatherColumns(start.data(), *activePlanes, columnsStart);
+                    gatherColumns(step.data(), *activePlanes, columnsStep);
+                    rampFn(columnsStart.data(), columnsStep.data(), numColumns, outChannels, inAt.data(), outAt.data(), n);
+                } else {
+                    rampFn(start.data(), step.data(), inChannels, outChannels, inAt.data(), outAt.data(), n);
+                }
+            } else if (gather) {
+                gatherColumns(from.data(), *activePlanes, columnsStart);
+                denseFn(columnsStart.data(), numColumns, outChannels, inAt.data(), outAt.data(), n);
+            } else {
+                hold.process(inAt.data(), outAt.data(), n);
+            }
+            done += n;
+        }
+    }
+};
+
+#endif /* TimelineMatrix_h */
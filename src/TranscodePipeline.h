@@ -0,0 +1,242 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef TranscodePipeline_h
+#define TranscodePipeline_h
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "RingBuffer.h"
+#include "BufferArena.h"
+
+/*
+ TranscodeBlock
+ One unit of work travelling through the pipeline: the planar input planes
+ filled by the reader, the planar output planes filled by the transcoder
+ and the interleaved output frames handed to the writer.
+ */
+struct TranscodeBlock
+{
+    long long index = 0; // block number within the pass
+    int frames = 0;      // valid frames in this block
+
+    // all buffers are carved from the job's BufferArena
+    std::vector<float*> inPtrs;
+    std::vector<float*> outPtrs;
+    float* fileBuffer = nullptr;
+
+    // set by readers that skip silent inputs: only these input planes hold
+    // audio, the others are left as they were
+    bool sparse = false;
+    std::vector<int> activePlanes;
+
+    // inputs of the conversion when they aren't the input planes in order
+    // (objects on the tracks of one file), empty otherwise
+    std::vector<float*> convertPtrs;
+
+    static size_t arenaSize(int inChannels, int outChannels, int blockSize)
+    {
+        return BufferArena::planesSize(inChannels, blockSize)
+            + BufferArena::planesSize(outChannels, blockSize)
+            + BufferArena::padded((size_t)outChannels * blockSize);
+    }
+
+    void allocate(BufferArena& arena, int inChannels, int outChannels, int blockSize)
+    {
+        arena.allocatePlanes(inPtrs, inChannels, blockSize);
+        arena.allocatePlanes(outPtrs, outChannels, blockSize);
+        fileBuffer = arena.allocate((size_t)outChannels * blockSize);
+    }
+};
+
+/*
+ TranscodePipeline
+ Runs the read -> transcode -> write stages of the main sound loop.
+
+ threads == 1: every stage runs on the calling thread, block by block
+ threads == 2: reader on its own thread, transcode + write on the caller
+ threads >= 3: reader, transcoder and writer each on their own thread
+
+ Stages are connected by lock-free SPSC ring buffers of `queueDepth` blocks.
+ Each stage only ever sees blocks in stream order, so stage-local state
+ (read position, filter state in Mach1Transcode, output file position)
+ behaves exactly as in the single threaded loop.
+ */
+class TranscodePipeline
+{
+public:
+    typedef std::function<int(TranscodeBlock&)> ReadStage;   // returns frames read
+    typedef std::function<void(TranscodeBlock&)> BlockStage;
+
+    // returned by a ReadStage to end the run before `numBlocks`, for inputs of unknown length
+    static const int END_OF_STREAM = -1;
+
+private:
+    int threads = 1;
+    int queueDepth = 4;
+    std::vector<TranscodeBlock> blocks;
+
+    std::atomic<bool> abort;
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    void fail()
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!error) {
+            error = std::current_exception();
+        }
+        abort = true;
+    }
+
+public:
+    TranscodePipeline() : abort(false) {}
+
+    void setThreads(int numThreads)
+    {
+        threads = numThreads < 1 ? 1 : numThreads;
+    }
+
+    void setQueueDepth(int depth)
+    {
+        queueDepth = depth < 2 ? 2 : depth;
+    }
+
+    int getThreads() const
+    {
+        return threads;
+    }
+
+    int getQueueDepth() const
+    {
+        return queueDepth;
+    }
+
+    int getNumBlocks() const
+    {
+        return threads > 1 ? queueDepth : 1;
+    }
+
+    // floats the block pool needs from the arena
+    size_t arenaSize(int inChannels, int outChannels, int blockSize) const
+    {
+        return getNumBlocks() * TranscodeBlock::arenaSize(inChannels, outChannels, blockSize);
+    }
+
+    /*
+     setup(arena, inChannels, outChannels, blockSize)
+     Carves the block pool out of `arena`: a single block for serial
+     processing, `queueDepth` blocks when pipelined.
+     */
+    void setup(BufferArena& arena, int inChannels, int outChannels, int blockSize)
+    {
+        blocks.resize(getNumBlocks());
+        for (size_t i = 0; i < blocks.size(); i++) {
+            blocks[i].allocate(arena, inChannels, outChannels, blockSize);
+        }
+    }
+
+    /*
+     run(numBlocks, read, process, write)
+     Pushes `numBlocks` blocks through the stages, or the blocks before the
+     first read that returns END_OF_STREAM, and returns the total number
+     of frames read. Exceptions thrown by any stage stop all stages
+     and are rethrown on the calling thread.
+     */
+    long long run(long long numBlocks, ReadStage read, BlockStage process, BlockStage write)
+    {
+        long long totalFrames = 0;
+
+        if (threads <= 1 || blocks.size() < 2) {
+            TranscodeBlock& block = blocks[0];
+            for (long long i = 0; i < numBlocks; i++) {
+                block.index = i;
+                block.frames = read(block);
+                if (block.frames == END_OF_STREAM) break;
+                totalFrames += block.frames;
+                process(block);
+                write(block);
+            }
+            return totalFrames;
+        }
+
+        abort = false;
+        error = nullptr;
+
+        RingBuffer<TranscodeBlock*> freeQueue(blocks.size());
+        RingBuffer<TranscodeBlock*> readQueue(blocks.size());
+        RingBuffer<TranscodeBlock*> writeQueue(blocks.size());
+        for (size_t i = 0; i < blocks.size(); i++) {
+            freeQueue.tryPush(&blocks[i]);
+        }
+        // stages asleep on a queue have to see the abort
+        auto failAll = [&]() {
+            fail();
+            freeQueue.wake();
+            readQueue.wake();
+            writeQueue.wake();
+        };
+
+        // a null block marks the end of the stream
+        std::thread reader([&]() {
+            try {
+                for (long long i = 0; i < numBlocks; i++) {
+                    TranscodeBlock* block = nullptr;
+                    if (!freeQueue.pop(block, abort)) return;
+                    block->index = i;
+                    block->frames = read(*block);
+                    if (block->frames == END_OF_STREAM) break;
+                    totalFrames += block->frames;
+                    if (!readQueue.push(block, abort)) return;
+                }
+                readQueue.push(nullptr, abort);
+            } catch (...) {
+                failAll();
+            }
+        });
+
+        std::thread transcoder;
+        if (threads >= 3) {
+            transcoder = std::thread([&]() {
+                try {
+                    TranscodeBlock* block = nullptr;
+                    do {
+                        if (!readQueue.pop(block, abort)) return;
+                        if (block) process(*block);
+                        if (!writeQueue.push(block, abort)) return;
+                    } while (block);
+                } catch (...) {
+                    failAll();
+                }
+            });
+        }
+
+        try {
+            RingBuffer<TranscodeBlock*>& inQueue = (threads >= 3) ? writeQueue : readQueue;
+            TranscodeBlock* block = nullptr;
+            while (inQueue.pop(block, abort) && block) {
+                if (threads < 3) process(*block);
+                write(*block);
+                if (!freeQueue.push(block, abort)) break;
+            }
+        } catch (...) {
+            failAll();
+        }
+
+        reader.join();
+        if (transcoder.joinable()) {
+            transcoder.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return totalFrames;
+    }
+};
+
+#endif /* TranscodePipeline_h */
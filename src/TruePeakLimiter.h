@@ -0,0 +1,251 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef TruePeakLimiter_h
+#define TruePeakLimiter_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+/*
+ TruePeakLimiter
+ Single pass look-ahead limiter that keeps the inter-sample (true) peak of
+ every output channel under a ceiling, so a "don't clip" deliverable can be
+ written in one streaming pass instead of a two pass normalize.
+
+ - Peaks are detected on a 4x oversampled signal (12 tap windowed sinc
+   polyphase interpolator), as in ITU-R BS.1770 true-peak metering.
+ - Gain is linked: one gain curve from the loudest channel drives all
+   channels, so the spatial image doesn't shift.
+ - The required gain is held over the look-ahead window and then box
+   filtered over the same window. This ramps the gain down smoothly ahead
+   of a peak and can never come in late. Release is exponential.
+
+ Audio is delayed by getLatency() frames. process() returns fewer frames
+ than it consumes while the delay line primes, and flush() drains the
+ remaining frames at the end so the output is exactly as long as the input.
+ All per-channel loops run over contiguous buffers so they vectorize.
+ */
+class TruePeakLimiter
+{
+    static const int OVERSAMPLE = 4;
+    static const int TAPS = 12;                // per phase
+    static const int DETECT_DELAY = TAPS / 2;  // interpolator look-ahead
+
+    int channels = 0;
+    float ceiling = 1.0f;
+    int lookahead = 0;       // L
+    int latency = 0;         // DETECT_DELAY + L - 1
+    float releaseCoef = 0.0f;
+
+    float phases[OVERSAMPLE - 1][TAPS];
+
+    // per channel: last TAPS input samples followed by the current block
+    std::vector<std::vector<float>> detectBuffers;
+    // per channel: input samples that haven't been emitted yet
+    std::vector<std::vector<float>> delayLines;
+    int pending = 0;
+
+    std::vector<float> peaks;
+    std::vector<float> gains;
+    float lastSegmentPeak = 0.0f;
+
+    // sliding minimum of required gains over the look-ahead window
+    std::vector<float> holdValues;
+    std::vector<long long> holdIndices;
+    int holdHead = 0, holdCount = 0;
+    long long detectIndex = 0;
+
+    // box filter over the look-ahead window
+    std::vector<float> boxValues;
+    int boxPos = 0;
+    double boxSum = 0.0;
+    float envelope = 1.0f;
+
+    long long consumed = 0;   // real input frames
+    long long emitted = 0;    // output frames
+    float minGain = 1.0f;
+
+    void designInterpolator()
+    {
+        const double pi = 3.14159265358979323846;
+        for (int p = 1; p < OVERSAMPLE; p++) {
+            double sum = 0.0;
+            for (int t = 0; t < TAPS; t++) {
+                // tap t weights x[m - TAPS/2 + 1 + t] for the point at m + p/OVERSAMPLE
+                double x = (double)(t - (TAPS / 2 - 1)) - (double)p / OVERSAMPLE;
+                double sinc = std::fabs(x) < 1e-9 ? 1.0 : std::sin(pi * x) / (pi * x);
+                double window = 0.5 + 0.5 * std::cos(pi * x / (TAPS / 2 + 1));
+                phases[p - 1][t] = (float)(sinc * window);
+                sum += phases[p - 1][t];
+            }
+            for (int t = 0; t < TAPS; t++) {
+                phases[p - 1][t] = (float)(phases[p - 1][t] / sum);
+            }
+        }
+    }
+
+    // next gain sample from a new required gain: hold-min -> release -> box filter
+    float nextGain(float required)
+    {
+        int capacity = (int)holdValues.size();
+        // drop entries that can never be the minimum again
+        while (holdCount > 0) {
+            int back = (holdHead + holdCount - 1) % capacity;
+            if (holdValues[back] >= required) holdCount--;
+            else break;
+        }
+        int slot = (holdHead + holdCount) % capacity;
+        holdValues[slot] = required;
+        holdIndices[slot] = detectIndex;
+        holdCount++;
+        // drop entries that left the window
+        while (holdIndices[holdHead] <= detectIndex - lookahead) {
+            holdHead = (holdHead + 1) % capacity;
+            holdCount--;
+        }
+        float held = holdValues[holdHead];
+        detectIndex++;
+
+        envelope = (std::min)(held, envelope + (1.0f - envelope) * releaseCoef);
+
+        boxSum += envelope - boxValues[boxPos];
+        boxValues[boxPos] = envelope;
+        boxPos = (boxPos + 1) % lookahead;
+        return (float)(boxSum / lookahead);
+    }
+
+    int processInternal(float* const* in, float* const* out, int frames, int outOffset)
+    {
+        if (frames <= 0) return 0;
+        if ((int)peaks.size() < frames) {
+            peaks.resize(frames);
+            gains.resize(frames);
+        }
+
+        // 1. linked true-peak detection
+        std::fill(peaks.begin(), peaks.begin() + frames, 0.0f);
+        for (int k = 0; k < channels; k++) {
+            std::vector<float>& buf = detectBuffers[k];
+            if ((int)buf.size() < TAPS + frames) buf.resize(TAPS + frames);
+            float* x = buf.data();
+            if (in) memcpy(x + TAPS, in[k], frames * sizeof(float));
+            else memset(x + TAPS, 0, frames * sizeof(float));
+
+            for (int i = 0; i < frames; i++) {
+                // segment [m, m + 1) with m = i - DETECT_DELAY relative to the block
+                const float* window = x + i + 1;
+                float segment = std::fabs(window[TAPS / 2 - 1]);
+                for (int p = 0; p < OVERSAMPLE - 1; p++) {
+                    float acc = 0.0f;
+                    for (int t = 0; t < TAPS; t++) acc += window[t] * phases[p][t];
+                    segment = (std::max)(segment, std::fabs(acc));
+                }
+                peaks[i] = (std::max)(peaks[i], segment);
+            }
+            memmove(x, x + frames, TAPS * sizeof(float));
+        }
+
+        // 2. gain curve, each sample also covers the segment leading into it
+        for (int i = 0; i < frames; i++) {
+            float peak = (std::max)(peaks[i], lastSegmentPeak);
+            lastSegmentPeak = peaks[i];
+            float required = peak > ceiling ? ceiling / peak : 1.0f;
+            gains[i] = nextGain(required);
+            minGain = (std::min)(minGain, gains[i]);
+        }
+
+        // 3. delay the audio and apply the gain computed `latency` frames later
+        int available = pending + frames;
+        int emit = available - latency;
+        if (emit < 0) emit = 0;
+        const float* g = gains.data() + (frames - emit);
+        for (int k = 0; k < channels; k++) {
+            std::vector<float>& line = delayLines[k];
+            if ((int)line.size() < latency + frames) line.resize(latency + frames);
+            float* d = line.data();
+            if (in) memcpy(d + pending, in[k], frames * sizeof(float));
+            else memset(d + pending, 0, frames * sizeof(float));
+            float* o = out[k] + outOffset;
+            for (int i = 0; i < emit; i++) o[i] = d[i] * g[i];
+            memmove(d, d + emit, (available - emit) * sizeof(float));
+        }
+        pending = available - emit;
+        return emit;
+    }
+
+public:
+    TruePeakLimiter() { designInterpolator(); }
+
+    /*
+     setup(numChannels, sampleRate, ceilingDb, lookaheadMs, releaseMs)
+     ceilingDb is the maximum true peak in dBTP, e.g. -1.0
+     */
+    void setup(int numChannels, int sampleRate, float ceilingDb, float lookaheadMs = 1.5f, float releaseMs = 50.0f)
+    {
+        channels = numChannels;
+        ceiling = std::pow(10.0f, ceilingDb / 20.0f);
+        lookahead = (std::max)(2, (int)(lookaheadMs * 0.001f * sampleRate + 0.5f));
+        latency = DETECT_DELAY + lookahead - 1;
+        releaseCoef = 1.0f - std::exp(-1.0f / (releaseMs * 0.001f * sampleRate));
+
+        detectBuffers.assign(channels, std::vector<float>(TAPS, 0.0f));
+        delayLines.assign(channels, std::vector<float>(latency, 0.0f));
+        pending = 0;
+
+        holdValues.assign(lookahead + 1, 1.0f);
+        holdIndices.assign(lookahead + 1, 0);
+        holdHead = holdCount = 0;
+        detectIndex = 0;
+
+        boxValues.assign(lookahead, 1.0f);
+        boxPos = 0;
+        boxSum = lookahead;
+        envelope = 1.0f;
+        lastSegmentPeak = 0.0f;
+
+        consumed = emitted = 0;
+        minGain = 1.0f;
+    }
+
+    int getLatency() const { return latency; }
+
+    // largest gain reduction applied so far, as a linear gain
+    float getMinGain() const { return minGain; }
+
+    /*
+     process(planes, frames)
+     Limits `frames` frames of planar audio in place. Returns how many
+     frames were written to the start of `planes` (fewer than `frames`
+     while the look-ahead delay fills).
+     */
+    int process(float* const* planes, int frames)
+    {
+        consumed += frames;
+        int produced = processInternal(planes, planes, frames, 0);
+        emitted += produced;
+        return produced;
+    }
+
+    /*
+     flush(planes, offset, capacity)
+     Drains delayed frames into planes[k][offset...] once the input has
+     ended. Returns the frames written; call again while it fills `capacity`.
+     */
+    int flush(float* const* planes, int offset, int capacity)
+    {
+        int produced = 0;
+        while (produced < capacity && emitted < consumed) {
+            long long remaining = consumed - emitted;
+            int want = (int)(std::min)((long long)(capacity - produced), remaining);
+            int n = processInternal(nullptr, planes, want, offset + produced);
+            produced += n;
+            emitted += n;
+        }
+        return produced;
+    }
+};
+
+#endif /* TruePeakLimiter_h */
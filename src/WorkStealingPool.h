@@ -0,0 +1,165 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+#ifndef WorkStealingPool_h
+#define WorkStealingPool_h
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ WorkStealingPool
+ Fixed set of worker threads, each with its own task deque. submit()
+ deals tasks round-robin; a worker takes from the back of its own deque
+ and, once that is empty, steals from the front of another worker's deque,
+ so a few long jobs don't leave the other workers idle.
+
+ Tasks get the index of the worker running them, which lets callers keep
+ per-worker state (e.g. one Mach1Transcode per worker) without locking.
+ */
+class WorkStealingPool
+{
+public:
+    typedef std::function<void(int worker)> Task;
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;  // new tasks or stopping
+    std::condition_variable idle;  // all tasks finished
+    size_t queued = 0;             // submitted and not yet taken
+    size_t pending = 0;            // submitted and not yet finished
+    bool stopping = false;
+    std::exception_ptr error;
+
+    std::atomic<size_t> nextQueue;
+    std::atomic<long long> steals;
+
+    bool take(int worker, Task& task)
+    {
+        {
+            Queue& own = *queues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            Queue& victim = *queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                steals++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(int worker)
+    {
+        for (;;) {
+            Task task;
+            if (take(worker, task)) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    queued--;
+                }
+                try {
+                    task(worker);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error) error = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--pending == 0) idle.notify_all();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return stopping || queued > 0; });
+            if (stopping && queued == 0) return;
+        }
+    }
+
+public:
+    explicit WorkStealingPool(int numWorkers) : nextQueue(0), steals(0)
+    {
+        if (numWorkers < 1) numWorkers = 1;
+        for (int i = 0; i < numWorkers; i++) {
+            queues.emplace_back(new Queue());
+        }
+        for (int i = 0; i < numWorkers; i++) {
+            workers.emplace_back(&WorkStealingPool::workerLoop, this, i);
+        }
+    }
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    int getNumWorkers() const { return (int)workers.size(); }
+    long long getNumSteals() const { return steals; }
+
+    void submit(Task task)
+    {
+        // count first, so a worker can never finish the task before it is counted
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued++;
+            pending++;
+        }
+        Queue& queue = *queues[nextQueue++ % queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    /*
+     wait()
+     Blocks until every submitted task has finished. An exception that
+     escaped a task is rethrown here.
+     */
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [&]() { return pending == 0; });
+        if (error) {
+            std::exception_ptr e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+};
+
+#endif /* WorkStealingPool_h */
@@ -0,0 +1,543 @@
+//  Mach1 Spatial SDK
+//  Copyright © 2017-2021 Mach1. All rights reserved.
+
+/*
+ Microbenchmark for the m1-transcode processing kernels.
+ Build with -DM1_TRANSCODE_BUILD_BENCHMARKS=ON and run `m1-transcode-bench`.
+ Set M1_TRANSCODE_SIMD=scalar|sse|avx2|avx512|neon to cap the dispatched ISA.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "InterleaveKernels.h"
+#include "MatrixKernel.h"
+#include "FixedMatrixKernels.h"
+#include "FusedOutputStage.h"
+#include "PcmQuantizer.h"
+#include "RampMatrixKernel.h"
+
+#if defined(M1_BENCH_SDK_MATRICES)
+#include "Mach1Transcode.h"
+#endif
+
+#define BENCH_FRAMES 4096
+#define BENCH_BLOCK_FRAMES 512 // the transcoder's default block size
+#define BENCH_SECONDS 0.25
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+// runs `fn` repeatedly for about BENCH_SECONDS and returns frames per second
+template <typename Fn>
+static double measure(Fn fn, int framesPerCall)
+{
+    long long calls = 0;
+    BenchClock::time_point start = BenchClock::now();
+    double elapsed = 0.0;
+    do {
+        for (int i = 0; i < 64; i++) fn();
+        calls += 64;
+        elapsed = std::chrono::duration<double>(BenchClock::now() - start).count();
+    } while (elapsed < BENCH_SECONDS);
+    return (double)calls * framesPerCall / elapsed;
+}
+
+#define BENCH_ROUNDS 15
+
+/*
+ measurePair(a, b, framesPerCall, rateA, rateB)
+ Times `a` and `b` in alternating short rounds, so drifting clocks and
+ neighbours on a shared host hit both alike. Returns the median of the
+ per round b/a ratios, with the median rates of each in rateA/rateB.
+ */
+template <typename FnA, typename FnB>
+static double measurePair(FnA a, FnB b, int framesPerCall, double& rateA, double& rateB)
+{
+    std::vector<double> ratesA, ratesB, ratios;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        double roundA = 0.0, roundB = 0.0;
+        for (int half = 0; half < 2; half++) {
+            // swap the order every round so neither always runs first
+            bool aFirst = ((round + half) & 1) == 0;
+            long long calls = 0;
+            BenchClock::time_point start = BenchClock::now();
+            double elapsed = 0.0;
+            do {
+                for (int i = 0; i < 16; i++) {
+                    if (aFirst) a(); else b();
+                }
+                calls += 16;
+                elapsed = std::chrono::duration<double>(BenchClock::now() - start).count();
+            } while (elapsed < BENCH_SECONDS / BENCH_ROUNDS);
+            (aFirst ? roundA : roundB) = (double)calls * framesPerCall / elapsed;
+        }
+        ratesA.push_back(roundA);
+        ratesB.push_back(roundB);
+        ratios.push_back(roundB / roundA);
+    }
+    std::sort(ratesA.begin(), ratesA.end());
+    std::sort(ratesB.begin(), ratesB.end());
+    std::sort(ratios.begin(), ratios.end());
+    rateA = ratesA[BENCH_ROUNDS / 2];
+    rateB = ratesB[BENCH_ROUNDS / 2];
+    return ratios[BENCH_ROUNDS / 2];
+}
+
+// whether `level` is a distinct kernel set on this machine
+static bool levelAvailable(CpuFeatures::SimdLevel level)
+{
+    if (level == CpuFeatures::SIMD_SCALAR) return true;
+    if (level > CpuFeatures::get().getLevel()) return false;
+#if defined(M1_ARCH_NEON)
+    return level == CpuFeatures::SIMD_NEON;
+#else
+    return level != CpuFeatures::SIMD_NEON;
+#endif
+}
+
+// every kernel level against the reference loops, with an odd offset and
+// tail so lane order, remainders and the plane offset are all checked
+static bool verifyInterleave(int c)
+{
+    const CpuFeatures::SimdLevel levels[] = { CpuFeatures::SIMD_SCALAR, CpuFeatures::SIMD_SSE, CpuFeatures::SIMD_NEON, CpuFeatures::SIMD_AVX2, CpuFeatures::SIMD_AVX512 };
+    const int offset = 5, frames = BENCH_FRAMES - 11;
+    std::vector<float> interleaved((size_t)c * BENCH_FRAMES), result((size_t)c * BENCH_FRAMES), expected((size_t)c * BENCH_FRAMES);
+    std::vector<std::vector<float>> planes(c, std::vector<float>(BENCH_FRAMES)), refPlanes(c, std::vector<float>(BENCH_FRAMES));
+    std::vector<float*> ptrs(c), refPtrs(c);
+    for (int k = 0; k < c; k++) {
+        ptrs[k] = planes[k].data();
+        refPtrs[k] = refPlanes[k].data();
+    }
+    // distinct value for every sample, so any swapped lane shows
+    for (size_t i = 0; i < interleaved.size(); i++) interleaved[i] = (float)i;
+    InterleaveKernels::deinterleaveReference(interleaved.data(), c, refPtrs.data(), offset, frames);
+    InterleaveKernels::interleaveReference(refPtrs.data(), c, expected.data(), frames);
+
+    for (CpuFeatures::SimdLevel level : levels) {
+        if (!levelAvailable(level)) continue;
+        InterleaveKernels::DeinterleaveFn demux = InterleaveKernels::getDeinterleave(c, level);
+        InterleaveKernels::InterleaveFn mux = InterleaveKernels::getInterleave(c, level);
+        if (!demux || !mux) continue;
+
+        for (int k = 0; k < c; k++) std::fill(planes[k].begin(), planes[k].end(), 0.0f);
+        demux(interleaved.data(), ptrs.data(), offset, frames);
+        for (int k = 0; k < c; k++) {
+            for (int j = offset; j < offset + frames; j++) {
+                if (planes[k][j] != refPlanes[k][j]) {
+                    printf("  %-8d %s deinterleave MISMATCH at channel %d frame %d\n", c, CpuFeatures::levelName(level), k, j);
+                    return false;
+                }
+            }
+        }
+
+        std::fill(result.begin(), result.end(), 0.0f);
+        mux(refPtrs.data(), result.data(), frames);
+        for (size_t i = 0; i < (size_t)c * frames; i++) {
+            if (result[i] != expected[i]) {
+                printf("  %-8d %s interleave MISMATCH at sample %zu\n", c, CpuFeatures::levelName(level), i);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void benchInterleave()
+{
+    const int counts[] = { 2, 4, 8, 10, 12, 14, 16 };
+
+    printf("Interleave kernels (%d frames per call, ISA: %s)\n", BENCH_FRAMES, CpuFeatures::levelName(CpuFeatures::get().getLevel()));
+    printf("  %-8s %14s %14s %8s %14s %14s %8s\n", "chans", "demux ref", "demux simd", "gain", "mux ref", "mux simd", "gain");
+
+    for (int c : counts) {
+        std::vector<float> interleaved((size_t)c * BENCH_FRAMES);
+        std::vector<float> result((size_t)c * BENCH_FRAMES);
+        std::vector<std::vector<float>> planes(c, std::vector<float>(BENCH_FRAMES));
+        std::vector<float*> ptrs(c);
+        for (int k = 0; k < c; k++) ptrs[k] = planes[k].data();
+        for (size_t i = 0; i < interleaved.size(); i++) interleaved[i] = (float)sin((double)i);
+
+        // verify against the reference loops before timing
+        if (!verifyInterleave(c)) return;
+
+        double demuxRef = measure([&]() { InterleaveKernels::deinterleaveReference(interleaved.data(), c, ptrs.data(), 0, BENCH_FRAMES); }, BENCH_FRAMES);
+        double demuxSimd = measure([&]() { InterleaveKernels::deinterleave(interleaved.data(), c, ptrs.data(), 0, BENCH_FRAMES); }, BENCH_FRAMES);
+        double muxRef = measure([&]() { InterleaveKernels::interleaveReference(ptrs.data(), c, result.data(), BENCH_FRAMES); }, BENCH_FRAMES);
+        double muxSimd = measure([&]() { InterleaveKernels::interleave(ptrs.data(), c, result.data(), BENCH_FRAMES); }, BENCH_FRAMES);
+
+        printf("  %-8d %11.1f Mf/s %9.1f Mf/s %7.2fx %9.1f Mf/s %9.1f Mf/s %7.2fx\n", c,
+               demuxRef / 1e6, demuxSimd / 1e6, demuxSimd / demuxRef,
+               muxRef / 1e6, muxSimd / 1e6, muxSimd / muxRef);
+    }
+    printf("\n");
+}
+
+static void benchMatrix()
+{
+    // in -> out channel counts of common conversions
+    const int pairs[][2] = { { 4, 2 }, { 8, 8 }, { 8, 12 }, { 8, 16 }, { 14, 10 }, { 14, 60 }, { 60, 14 } };
+    const CpuFeatures::SimdLevel levels[] = { CpuFeatures::SIMD_SCALAR, CpuFeatures::SIMD_SSE, CpuFeatures::SIMD_NEON, CpuFeatures::SIMD_AVX2, CpuFeatures::SIMD_AVX512 };
+
+    printf("Matrix kernels (%d frames per call, Mframes/s)\n", BENCH_FRAMES);
+    printf("  %-8s", "in>out");
+    for (CpuFeatures::SimdLevel level : levels) {
+        if (levelAvailable(level)) {
+            printf(" %10s", CpuFeatures::levelName(level));
+        }
+    }
+    printf(" %8s\n", "gain");
+
+    for (const int* pair : pairs) {
+        int in = pair[0], out = pair[1];
+        std::vector<std::vector<float>> matrix(out, std::vector<float>(in));
+        for (int o = 0; o < out; o++) {
+            for (int i = 0; i < in; i++) matrix[o][i] = (float)cos(0.37 * o + 1.3 * i);
+        }
+        std::vector<std::vector<float>> inPlanes(in, std::vector<float>(BENCH_FRAMES)), outPlanes(out, std::vector<float>(BENCH_FRAMES)), refPlanes(out, std::vector<float>(BENCH_FRAMES));
+        std::vector<float*> inPtrs(in), outPtrs(out), refPtrs(out);
+        for (int i = 0; i < in; i++) {
+            inPtrs[i] = inPlanes[i].data();
+            for (int j = 0; j < BENCH_FRAMES; j++) inPlanes[i][j] = (float)sin(0.01 * j + i);
+        }
+        for (int o = 0; o < out; o++) {
+            outPtrs[o] = outPlanes[o].data();
+            refPtrs[o] = refPlanes[o].data();
+        }
+
+        char label[16];
+        snprintf(label, sizeof(label), "%d>%d", in, out);
+        printf("  %-8s", label);
+        double scalar = 0.0, best = 0.0;
+        for (CpuFeatures::SimdLevel level : levels) {
+            if (!levelAvailable(level)) continue;
+            MatrixKernel kernel;
+            kernel.setMatrix(matrix, in, out, MatrixKernel::LAYOUT_OUT_IN, level);
+            kernel.setStrategy(MatrixKernel::STRATEGY_DENSE);
+
+            // verify against the reference loop before timing, odd frame count to hit the tails
+            kernel.processReference(inPtrs.data(), refPtrs.data(), BENCH_FRAMES - 5);
+            kernel.process(inPtrs.data(), outPtrs.data(), BENCH_FRAMES - 5);
+            for (int o = 0; o < out; o++) {
+                for (int j = 0; j < BENCH_FRAMES - 5; j++) {
+                    if (fabs(outPlanes[o][j] - refPlanes[o][j]) > 1e-4f * (1.0f + fabs(refPlanes[o][j]))) {
+                        printf(" MISMATCH at %s out %d frame %d\n", CpuFeatures::levelName(level), o, j);
+                        return;
+                    }
+                }
+            }
+
+            double rate = measure([&]() { kernel.process(inPtrs.data(), outPtrs.data(), BENCH_FRAMES); }, BENCH_FRAMES);
+            if (level == CpuFeatures::SIMD_SCALAR) scalar = rate;
+            if (rate > best) best = rate;
+            printf(" %10.1f", rate / 1e6);
+        }
+        printf(" %7.2fx\n", best / scalar);
+    }
+    printf("\n");
+}
+
+// mostly zero matrices, the dense kernel against the strategy setMatrix() picks
+static void benchSparse()
+{
+    struct Case {
+        const char* name;
+        int in, out;
+        int perRow; // non zero inputs per output, 0 for a scaled channel reorder
+    };
+    const Case cases[] = {
+        { "8>8 reorder", 8, 8, 0 },
+        { "12>12 trim", 12, 12, 0 },
+        { "4>8", 4, 8, 2 },
+        { "12>8", 12, 8, 3 },
+        { "8>16", 8, 16, 2 },
+        { "14>60", 14, 60, 3 },
+    };
+
+    printf("Sparse matrices (%d frames per call, ISA: %s, Mframes/s)\n", BENCH_FRAMES, CpuFeatures::levelName(CpuFeatures::get().getLevel()));
+    printf("  %-12s %8s %10s %10s %8s %s\n", "in>out", "nonzero", "dense", "picked", "gain", "strategy");
+
+    for (const Case& c : cases) {
+        std::vector<std::vector<float>> matrix(c.out, std::vector<float>(c.in, 0.0f));
+        for (int o = 0; o < c.out; o++) {
+            if (c.perRow == 0) {
+                matrix[o][(o * 5 + 3) % c.in] = (c.in == c.out && c.in == 8) ? 1.0f : 0.7f;
+                continue;
+            }
+            for (int k = 0; k < c.perRow; k++) {
+                matrix[o][(o * 3 + k * 5) % c.in] = (float)cos(0.37 * o + 1.3 * k);
+            }
+        }
+        std::vector<std::vector<float>> inPlanes(c.in, std::vector<float>(BENCH_FRAMES)), outPlanes(c.out, std::vector<float>(BENCH_FRAMES)), refPlanes(c.out, std::vector<float>(BENCH_FRAMES));
+        std::vector<float*> inPtrs(c.in), outPtrs(c.out), refPtrs(c.out);
+        for (int i = 0; i < c.in; i++) {
+            inPtrs[i] = inPlanes[i].data();
+            for (int j = 0; j < BENCH_FRAMES; j++) inPlanes[i][j] = (float)sin(0.01 * j + i);
+        }
+        for (int o = 0; o < c.out; o++) {
+            outPtrs[o] = outPlanes[o].data();
+            refPtrs[o] = refPlanes[o].data();
+        }
+
+        MatrixKernel kernel;
+        kernel.setMatrix(matrix, c.in, c.out, MatrixKernel::LAYOUT_OUT_IN);
+        MatrixKernel::Strategy picked = kernel.getStrategy();
+
+        kernel.processReference(inPtrs.data(), refPtrs.data(), BENCH_FRAMES - 5);
+        kernel.process(inPtrs.data(), outPtrs.data(), BENCH_FRAMES - 5);
+        for (int o = 0; o < c.out; o++) {
+            for (int j = 0; j < BENCH_FRAMES - 5; j++) {
+                if (fabs(outPlanes[o][j] - refPlanes[o][j]) > 1e-4f * (1.0f + fabs(refPlanes[o][j]))) {
+                    printf("  %-12s MISMATCH (%s) at out %d frame %d\n", c.name, MatrixKernel::strategyName(picked), o, j);
+                    return;
+                }
+            }
+        }
+
+        double pickedRate = measure([&]() { kernel.process(inPtrs.data(), outPtrs.data(), BENCH_FRAMES); }, BENCH_FRAMES);
+        kernel.setStrategy(MatrixKernel::STRATEGY_DENSE);
+        double denseRate = measure([&]() { kernel.process(inPtrs.data(), outPtrs.data(), BENCH_FRAMES); }, BENCH_FRAMES);
+
+        char label[32];
+        snprintf(label, sizeof(label), "%d/%d", kernel.getNumNonZeros(), c.in * c.out);
+        printf("  %-12s %8s %10.1f %10.1f %7.2fx %s\n", c.name, label, denseRate / 1e6, pickedRate / 1e6, pickedRate / denseRate, MatrixKernel::strategyName(picked));
+    }
+    printf("\n");
+}
+
+// conversion matrix of a registry entry: the SDK's own when the bench is
+// built with it, else a dense stand-in of the same shape
+static std::vector<std::vector<float>> entryMatrix(const FixedMatrixKernels::Entry& entry, bool& fromSdk)
+{
+#if defined(M1_BENCH_SDK_MATRICES)
+    Mach1Transcode<float> m1transcode;
+    m1transcode.setInputFormat(m1transcode.getFormatFromString(entry.inFormat));
+    m1transcode.setOutputFormat(m1transcode.getFormatFromString(entry.outFormat));
+    if (m1transcode.processConversionPath()) {
+        fromSdk = true;
+        return m1transcode.getMatrixConversion();
+    }
+#endif
+    fromSdk = false;
+    std::vector<std::vector<float>> matrix(entry.outChannels, std::vector<float>(entry.inChannels));
+    for (int o = 0; o < entry.outChannels; o++) {
+        for (int i = 0; i < entry.inChannels; i++) matrix[o][i] = (float)cos(0.37 * o + 1.3 * i);
+    }
+    return matrix;
+}
+
+// the FixedMatrixKernels registry against the kernel setMatrix() picks, on
+// blocks the size the transcoder uses; fixed only replaces dense
+static void benchFixed()
+{
+    const int frames = BENCH_BLOCK_FRAMES;
+    printf("Fixed matrix kernels (%d frames per call, ISA: %s, Mframes/s, median of %d alternating rounds)\n", frames, CpuFeatures::levelName(CpuFeatures::get().getLevel()), BENCH_ROUNDS);
+    printf("  %-28s %-7s %8s %10s %10s %8s\n", "conversion", "matrix", "picked", "generic", "fixed", "gain");
+
+    int numEntries = 0;
+    const FixedMatrixKernels::Entry* entries = FixedMatrixKernels::getEntries(numEntries);
+    for (int e = 0; e < numEntries; e++) {
+        const FixedMatrixKernels::Entry& entry = entries[e];
+        int in = entry.inChannels, out = entry.outChannels;
+        bool fromSdk = false;
+        std::vector<std::vector<float>> matrix = entryMatrix(entry, fromSdk);
+        std::vector<std::vector<float>> inPlanes(in, std::vector<float>(frames)), outPlanes(out, std::vector<float>(frames)), refPlanes(out, std::vector<float>(frames));
+        std::vector<float*> inPtrs(in), outPtrs(out), refPtrs(out);
+        for (int i = 0; i < in; i++) {
+            inPtrs[i] = inPlanes[i].data();
+            for (int j = 0; j < frames; j++) inPlanes[i][j] = (float)sin(0.01 * j + i);
+        }
+        for (int o = 0; o < out; o++) {
+            outPtrs[o] = outPlanes[o].data();
+            refPtrs[o] = refPlanes[o].data();
+        }
+
+        char label[64];
+        snprintf(label, sizeof(label), "%s > %s", entry.inFormat, entry.outFormat);
+        MatrixKernel generic, fixed;
+        if (!generic.setMatrix(matrix, in, out, MatrixKernel::LAYOUT_OUT_IN) || !fixed.setMatrix(matrix, in, out, MatrixKernel::LAYOUT_OUT_IN)) {
+            printf("  %-28s %-7s shape doesn't match the entry\n", label, fromSdk ? "sdk" : "dense");
+            continue;
+        }
+        const char* picked = MatrixKernel::strategyName(generic.getStrategy());
+        if (!FixedMatrixKernels::apply(fixed, entry)) {
+            printf("  %-28s %-7s %8s %10s\n", label, fromSdk ? "sdk" : "dense", picked, "not used");
+            continue;
+        }
+
+        fixed.processReference(inPtrs.data(), refPtrs.data(), frames - 5);
+        fixed.process(inPtrs.data(), outPtrs.data(), frames - 5);
+        for (int o = 0; o < out; o++) {
+            for (int j = 0; j < frames - 5; j++) {
+                if (fabs(outPlanes[o][j] - refPlanes[o][j]) > 1e-4f * (1.0f + fabs(refPlanes[o][j]))) {
+                    printf("  %-28s MISMATCH at out %d frame %d\n", label, o, j);
+                    return;
+                }
+            }
+        }
+
+        double genericRate = 0.0, fixedRate = 0.0;
+        double gain = measurePair([&]() { generic.process(inPtrs.data(), outPtrs.data(), frames); },
+                                  [&]() { fixed.process(inPtrs.data(), outPtrs.data(), frames); }, frames, genericRate, fixedRate);
+        printf("  %-28s %-7s %8s %10.1f %10.1f %7.2fx\n", label, fromSdk ? "sdk" : "dense", picked, genericRate / 1e6, fixedRate / 1e6, gain);
+    }
+    printf("\n");
+}
+
+// convert, gain, peak and interleave as separate passes against FusedOutputStage
+static void benchFused()
+{
+    const int pairs[][2] = { { 8, 2 }, { 8, 4 }, { 8, 8 }, { 14, 10 }, { 8, 12 }, { 8, 16 }, { 14, 24 }, { 8, 32 }, { 14, 60 } };
+    const int frames = BENCH_BLOCK_FRAMES;
+
+    printf("Output stage (%d frames per call, ISA: %s, Mframes/s, median of %d alternating rounds)\n", frames, CpuFeatures::levelName(CpuFeatures::get().getLevel()), BENCH_ROUNDS);
+    printf("  %-8s %10s %10s %8s %8s\n", "in>out", "separate", "fused", "gain", "used");
+
+    for (const int* pair : pairs) {
+        int in = pair[0], out = pair[1];
+        std::vector<std::vector<float>> matrix(out, std::vector<float>(in));
+        for (int o = 0; o < out; o++) {
+            for (int i = 0; i < in; i++) matrix[o][i] = (float)cos(0.37 * o + 1.3 * i);
+        }
+        MatrixKernel kernel;
+        kernel.setMatrix(matrix, in, out, MatrixKernel::LAYOUT_OUT_IN);
+
+        BufferArena arena;
+        arena.reset(BufferArena::planesSize(in, frames) + BufferArena::planesSize(out, frames) + BufferArena::padded((size_t)out * frames) + FusedOutputStage::arenaSize(out));
+        std::vector<float*> inPtrs, outPtrs;
+        arena.allocatePlanes(inPtrs, in, frames);
+        arena.allocatePlanes(outPtrs, out, frames);
+        float* interleaved = arena.allocate((size_t)out * frames);
+        for (int i = 0; i < in; i++) {
+            for (int j = 0; j < frames; j++) inPtrs[i][j] = (float)sin(0.01 * j + i);
+        }
+        FusedOutputStage stage;
+        stage.setup(arena, kernel, out, 1);
+
+        float peak = 0.0f;
+        double separate = 0.0, fused = 0.0;
+        double gain = measurePair([&]() {
+            kernel.process(inPtrs.data(), outPtrs.data(), frames);
+            for (int o = 0; o < out; o++) {
+                for (int j = 0; j < frames; j++) outPtrs[o][j] *= 0.5f;
+            }
+            for (int o = 0; o < out; o++) {
+                for (int j = 0; j < frames; j++) peak = (std::max)(peak, std::fabs(outPtrs[o][j]));
+            }
+            InterleaveKernels::interleave(outPtrs.data(), out, interleaved, frames);
+        }, [&]() { peak = (std::max)(peak, stage.process(inPtrs.data(), frames, 0.5f, interleaved)); }, frames, separate, fused);
+
+        char label[32];
+        snprintf(label, sizeof(label), "%d>%d", in, out);
+        printf("  %-8s %10.1f %10.1f %7.2fx %8s\n", label, separate / 1e6, fused / 1e6, gain, FusedOutputStage::worthIt(kernel, out) ? "fused" : "separate");
+    }
+    printf("\n");
+}
+
+static void benchQuantize()
+{
+    const int channels = 12;
+    const int bits[] = { 16, 24, 32 };
+    const size_t samples = (size_t)channels * BENCH_FRAMES;
+
+    printf("PCM quantizer (%d channels, %d frames per call, ISA: %s, Msamples/s)\n", channels, BENCH_FRAMES, CpuFeatures::levelName(CpuFeatures::get().getLevel()));
+    printf("  %-8s %10s %10s %8s %10s %10s\n", "bits", "reference", "simd", "gain", "tpdf", "shaped");
+
+    std::vector<float> src(samples);
+    for (size_t i = 0; i < samples; i++) src[i] = 1.1f * (float)sin(0.001 * (double)i);
+    std::vector<unsigned char> expected(samples * 4), result(samples * 4);
+
+    for (int b : bits) {
+        PcmQuantizer quantizer;
+        quantizer.setup(channels, b);
+        // verify against the reference conversion before timing
+        PcmQuantizer::quantizeReference(src.data(), samples, b, expected.data());
+        quantizer.quantize(src.data(), BENCH_FRAMES, result.data());
+        if (memcmp(expected.data(), result.data(), samples * (b / 8)) != 0) {
+            printf("  %-8d MISMATCH\n", b);
+            continue;
+        }
+
+        double reference = measure([&]() { PcmQuantizer::quantizeReference(src.data(), samples, b, result.data()); }, BENCH_FRAMES * channels);
+        double simd = measure([&]() { quantizer.quantize(src.data(), BENCH_FRAMES, result.data()); }, BENCH_FRAMES * channels);
+        PcmQuantizer tpdf, shaped;
+        tpdf.setup(channels, b, PcmQuantizer::DITHER_TPDF);
+        shaped.setup(channels, b, PcmQuantizer::DITHER_SHAPED);
+        double tpdfRate = measure([&]() { tpdf.quantize(src.data(), BENCH_FRAMES, result.data()); }, BENCH_FRAMES * channels);
+        double shapedRate = measure([&]() { shaped.quantize(src.data(), BENCH_FRAMES, result.data()); }, BENCH_FRAMES * channels);
+
+        printf("  %-8d %10.1f %10.1f %7.2fx %10.1f %10.1f\n", b, reference / 1e6, simd / 1e6, simd / reference, tpdfRate / 1e6, shapedRate / 1e6);
+    }
+    printf("\n");
+}
+
+// time-varying timeline conversion against a fixed matrix of the same shape
+static void benchRamp()
+{
+    // objects -> output channel counts of timeline conversions
+    const int pairs[][2] = { { 16, 8 }, { 32, 12 }, { 64, 16 } };
+
+    printf("Ramp kernel (%d frames per call, ISA: %s, Mframes/s)\n", BENCH_FRAMES, CpuFeatures::levelName(CpuFeatures::get().getLevel()));
+    printf("  %-8s %10s %10s %8s %10s\n", "in>out", "reference", "ramp", "gain", "fixed");
+
+    for (const int* pair : pairs) {
+        int in = pair[0], out = pair[1];
+        std::vector<float> start((size_t)in * out), step((size_t)in * out);
+        std::vector<std::vector<float>> matrix(out, std::vector<float>(in));
+        for (int o = 0; o < out; o++) {
+            for (int i = 0; i < in; i++) {
+                start[(size_t)o * in + i] = matrix[o][i] = (float)cos(0.37 * o + 1.3 * i);
+                step[(size_t)o * in + i] = 1e-5f * (float)sin(0.7 * o + i);
+            }
+        }
+        std::vector<std::vector<float>> inPlanes(in, std::vector<float>(BENCH_FRAMES)), outPlanes(out, std::vector<float>(BENCH_FRAMES)), refPlanes(out, std::vector<float>(BENCH_FRAMES));
+        std::vector<float*> inPtrs(in), outPtrs(out), refPtrs(out);
+        for (int i = 0; i < in; i++) {
+            inPtrs[i] = inPlanes[i].data();
+            for (int j = 0; j < BENCH_FRAMES; j++) inPlanes[i][j] = (float)sin(0.01 * j + i);
+        }
+        for (int o = 0; o < out; o++) {
+            outPtrs[o] = outPlanes[o].data();
+            refPtrs[o] = refPlanes[o].data();
+        }
+
+        char label[16];
+        snprintf(label, sizeof(label), "%d>%d", in, out);
+        RampMatrixKernel::ProcessFn ramp = RampMatrixKernel::getProcess();
+
+        // verify against the reference loop before timing, odd frame count to hit the tails
+        RampMatrixKernel::processReference(start.data(), step.data(), in, out, inPtrs.data(), refPtrs.data(), BENCH_FRAMES - 5);
+        ramp(start.data(), step.data(), in, out, inPtrs.data(), outPtrs.data(), BENCH_FRAMES - 5);
+        for (int o = 0; o < out; o++) {
+            for (int j = 0; j < BENCH_FRAMES - 5; j++) {
+                if (fabs(outPlanes[o][j] - refPlanes[o][j]) > 1e-4f * (1.0f + fabs(refPlanes[o][j]))) {
+                    printf("  %-8s MISMATCH at out %d frame %d\n", label, o, j);
+                    return;
+                }
+            }
+        }
+
+        MatrixKernel fixed;
+        fixed.setMatrix(matrix, in, out, MatrixKernel::LAYOUT_OUT_IN);
+        double reference = measure([&]() { RampMatrixKernel::processReference(start.data(), step.data(), in, out, inPtrs.data(), outPtrs.data(), BENCH_FRAMES); }, BENCH_FRAMES);
+        double simd = measure([&]() { ramp(start.data(), step.data(), in, out, inPtrs.data(), outPtrs.data(), BENCH_FRAMES); }, BENCH_FRAMES);
+        double fixedRate = measure([&]() { fixed.process(inPtrs.data(), outPtrs.data(), BENCH_FRAMES); }, BENCH_FRAMES);
+        printf("  %-8s %10.1f %10.1f %7.2fx %10.1f\n", label, reference / 1e6, simd / 1e6, simd / reference, fixedRate / 1e6);
+    }
+    printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+    benchInterleave();
+    benchMatrix();
+    benchSparse();
+    benchFixed();
+    benchFused();
+    benchQuantize();
+    benchRamp();
+    return 0;
+}
@@ -23,6 +23,15 @@
 #include <sstream>
 #include <fstream>
 #include <string>
+#include <memory>
+#include <map>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
 
 #include "Mach1Transcode.h"
 #include "Mach1AudioTimeline.h"
@@ -34,26 +43,38 @@
 #include "pugixml.hpp"
 #include "bw64/bw64.hpp"
 #include "adm_metadata.h"
+#include "TranscodePipeline.h"
+#include "MappedAudioReader.h"
+#include "InterleaveKernels.h"
+#include "BlockSizeTuner.h"
+#include "BufferArena.h"
+#include "SpillFile.h"
+#include "TruePeakLimiter.h"
+#include "WorkStealingPool.h"
+#include "ResourceBudget.h"
+#include "PositionalWavWriter.h"
+#include "PcmQuantizer.h"
+#include "StreamAudioReader.h"
+#include "StreamWavWriter.h"
+#include "AsyncFileIO.h"
+#include "AsyncAudioReader.h"
+#include "AsyncWavWriter.h"
+#include "InputPrefetcher.h"
+#include "MatrixKernel.h"
+#include "FixedMatrixKernels.h"
+#include "FusedOutputStage.h"
+#include "KeypointTimeline.h"
+#include "TimelineMatrix.h"
+#include "ObjectScheduler.h"
+#include "AdmTrackMap.h"
 
 std::vector<Mach1AudioObject> audioObjects;
-std::vector<Mach1Point3D> keypoints;
+KeypointTimeline keypointTimeline; // keypoints of audioObjects
+std::mutex audioObjectsMutex; // one timeline job at a time owns audioObjects
 
 Mach1Point3D* callbackPointsSampler(long long sample, int& n) {
-    keypoints.resize(audioObjects.size());
-    
-    for (int i = 0; i < audioObjects.size(); i++) {
-        std::vector<Mach1KeyPoint> kp = audioObjects[i].getKeyPoints();
-
-        keypoints[i] = kp[0].point;
-        for (int j = 0; j < kp.size(); j++) {
-            if (kp[j].sample >= sample) {
-                keypoints[i] = kp[j].point;
-                continue;
-            }
-        }
-    }
-    n = keypoints.size();
-    return keypoints.data();
+    n = keypointTimeline.getNumObjects();
+    return keypointTimeline.pointsAt(sample);
 }
 
 using namespace std;
@@ -82,24 +103,46 @@ void printHelp() {
 	std::cout << std::endl;
 	std::cout << "usage: ./m1-transcode -in-file test_s8.wav -in-fmt M1Spatial -out-file test_b.wav -out-fmt ACNSN3D -out-file-chans 0" << std::endl;
     std::cout << "usage: ./m1-transcode -in-file test_s8.wav -in-fmt M1Spatial -out-file 7_1_2-ADM.wav -out-fmt 7.1.2_M -write-metada -out-file-chans 0" << std::endl;
+    std::cout << "usage: ffmpeg -i in.mov -f wav - | ./m1-transcode -in-file - -in-fmt M1Spatial -out-file - -out-fmt 7.1.4_C | encoder" << std::endl;
+    std::cout << "usage: ./m1-transcode -in-file test_s8.wav -in-fmt M1Spatial -out-file test_b.wav test_714.wav -out-fmt ACNSN3D 7.1.4_C" << std::endl;
+    std::cout << "usage: ./m1-transcode -in-file session_adm.wav -in-fmt ADM -out-file test_s8.wav -out-fmt M1Spatial" << std::endl;
     std::cout << std::endl;
     std::cout << "all boolean argument flags should be used before the end of the command to ensure it is captured" << std::endl;
 	std::cout << std::endl;
 	std::cout << "  -help                 - list command line options" << std::endl;
     std::cout << "  -formats              - list all available formats" << std::endl;
-	std::cout << "  -in-file  <filename>  - input file: put quotes around sets of files" << std::endl;
+	std::cout << "  -in-file  <filename>  - input file: put quotes around sets of files, - or a FIFO streams WAV/RF64 in a single pass" << std::endl;
 	std::cout << "  -in-fmt   <fmt>       - input format: see supported formats below" << std::endl;
     std::cout << "  -in-json  <json>      - input json: for input custom json Mach1Transcode templates" << std::endl;
-	std::cout << "  -out-file <filename>  - output file. full name for single file or name stem for file sets" << std::endl;
-	std::cout << "  -out-fmt  <fmt>       - output format: see supported formats below" << std::endl;
+	std::cout << "  -out-file <filename>  - output file. full name for single file or name stem for file sets, - streams a WAV to stdout, one per -out-fmt" << std::endl;
+	std::cout << "  -out-fmt  <fmt>       - output format: see supported formats below, several fan out from one read of the input" << std::endl;
     std::cout << "  -out-json  <json>     - output json: for output custom json Mach1Transcode templates" << std::endl;
 	std::cout << "  -out-file-chans <#>   - output file channels: 1, 2 or 0 (0 = multichannel)" << std::endl;
 	std::cout << "  -normalize            - two pass normalize absolute peak to zero dBFS" << std::endl;
 	std::cout << "  -master-gain <#>      - final output gain in dB like -3 or 2.3" << std::endl;
+	std::cout << "  -limit <#>            - single pass look-ahead true peak limiter, ceiling in dBTP like -1" << std::endl;
 	std::cout << "  -lfe-sub <#>          - indicates channel(s) to be filtered and treated as LFE/SUB, delimited by ',' for multiple channels" << std::endl;
 	std::cout << "  -spatial-downmix <#>  - compare top vs. bottom of the input soundfield, if difference is less than the set threshold (float) output format will be Mach1 Horizon" << std::endl;
 	std::cout << "  -extract-metadata     - export any detected XML metadata into separate text file" << std::endl;
 	std::cout << "  -write-metadata       - write channel-bed ADM metadata for supported formats" << std::endl;
+	std::cout << "  -threads <#>          - pipeline threads: 1 = serial, 2 = separate reader, 3 = separate reader, transcoder and writer" << std::endl;
+	std::cout << "  -queue-depth <#>      - number of blocks in flight between pipeline stages (default 4)" << std::endl;
+	std::cout << "  -block-size <#>       - processing block size in frames (default 512)" << std::endl;
+	std::cout << "  -autotune             - time several block sizes on the actual channel counts and use the fastest" << std::endl;
+	std::cout << "  -spill-budget <#>     - max MB of scratch disk used to keep two pass results instead of transcoding twice (default 8192, 0 = off)" << std::endl;
+	std::cout << "  -spill-dir <path>     - folder for the two pass scratch file (default $TMPDIR or /tmp)" << std::endl;
+	std::cout << "  -sdk-matrix           - convert with Mach1Transcode::processConversion instead of the SIMD matrix kernel" << std::endl;
+	std::cout << "  -dither <mode>        - none, tpdf or shaped (tpdf with noise shaping) when writing 16 or 24 bit WAV" << std::endl;
+	std::cout << "  -io-backend <mode>    - sync, uring (io_uring, falls back to threads) or threads: large queued reads and writes for WAV files (default sync)" << std::endl;
+	std::cout << "  -io-depth <#>         - 1MB requests per file in flight with -io-backend (default 4)" << std::endl;
+	std::cout << "  -write-buffer <#>     - MB staged per output file and written in one go, preallocating WAV outputs (default 0 = libsndfile, 1 with -io-backend)" << std::endl;
+	std::cout << "  -direct-io            - write WAV outputs with O_DIRECT, past the page cache" << std::endl;
+	std::cout << "  -prefetch <#>         - chunks of 16K frames read ahead on every input file concurrently when there are several (default 4, 0 = off)" << std::endl;
+	std::cout << "  -segments <#>         - split the input into this many time ranges and transcode them concurrently" << std::endl;
+	std::cout << "  -batch <manifest>     - run every job of a yaml manifest in one process, other options apply to all jobs" << std::endl;
+	std::cout << "  -jobs <#>             - batch jobs transcoded concurrently (default 1)" << std::endl;
+	std::cout << "  -max-memory <#>       - cap in MB on the sample buffers of concurrent batch jobs (default 0 = no cap)" << std::endl;
+	std::cout << "  -max-open-files <#>   - cap on files held open by concurrent batch jobs (default: process limit)" << std::endl;
 	std::cout << std::endl;
 }
 
@@ -163,6 +206,26 @@ audiofileInfo printFileInfo(SndfileHandle file, bool displayLength = true) {
     return inputFileInfo;
 }
 
+/*
+ writeTempFile(contents, extension)
+ Writes `contents` to a new file in the scratch folder and returns its
+ path, empty on failure. The caller removes it.
+ */
+std::string writeTempFile(const std::string& contents, const std::string& extension) {
+    std::string path = SpillFile::defaultDirectory() + "/m1-transcode-"
+        + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + "-"
+        + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + extension;
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return "";
+    file.write(contents.data(), contents.size());
+    file.close();
+    if (!file) {
+        remove(path.c_str());
+        return "";
+    }
+    return path;
+}
+
 std::string prepareAdmMetadata(const char* admString, float duration, int sampleRate, int format) {
     // Used to find duration in time of input file
     // to correctly edit the ADM metadata and add the appropriate
@@ -234,35 +297,98 @@ std::string prepareAdmMetadata(const char* admString, float duration, int sample
 }
 
 // ---------------------------------------------------------
-#define BUFFERLEN 512
+#define BUFFERLEN 512 // default processing block size
+#define MIN_BUFFERLEN 16
+#define MAX_BUFFERLEN 262144
+#define MAX_TIMELINE_OBJECTS 1024 // ADM/Atmos objects, past Mach1TranscodeMAXCHANS on the timeline matrix
+
+/*
+ WriteBuffering
+ How SndFileWriter writes PCM WAV outputs, without a queue they go to
+ libsndfile.
+ */
+struct WriteBuffering {
+    AsyncFileIO* io = nullptr;
+    int buffers = 0;          // queue buffers per file
+    long long frames = 0;     // expected length to preallocate, 0 = unknown
+    bool directIO = false;
+};
 
 class SndFileWriter {
     std::unique_ptr<bw64::Bw64Writer> outBw64;
+    std::unique_ptr<StreamWavWriter> outStream;
+    std::unique_ptr<AsyncWavWriter> outAsync;
     SndfileHandle outSnd;
     int channels;
+    PcmQuantizer quantizer;
+    std::vector<unsigned char> pcm;
+    bool rawPcm = false; // samples are quantized here and written with writeRaw
+    std::vector<float> staging; // BW64 frames collected into large writes
+    int stagedFrames = 0;
     
     enum SNDFILETYPE {
         SNDFILETYPE_BW64,
-        SNDFILETYPE_SND
+        SNDFILETYPE_SND,
+        SNDFILETYPE_STREAM, // stdout or a FIFO
+        SNDFILETYPE_ASYNC   // PCM WAV through an AsyncFileIO queue
     } type;
 
+    void flushStaging() {
+        if (stagedFrames > 0) {
+            outBw64->write(staging.data(), stagedFrames);
+            stagedFrames = 0;
+        }
+    }
+
 public:
-    void open(std::string outfilestr, int sampleRate, int channels, int format) {
-        outSnd = SndfileHandle(outfilestr, SFM_WRITE, format, channels, (int)sampleRate);
+    ~SndFileWriter() {
+        if (outBw64) flushStaging();
+    }
+
+    void open(std::string outfilestr, int sampleRate, int channels, int format, PcmQuantizer::Dither dither = PcmQuantizer::DITHER_NONE, const WriteBuffering& buffering = WriteBuffering()) {
         this->channels = channels;
+        // WAV PCM is converted by PcmQuantizer, other subformats are left to libsndfile
+        int bits = 0;
+        if ((format & SF_FORMAT_TYPEMASK) == SF_FORMAT_WAV) {
+            if ((format & SF_FORMAT_SUBMASK) == SF_FORMAT_PCM_16) bits = 16;
+            if ((format & SF_FORMAT_SUBMASK) == SF_FORMAT_PCM_24) bits = 24;
+            if ((format & SF_FORMAT_SUBMASK) == SF_FORMAT_PCM_32) bits = 32;
+        }
+        rawPcm = quantizer.setup(channels, bits, dither);
+        if (StreamWavWriter::isStream(outfilestr)) {
+            outStream.reset(new StreamWavWriter());
+            if (!rawPcm || !outStream->open(outfilestr, channels, sampleRate, bits)) outStream.reset();
+            type = SNDFILETYPE_STREAM;
+            return;
+        }
+        if (buffering.io && rawPcm) {
+            outAsync.reset(new AsyncWavWriter());
+            if (outAsync->open(outfilestr, channels, sampleRate, bits, *buffering.io, buffering.buffers, buffering.frames, buffering.directIO)) {
+                type = SNDFILETYPE_ASYNC;
+                return;
+            }
+            outAsync.reset(); // out of queue buffers, libsndfile it is
+        }
+        outSnd = SndfileHandle(outfilestr, SFM_WRITE, format, channels, (int)sampleRate);
         type = SNDFILETYPE_SND;
     }
 
-    void open(std::string outfilestr, int sampleRate, int channels, int format, bw64::ChnaChunk chnaChunkAdm, bw64::AxmlChunk axmlChunkAdm) {
+    void open(std::string outfilestr, int sampleRate, int channels, int format, bw64::ChnaChunk chnaChunkAdm, bw64::AxmlChunk axmlChunkAdm, size_t stagingBytes = 0) {
         // TODO: make variable of samplerate and bitdepth based on input
         outBw64 = bw64::writeFile(outfilestr, channels, sampleRate, format, std::make_shared<bw64::ChnaChunk>(chnaChunkAdm), std::make_shared<bw64::AxmlChunk>(axmlChunkAdm));
         this->channels = channels;
         type = SNDFILETYPE_BW64;
+        staging.assign(stagingBytes / sizeof(float) / channels * channels, 0.0f);
+        stagedFrames = 0;
     }
 
     bool isOpened() {
         if (type == SNDFILETYPE_SND) {
             return outSnd.error() == 0;
+        } else if (type == SNDFILETYPE_STREAM) {
+            return outStream != nullptr;
+        } else if (type == SNDFILETYPE_ASYNC) {
+            return outAsync->isOpened();
         } else {
             return true;
         }
@@ -277,23 +403,78 @@ public:
     void printInfo() {
         if (type == SNDFILETYPE_SND) {
             printFileInfo(outSnd, false);
+        } else if (type == SNDFILETYPE_STREAM) {
+            std::cout << "Sample Rate:        " << outStream->getSampleRate() << std::endl;
+            std::cout << "Bit Depth:          " << outStream->getBitDepth() << std::endl;
+            std::cout << "Channels:           " << outStream->getChannels() << std::endl;
+            std::cout << "Streaming:          " << (outStream->isSeekable() ? "sizes patched on close" : "open ended header") << std::endl;
+            std::cout << std::endl;
+        } else if (type == SNDFILETYPE_ASYNC) {
+            std::cout << "Sample Rate:        " << outAsync->getSampleRate() << std::endl;
+            std::cout << "Bit Depth:          " << outAsync->getBitDepth() << std::endl;
+            std::cout << "Channels:           " << outAsync->getChannels() << std::endl;
+            if (outAsync->isPreallocated() || outAsync->isDirect()) {
+                std::cout << "Disk:               " << (outAsync->isPreallocated() ? "preallocated" : "")
+                    << (outAsync->isPreallocated() && outAsync->isDirect() ? ", " : "") << (outAsync->isDirect() ? "direct I/O" : "") << std::endl;
+            }
+            std::cout << std::endl;
+        }
+        if (type != SNDFILETYPE_BW64 && rawPcm && quantizer.getDither() != PcmQuantizer::DITHER_NONE) {
+            std::cout << "Dither:             " << PcmQuantizer::ditherName(quantizer.getDither()) << std::endl;
         }
     }
 
     void setString(int str_type, const char* str) {
         if (type == SNDFILETYPE_SND) {
             outSnd.setString(str_type, str);
+        } else if (type == SNDFILETYPE_STREAM && str_type == SF_STR_COMMENT) {
+            outStream->setComment(str);
+        } else if (type == SNDFILETYPE_ASYNC && str_type == SF_STR_COMMENT) {
+            outAsync->setComment(str);
         }
     }
 
     void write(float* buf, int frames) {
-        if (type == SNDFILETYPE_SND) {
+        if (type == SNDFILETYPE_SND && rawPcm) {
+            size_t bytes = (size_t)frames * channels * quantizer.getBytesPerSample();
+            if (pcm.size() < bytes) pcm.resize(bytes);
+            quantizer.quantize(buf, frames, pcm.data());
+            outSnd.writeRaw(pcm.data(), (sf_count_t)bytes);
+        } else if (type == SNDFILETYPE_STREAM) {
+            if (!outStream->writeFrames(buf, frames, quantizer, pcm)) {
+                throw std::runtime_error("writing out-file");
+            }
+        } else if (type == SNDFILETYPE_ASYNC) {
+            if (!outAsync->writeFrames(buf, frames, quantizer)) {
+                throw std::runtime_error("writing out-file");
+            }
+        } else if (type == SNDFILETYPE_SND) {
             outSnd.write(buf, frames*channels);
+        } else if (staging.size() >= (size_t)frames * channels) {
+            if ((size_t)(stagedFrames + frames) * channels > staging.size()) flushStaging();
+            memcpy(staging.data() + (size_t)stagedFrames * channels, buf, (size_t)frames * channels * sizeof(float));
+            stagedFrames += frames;
         } else {
+            flushStaging();
             outBw64->write(buf, frames);
-            outBw64->framesWritten();
         }
     }
+
+    /*
+     close()
+     Finishes streamed, queued and staged outputs, false if their last
+     writes failed. The other types are finished when the writer goes away.
+     */
+    bool close() {
+        if (type == SNDFILETYPE_STREAM && outStream) {
+            return outStream->close();
+        } else if (type == SNDFILETYPE_ASYNC) {
+            return outAsync->close();
+        } else if (type == SNDFILETYPE_BW64) {
+            flushStaging();
+        }
+        return true;
+    }
 };
 
 void parseFile(SndfileHandle infile, int channels) {
@@ -313,83 +494,346 @@ void parseFile(SndfileHandle infile, int channels) {
 	};
 }
 
-int main(int argc, char* argv[]) {
-    Mach1AudioTimeline m1audioTimeline;
-    Mach1Transcode<float> m1transcode;
-    m1transcode.setCustomPointsSamplerCallback(callbackPointsSampler);
-
-	// locals for cmd line parameters
-	bool fileOut = false;
-    bool useAudioTimeline = false; // adm, atmos formats
+/*
+ TranscodeJob
+ Settings for one conversion, read from the command line or from one entry
+ of a batch manifest.
+ */
+struct TranscodeJob {
+	std::vector<std::string> inFiles;
+	std::string inFolder;      // audio files of ADM/Atmos timelines
+	std::string inFileMeta;    // Atmos metadata file
+	std::string inFmtStr;
+	int inFmt = 0;
+	bool useAudioTimeline = false; // adm, atmos formats
+	std::string outfilename;
+	std::string outFmtStr;
+	int outFmt = 0;
+	// every -out-fmt/-out-file target, the three fields above hold the first
+	std::vector<std::string> outfilenames;
+	std::vector<std::string> outFmtStrs;
+	std::vector<int> outFmts;
+	std::string inJsonStr, outJsonStr; // custom point formats
+	int outFileChans = 0;
 	//TODO: inputGain = 1.0f; // in level, not db
 	float masterGain = 1.0f; // in level, not dB
 	bool normalize = false;
-    char* infolder = NULL;
-	char* infilename = NULL;
-	char* inFmtStr = NULL;
-	int inFmt;
-	char* outfilename = NULL;
-	std::string md_outfilename = "";
-	char* outFmtStr = NULL;
-    int outFmt;
-	int outFileChans;
-	int channels;
+	bool limit = false;
+	float limitCeiling = 0.0f; // in dBTP
 	bool spatialDownmixerMode = false;
 	float corrThreshold = 0.0;
 	std::vector<int> subChannelIndices;
-	bool processSubs = false;
 	bool extractMetadata = false;
-    bool writeMetadata = false;
-	ADMParse admParse; // Reading ADM data
+	bool writeMetadata = false;
+	int numThreads = 1;
+	int queueDepth = 4;
+	int blockSize = BUFFERLEN;
+	bool autotune = false;
+	long long spillBudgetMB = 8192;
+	std::string spillDir = SpillFile::defaultDirectory();
+	int segments = 1; // time ranges transcoded concurrently
+	bool sdkMatrix = false; // always convert with Mach1Transcode::processConversion
+	PcmQuantizer::Dither dither = PcmQuantizer::DITHER_NONE; // 16 and 24 bit WAV output
+	AsyncFileIO::Backend ioBackend = AsyncFileIO::BACKEND_SYNC;
+	int ioDepth = 4; // queue buffers per file
+	int writeBufferMB = 0; // staged per output file, 0 = 1MB queue buffers or libsndfile
+	bool directIO = false;
+	int prefetchChunks = 4; // read ahead per input file with several inputs, 0 = off
+};
 
-	sf_count_t totalSamples;
-	long sampleRate;
+/*
+ configureTranscode(m1transcode, job)
+ Sets up the input and output formats of `job` on a transcoder, the
+ conversion path still has to be processed.
+ */
+void configureTranscode(Mach1Transcode<float>& m1transcode, const TranscodeJob& job) {
+	if (job.useAudioTimeline) m1transcode.setCustomPointsSamplerCallback(callbackPointsSampler);
+	m1transcode.setInputFormat(job.inFmt);
+	if (!job.inJsonStr.empty()) m1transcode.setInputFormatCustomPointsJson((char*)job.inJsonStr.c_str());
+	if (!job.outJsonStr.empty()) m1transcode.setOutputFormatCustomPointsJson((char*)job.outJsonStr.c_str());
+	m1transcode.setOutputFormat(job.outFmt);
+}
 
-	// multiplexed buffers
-	float fileBuffer[Mach1TranscodeMAXCHANS * BUFFERLEN];
+/*
+ targetJob(job, target)
+ `job` narrowed to one of its -out-fmt/-out-file targets.
+ */
+TranscodeJob targetJob(const TranscodeJob& job, size_t target) {
+	TranscodeJob narrowed = job;
+	if (target < job.outFmts.size()) {
+		narrowed.outFmtStr = job.outFmtStrs[target];
+		narrowed.outFmt = job.outFmts[target];
+		narrowed.outfilename = job.outfilenames[target];
+		narrowed.outFmtStrs.assign(1, narrowed.outFmtStr);
+		narrowed.outFmts.assign(1, narrowed.outFmt);
+		narrowed.outfilenames.assign(1, narrowed.outfilename);
+	}
+	return narrowed;
+}
 
-	// process buffers
-	float inBuffers[Mach1TranscodeMAXCHANS][BUFFERLEN];
-	float *inPtrs[Mach1TranscodeMAXCHANS];
-	float outBuffers[Mach1TranscodeMAXCHANS][BUFFERLEN];
-	float *outPtrs[Mach1TranscodeMAXCHANS];
-	for (int i = 0; i < Mach1TranscodeMAXCHANS; i++) {
-		inPtrs[i] = inBuffers[i];
-		outPtrs[i] = outBuffers[i];
+// mach1 format tag written to the output's comment string, empty for other formats
+std::string formatComment(Mach1Transcode<float>& m1transcode, int outFmt) {
+	if (outFmt == m1transcode.getFormatFromString("M1Spatial") || outFmt == m1transcode.getFormatFromString("M1Spatial-8")) {
+		return "mach1spatial-8";
 	}
+    else if (outFmt == m1transcode.getFormatFromString("M1Spatial-12")) {
+        return "mach1spatial-12";
+    }
+    else if (outFmt == m1transcode.getFormatFromString("M1Spatial-14")) {
+        return "mach1spatial-14";
+    }
+    else if (outFmt == m1transcode.getFormatFromString("M1Spatial-32")) {
+        return "mach1spatial-32";
+    }
+    else if (outFmt == m1transcode.getFormatFromString("M1Spatial-60")) {
+        return "mach1spatial-60";
+    }
+	else if (outFmt == m1transcode.getFormatFromString("M1Horizon") || outFmt == m1transcode.getFormatFromString("M1Spatial-4")) {
+		return "mach1horizon-4";
+	}
+	else if (outFmt == m1transcode.getFormatFromString("M1HorizonPairs")) {
+		return "mach1horizon-8";
+	}
+	return "";
+}
 
-	//=================================================================
-	// read command line parameters
-	//
+/*
+ TranscodeSession
+ State kept between the jobs of one process: transcoders whose conversion
+ path and matrix are already resolved, keyed by fan-out target and format
+ pair. Jobs sharing a format pair skip processConversionPath() and
+ getMatrixConversion(). The sample buffer arena and its memoryBudget
+ reservation only last for one job.
+ Timeline and spatial downmix jobs change their transcoder's formats while
+ they run, so they always get a fresh one, one per fan-out target.
+ */
+class TranscodeSession {
+public:
+	struct Conversion {
+		std::unique_ptr<Mach1Transcode<float>> transcode;
+		std::vector<std::vector<float>> matrix;
+		MatrixKernel kernel; // flat copy of `matrix` for the SIMD kernels
+		bool ready = false; // conversion path resolved
+		int tunedBlockSize = 0; // 0 until -autotune ran for this pair
+	};
+
+	// all per-job sample buffers are carved from one aligned arena
+	BufferArena arena;
+
+	// limits shared by the sessions of a parallel batch, null when unlimited
+	ResourceBudget* memoryBudget = nullptr;
+	ResourceBudget* fileBudget = nullptr;
 
+private:
+	std::map<std::string, std::unique_ptr<Conversion>> conversions;
+	std::vector<std::unique_ptr<Conversion>> scratch;
+	size_t memoryReserved = 0; // bytes of memoryBudget held by the arena
+
+	static void setup(Conversion& conversion, const TranscodeJob& job) {
+		conversion.transcode.reset(new Mach1Transcode<float>());
+		configureTranscode(*conversion.transcode, job);
+		conversion.matrix.clear();
+		conversion.ready = false;
+		conversion.tunedBlockSize = 0;
+	}
+
+public:
+	/*
+	 getConversion(job, target)
+	 Returns a transcoder set up for the job's formats. If `ready` is set the
+	 conversion path and matrix were resolved by an earlier job. `target`
+	 is part of the key, as it is for the fresh transcoders of timeline
+	 jobs: fan-out targets run concurrently, so two of them with the same
+	 formats must not share a transcoder.
+	 */
+	Conversion& getConversion(const TranscodeJob& job, size_t target = 0) {
+		if (job.useAudioTimeline || job.spatialDownmixerMode) {
+			if (scratch.size() <= target) scratch.resize(target + 1);
+			if (!scratch[target]) scratch[target].reset(new Conversion());
+			setup(*scratch[target], job);
+			return *scratch[target];
+		}
+		std::string key = std::to_string(target) + ":" + std::to_string(job.inFmt) + ">" + std::to_string(job.outFmt) + "\n" + job.inJsonStr + "\n" + job.outJsonStr;
+		std::unique_ptr<Conversion>& conversion = conversions[key];
+		if (!conversion) {
+			conversion.reset(new Conversion());
+			setup(*conversion, job);
+		}
+		return *conversion;
+	}
+
+	size_t getNumConversions() const {
+		return conversions.size();
+	}
+
+	/*
+	 reserveMemory(bytes)
+	 Makes sure the arena may grow to `bytes` under memoryBudget. To grow it
+	 everything is handed back first, so a waiting session never sits on
+	 memory the others are waiting for. Jobs take their files before their
+	 memory and JobScope hands the memory back when the job ends, so an idle
+	 session holds neither.
+	 */
+	void reserveMemory(size_t bytes) {
+		if (!memoryBudget || bytes <= memoryReserved) return;
+		memoryBudget->release(memoryReserved);
+		memoryReserved = 0;
+		arena.release();
+		memoryBudget->acquire(bytes);
+		memoryReserved = bytes;
+	}
+
+	// frees the arena and hands its reservation back to memoryBudget
+	void releaseMemory() {
+		if (memoryBudget) memoryBudget->release(memoryReserved);
+		memoryReserved = 0;
+		arena.release();
+	}
+
+	/*
+	 JobScope
+	 Calls releaseMemory() when a job returns, whichever way it does.
+	 */
+	class JobScope {
+		TranscodeSession& session;
+
+	public:
+		explicit JobScope(TranscodeSession& jobSession) : session(jobSession) {}
+		~JobScope() { session.releaseMemory(); }
+
+		JobScope(const JobScope&) = delete;
+		JobScope& operator=(const JobScope&) = delete;
+	};
+
+	~TranscodeSession() {
+		releaseMemory();
+	}
+};
+
+/*
+ parseJobOptions(argc, argv, m1transcode, job)
+ Reads the options of one conversion into `job`, `m1transcode` is only
+ used for format lookups. Returns 0 on success.
+ */
+int parseJobOptions(int argc, char* argv[], Mach1Transcode<float>& m1transcode, TranscodeJob& job) {
 	char *pStr;
-	if (cmdOptionExists(argv, argv + argc, "-h")
-		|| cmdOptionExists(argv, argv + argc, "-help")
-		|| cmdOptionExists(argv, argv + argc, "--help")
-		|| argc == 1)
+	pStr = getCmdOption(argv, argv + argc, "-normalize");
+	if (pStr != NULL)
 	{
-		printHelp();
-		return 0;
+		job.normalize = true;
 	}
-    if (cmdOptionExists(argv, argv + argc, "-f")
-        || cmdOptionExists(argv, argv + argc, "-formats")
-        || cmdOptionExists(argv, argv + argc, "-format-list")
-        || cmdOptionExists(argv, argv + argc, "--formats")
-        || argc == 1)
-    {
-        printFormats();
-        return 0;
-    }
-	pStr = getCmdOption(argv, argv + argc, "-normalize");
+	pStr = getCmdOption(argv, argv + argc, "-threads");
+	if (pStr != NULL)
+	{
+		job.numThreads = atoi(pStr);
+		if (job.numThreads < 1) {
+			std::cout << "Please use 1 or more threads" << std::endl;
+			return -1;
+		}
+	}
+	pStr = getCmdOption(argv, argv + argc, "-queue-depth");
+	if (pStr != NULL)
+	{
+		job.queueDepth = atoi(pStr);
+		if (job.queueDepth < 2) {
+			std::cout << "Please use a queue depth of 2 or more blocks" << std::endl;
+			return -1;
+		}
+	}
+	pStr = getCmdOption(argv, argv + argc, "-block-size");
+	if (pStr != NULL)
+	{
+		job.blockSize = atoi(pStr);
+		if (job.blockSize < MIN_BUFFERLEN || job.blockSize > MAX_BUFFERLEN) {
+			std::cout << "Please use a block size between " << MIN_BUFFERLEN << " and " << MAX_BUFFERLEN << " frames" << std::endl;
+			return -1;
+		}
+	}
+	if (cmdOptionExists(argv, argv + argc, "-autotune"))
+	{
+		job.autotune = true;
+	}
+	pStr = getCmdOption(argv, argv + argc, "-spill-budget");
 	if (pStr != NULL)
 	{
-		normalize = true;
+		job.spillBudgetMB = atoll(pStr);
+	}
+	pStr = getCmdOption(argv, argv + argc, "-spill-dir");
+	if (pStr && (strlen(pStr) > 0))
+	{
+		job.spillDir = pStr;
+	}
+	pStr = getCmdOption(argv, argv + argc, "-segments");
+	if (pStr != NULL)
+	{
+		job.segments = atoi(pStr);
+		if (job.segments < 1) {
+			std::cout << "Please use 1 or more segments" << std::endl;
+			return -1;
+		}
+	}
+	if (cmdOptionExists(argv, argv + argc, "-sdk-matrix"))
+	{
+		job.sdkMatrix = true;
+	}
+	pStr = getCmdOption(argv, argv + argc, "-dither");
+	if (pStr != NULL)
+	{
+		if (!PcmQuantizer::parseDither(pStr, job.dither)) {
+			std::cout << "Please use none, tpdf or shaped dither" << std::endl;
+			return -1;
+		}
+	}
+	pStr = getCmdOption(argv, argv + argc, "-io-backend");
+	if (pStr != NULL)
+	{
+		if (!AsyncFileIO::parseBackend(pStr, job.ioBackend)) {
+			std::cout << "Please use sync, uring or threads as I/O backend" << std::endl;
+			return -1;
+		}
+	}
+	pStr = getCmdOption(argv, argv + argc, "-io-depth");
+	if (pStr != NULL)
+	{
+		job.ioDepth = atoi(pStr);
+		if (job.ioDepth < 2) {
+			std::cout << "Please use an I/O depth of 2 or more requests" << std::endl;
+			return -1;
+		}
+	}
+	pStr = getCmdOption(argv, argv + argc, "-write-buffer");
+	if (pStr != NULL)
+	{
+		job.writeBufferMB = atoi(pStr);
+		if (job.writeBufferMB < 0 || job.writeBufferMB > 1024) {
+			std::cout << "Please use a write buffer between 0 and 1024 MB" << std::endl;
+			return -1;
+		}
+	}
+	if (cmdOptionExists(argv, argv + argc, "-direct-io"))
+	{
+		job.directIO = true;
+	}
+	pStr = getCmdOption(argv, argv + argc, "-prefetch");
+	if (pStr != NULL)
+	{
+		job.prefetchChunks = atoi(pStr);
+		if (job.prefetchChunks < 0 || job.prefetchChunks > 64) {
+			std::cout << "Please use between 0 and 64 prefetch chunks" << std::endl;
+			return -1;
+		}
 	}
 	pStr = getCmdOption(argv, argv + argc, "-master-gain");
 	if (pStr != NULL)
 	{
-		masterGain = (float)atof(pStr); // still in dB
-		masterGain = m1transcode.db2level(masterGain);
+		job.masterGain = (float)atof(pStr); // still in dB
+		job.masterGain = m1transcode.db2level(job.masterGain);
+	}
+	pStr = getCmdOption(argv, argv + argc, "-limit");
+	if (pStr != NULL)
+	{
+		job.limit = true;
+		job.limitCeiling = (float)atof(pStr);
 	}
 	pStr = getCmdOption(argv, argv + argc, "-lfe-sub");
 	/*
@@ -399,11 +843,10 @@ int main(int argc, char* argv[]) {
 	 */
 	if (pStr && (strlen(pStr) > 0))
 	{
-		processSubs = true;
 		char* lfeIndices = strtok(pStr, ",");
 		while (lfeIndices) {
 			//pushback int safe only
-			subChannelIndices.push_back(stoi(lfeIndices));
+			job.subChannelIndices.push_back(stoi(lfeIndices));
 			lfeIndices = strtok(NULL, ",");
 		}
 	}
@@ -411,13 +854,13 @@ int main(int argc, char* argv[]) {
 	pStr = getCmdOption(argv, argv + argc, "-extract-metadata");
 	if (pStr != NULL)
 	{
-		extractMetadata = true;
+		job.extractMetadata = true;
 	}
     // flag for writing ADM metadata to audiofile if supported
     pStr = getCmdOption(argv, argv + argc, "-write-metadata");
     if (pStr != NULL)
     {
-        writeMetadata = true;
+        job.writeMetadata = true;
     }
 	/*
 	 flag for auto Mach1 Spatial downmixer
@@ -427,10 +870,10 @@ int main(int argc, char* argv[]) {
 	pStr = getCmdOption(argv, argv + argc, "-spatial-downmix");
 	if (pStr != NULL)
 	{
-		spatialDownmixerMode = true;
-		corrThreshold = atof(pStr);
+		job.spatialDownmixerMode = true;
+		job.corrThreshold = atof(pStr);
 	}
-	if (spatialDownmixerMode && (corrThreshold < 0.0 || corrThreshold > 1.0))
+	if (job.spatialDownmixerMode && (job.corrThreshold < 0.0 || job.corrThreshold > 1.0))
 	{
 		std::cout << "Please use 0.0 to 1.0 range for correlation threshold" << std::endl;
 		return -1;
@@ -439,7 +882,11 @@ int main(int argc, char* argv[]) {
 	pStr = getCmdOption(argv, argv + argc, "-in-file");
 	if (pStr && (strlen(pStr) > 0))
 	{
-		infilename = pStr;
+		// the input may be several files separated by a space
+		char** itr = std::find(argv, argv + argc, pStr);
+		do {
+			job.inFiles.push_back(*itr);
+		} while (++itr != argv + argc && std::string(*itr).substr(0,1) != "-");
 	}
 	else
 	{
@@ -449,44 +896,40 @@ int main(int argc, char* argv[]) {
 	pStr = getCmdOption(argv, argv + argc, "-in-fmt");
 	if (pStr && (strlen(pStr) > 0))
     {
-		inFmtStr = pStr;
-        
-        if (strcmp(inFmtStr, "ADM") == 0) {
-            m1transcode.setInputFormat(m1transcode.getFormatFromString("CustomPoints"));
-            m1audioTimeline.parseADM(infilename);
-            useAudioTimeline = true;
-        } else if (strcmp(inFmtStr, "Atmos") == 0) {
+		job.inFmtStr = pStr;
+
+        if (job.inFmtStr == "ADM") {
+            job.inFmt = m1transcode.getFormatFromString("CustomPoints");
+            job.useAudioTimeline = true;
+        } else if (job.inFmtStr == "Atmos") {
             char* pStr = getCmdOption(argv, argv + argc, "-in-file-meta");
             if (pStr && (strlen(pStr) > 0)) {
-                m1transcode.setInputFormat(m1transcode.getFormatFromString("CustomPoints"));
-                m1audioTimeline.parseAtmos(infilename, pStr);
-                useAudioTimeline = true;
+                job.inFmt = m1transcode.getFormatFromString("CustomPoints");
+                job.inFileMeta = pStr;
+                job.useAudioTimeline = true;
             } else {
                 cerr << "Please specify an input meta file" << std::endl;
                 return -1;
             }
-        } else if (strcmp(inFmtStr, "CustomPoints") == 0) {
+        } else if (job.inFmtStr == "CustomPoints") {
+			job.inFmt = m1transcode.getFormatFromString("CustomPoints");
 			pStr = getCmdOption(argv, argv + argc, "-in-json");
 			if (pStr && (strlen(pStr) > 0))
             {
                 std::ifstream file(pStr);
                 std::string strJson((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-                m1transcode.setInputFormat(m1transcode.getFormatFromString("CustomPoints"));
-				m1transcode.setInputFormatCustomPointsJson((char*)strJson.c_str());
+				job.inJsonStr = strJson;
 			}
         } else {
-            bool foundInFmt = false;
             // rename string for new naming convention
-            if (strcmp(inFmtStr, "M1Horizon") == 0) {
-                inFmtStr = "M1Spatial-4";
+            if (job.inFmtStr == "M1Horizon") {
+                job.inFmtStr = "M1Spatial-4";
             }
-            if (strcmp(inFmtStr, "M1Spatial") == 0) {
-                inFmtStr = "M1Spatial-8";
+            if (job.inFmtStr == "M1Spatial") {
+                job.inFmtStr = "M1Spatial-8";
             }
-            inFmt = m1transcode.getFormatFromString(inFmtStr);
-            if (inFmt > 1) { // if format int is 0 or -1 (making it invalid)
-                foundInFmt = true;
-            } else {
+            job.inFmt = m1transcode.getFormatFromString(job.inFmtStr);
+            if (job.inFmt <= 1) { // if format int is 0 or -1 (making it invalid)
                 std::cout << "Please select a valid input format" << std::endl;
                 return -1;
             }
@@ -495,450 +938,1379 @@ int main(int argc, char* argv[]) {
 		std::cout << "Please select a valid input format" << std::endl;
 		return -1;
 	}
-    
+
     // input folder
-    if (useAudioTimeline) {
+    if (job.useAudioTimeline) {
         pStr = getCmdOption(argv, argv + argc, "-in-folder");
         if (pStr && (strlen(pStr) > 0)) {
-            infolder = pStr;
-        } else {
+            job.inFolder = pStr;
+        } else if (job.inFmtStr != "ADM") {
+            // ADM without a folder reads its objects from the tracks of a BW64 in-file
             cerr << "Please specify an input folder for audio files" << std::endl;
             return -1;
         }
     }
 
-	// output file name and format
+	// output file names and formats, lists of them fan out to several targets
 	pStr = getCmdOption(argv, argv + argc, "-out-file");
 	if (pStr && (strlen(pStr) > 0))
 	{
-		fileOut = true;
-		outfilename = pStr;
-		std::string FileExt = ".txt";
-		int outfilename_size = strlen(outfilename);
-		md_outfilename = convertToString(outfilename, outfilename_size);
-		std::string Path, FileName;
-		std::string::size_type found = md_outfilename.find_last_of(".");
-		// if we found one of this symbols
-		if (found != std::string::npos) {
-			// path will be all symbols before found position
-			Path = md_outfilename.substr(0, found);
-		}
-		else { // if we not found '.', path is empty
-			Path.clear();
-		}
-		md_outfilename += FileExt;
+		char** itr = std::find(argv, argv + argc, pStr);
+		do {
+			job.outfilenames.push_back(*itr);
+		} while (++itr != argv + argc && std::string(*itr).substr(0,1) != "-");
+		job.outfilename = job.outfilenames[0];
 	}
 	pStr = getCmdOption(argv, argv + argc, "-out-fmt");
 	if (pStr && (strlen(pStr) > 0))
 	{
-		outFmtStr = pStr;
-		if (strcmp(outFmtStr, "CustomPoints") == 0) {
+		char** itr = std::find(argv, argv + argc, pStr);
+		do {
+			job.outFmtStrs.push_back(*itr);
+		} while (++itr != argv + argc && std::string(*itr).substr(0,1) != "-");
+		job.outFmtStr = job.outFmtStrs[0];
+		if (std::find(job.outFmtStrs.begin(), job.outFmtStrs.end(), "CustomPoints") != job.outFmtStrs.end()) {
 			pStr = getCmdOption(argv, argv + argc, "-out-json");
 			if (pStr && (strlen(pStr) > 0))
 			{
                 std::ifstream file(pStr);
                 std::string strJson((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-				m1transcode.setOutputFormatCustomPointsJson((char*)strJson.c_str());
+				job.outJsonStr = strJson;
 			}
 		}
 	}
 
-	bool foundOutFmt = false;
-	outFmt = m1transcode.getFormatFromString(outFmtStr);
-    if (outFmt > 1) { // if format int is 0 or -1 (making it invalid)
-		foundOutFmt = true;
+	if (job.outFmtStrs.empty()) job.outFmtStrs.push_back(job.outFmtStr);
+	if (job.outfilenames.empty()) job.outfilenames.push_back(job.outfilename);
+	job.outFmts.clear();
+	for (size_t i = 0; i < job.outFmtStrs.size(); i++) {
+		int outFmt = m1transcode.getFormatFromString(job.outFmtStrs[i]);
+		if (outFmt <= 1) { // if format int is 0 or -1 (making it invalid)
+			std::cout << "Please select a valid output format" << std::endl;
+			return -1;
+		}
+		job.outFmts.push_back(outFmt);
 	}
-	else {
-		std::cout << "Please select a valid output format" << std::endl;
+	job.outFmt = job.outFmts[0];
+	if (job.outfilenames.size() != job.outFmts.size()) {
+		std::cout << "Please give one -out-file per -out-fmt" << std::endl;
 		return -1;
 	}
+	for (size_t i = 0; i < job.outfilenames.size(); i++) {
+		if (std::count(job.outfilenames.begin(), job.outfilenames.end(), job.outfilenames[i]) > 1) {
+			std::cout << "Please use a different -out-file for every -out-fmt" << std::endl;
+			return -1;
+		}
+	}
 
 	pStr = getCmdOption(argv, argv + argc, "-out-file-chans");
 	if (pStr != NULL)
-		outFileChans = atoi(pStr);
+		job.outFileChans = atoi(pStr);
 	else
-		outFileChans = 0;
-	if (!((outFileChans == 0) || (outFileChans == 1) || (outFileChans == 2)))
+		job.outFileChans = 0;
+	if (!((job.outFileChans == 0) || (job.outFileChans == 1) || (job.outFileChans == 2)))
 	{
 		std::cout << "Please select 0, 1, or 2, zero meaning a single, multichannel output file" << std::endl;
 		return -1;
 	}
-	// if "-extract-metadata arg detected, analyze and extract xml metadata
-	if (extractMetadata)
-	{
-		if (admParse.locateMetadata(infilename).mdStartIndex > 0)
-		{
-			admParse.exportMetadata(infilename, md_outfilename, admParse.locateMetadata(infilename).mdStartIndex, admParse.locateMetadata(infilename).mdEndIndex, admParse.locateMetadata(infilename).totalFileSize);
-		}
-	}
-	std::cout << std::endl;
+	return 0;
+}
 
-	//=================================================================
-	// initialize inputs, outputs and components
-	//
+/*
+ SegmentLayout
+ What a time segmented transcode needs to know about the job's files.
+ */
+struct SegmentLayout {
+	std::vector<std::string> inFiles;
+	int processInChannels;
+	int outChannels;
+	int outFileChannels;
+	int numOutFiles;
+	long sampleRate;
+	int bitDepth;
+	long long frames;
+	int blockSize;
+	std::string comment;
+	const MatrixKernel* kernel; // shared by all segments, null for processConversion
+};
 
-	// -- input file ---------------------------------------
-	// determine number of input files
-	SndfileHandle *infile[Mach1TranscodeMAXCHANS];
-	vector<string> fNames;
-    audiofileInfo inputInfo;
-    
-    if (useAudioTimeline) {
-        for (int i = 0; i < audioObjects.size(); i++) {
-            std::string filename = std::string(infolder) + "/" + audioObjects[i].getName() + ".wav";
-            fNames.push_back(filename);
-        }
-    } else {
-		// check and process the input file, which may be several files separated by a space
-		char** itr = std::find(argv, argv + argc, infilename);
-		do {
-			fNames.push_back(*itr);
-		} while (++itr != argv + argc && std::string(*itr).substr(0,1) != "-");
-	}
-    
-	size_t numInFiles = fNames.size();
-	for (int i = 0; i < numInFiles; i++) {
-		infile[i] = new SndfileHandle(fNames[i].c_str());
-		if (infile[i] && (infile[i]->error() == 0)) {
-			// print input file stats
-			std::cout << "Input File:         " << fNames[i] << std::endl;
-            inputInfo = printFileInfo(*infile[i], true);
-			sampleRate = (long)infile[i]->samplerate();
-			//            int inChannels = 0;
-			//            for (int i = 0; i < numInFiles; i++)
-			//                inChannels += infile[i]->channels();
-			//            parseFile(*infile[i], inChannels);
-		} else {
-			cerr << "Error: opening in-file: " << fNames[i] << std::endl;
-			return -1;
+#define SEGMENTS_UNAVAILABLE 1
+
+/*
+ transcodeSegments(job, layout, masterGain)
+ Splits the input into job.segments block aligned time ranges and
+ transcodes them concurrently, each on its own transcoder and input
+ handles, writing straight to its final offset in preallocated outputs.
+ The matrix conversion is stateless per sample, so the output is
+ bit-identical to the serial path; jobs with state carried across blocks
+ (`-lfe-sub` filters, the limiter) stay on the serial path.
+ Returns SEGMENTS_UNAVAILABLE when the outputs can't be written positionally.
+ */
+int transcodeSegments(const TranscodeJob& job, const SegmentLayout& layout, float masterGain) {
+	const int blockSize = layout.blockSize;
+	long long numBlocks = (layout.frames + blockSize - 1) / blockSize;
+	int numSegments = (int)(std::min)((long long)job.segments, (std::max)(numBlocks, 1LL));
+
+	std::vector<std::unique_ptr<PositionalWavWriter>> writers;
+	for (int i = 0; i < layout.numOutFiles; i++) {
+		char outfilestr[1024];
+		if (layout.numOutFiles > 1) {
+			sprintf(outfilestr, "%s_%0d.wav", job.outfilename.c_str(), i);
+		}
+		else {
+			strcpy(outfilestr, job.outfilename.c_str());
+		}
+		writers.emplace_back(new PositionalWavWriter());
+		if (!writers.back()->create(outfilestr, layout.outFileChannels, (int)layout.sampleRate, layout.bitDepth, layout.frames, layout.comment)) {
+			return SEGMENTS_UNAVAILABLE;
+		}
+		std::cout << "Output File:        " << outfilestr << std::endl;
+		std::cout << "Sample Rate:        " << layout.sampleRate << std::endl;
+		std::cout << "Bit Depth:          " << layout.bitDepth << std::endl;
+		std::cout << "Channels:           " << layout.outFileChannels << std::endl;
+		if (job.dither != PcmQuantizer::DITHER_NONE && layout.bitDepth != 32) {
+			std::cout << "Dither:             " << PcmQuantizer::ditherName(job.dither) << std::endl;
 		}
+		std::cout << std::endl;
 	}
+	printf("Segments:           %d x %lld blocks\r\n", numSegments, (numBlocks + numSegments - 1) / numSegments);
 
-	std::cout << "Master Gain:        " << m1transcode.level2db(masterGain) << "dB" << std::endl;
-    std::cout << std::endl;
-
-	for (int i = 0; i < numInFiles; i++) {
-		infile[i]->seek(0, 0); // rewind input
-	}
+	std::vector<float> peaks(numSegments, 0.0f);
 
-	// -- setup 
-	m1transcode.setInputFormat(inFmt);
-	m1transcode.setOutputFormat(outFmt);
-	m1transcode.setLFESub(subChannelIndices, sampleRate);
+	// transcodes one segment, either measuring its peak or writing it out
+	auto runSegment = [&](int segment, bool measure, float gain) {
+		long long firstBlock = numBlocks * segment / numSegments;
+		long long endBlock = numBlocks * (segment + 1) / numSegments;
 
-	// first init of custom points
-	if (useAudioTimeline) {
-		audioObjects = m1audioTimeline.getAudioObjects();
-		std::vector<Mach1Point3D> points;
-		for (int i = 0; i < audioObjects.size(); i++) {
-			Mach1KeyPoint keypoint = audioObjects[i].getKeyPoints()[0];
-			points.push_back(keypoint.point);
+		Mach1Transcode<float> m1transcode;
+		configureTranscode(m1transcode, job);
+		if (!m1transcode.processConversionPath()) {
+			throw std::runtime_error("can't find conversion between formats");
 		}
-		m1transcode.setInputFormatCustomPoints(points);
-	}
 
-	// -- output file(s) --------------------------------------
+		size_t numInFiles = layout.inFiles.size();
+		std::vector<std::unique_ptr<SndfileHandle>> infile(numInFiles);
+		std::vector<std::unique_ptr<MappedAudioReader>> mappedInfile(numInFiles);
+		int inChannels = 0;
+		for (size_t i = 0; i < numInFiles; i++) {
+			infile[i].reset(new SndfileHandle(layout.inFiles[i].c_str()));
+			if (infile[i]->error() != 0) {
+				throw std::runtime_error("opening in-file: " + layout.inFiles[i]);
+			}
+			mappedInfile[i].reset(new MappedAudioReader());
+			if (!mappedInfile[i]->open(layout.inFiles[i])
+				|| mappedInfile[i]->channels() != infile[i]->channels()
+				|| (sf_count_t)mappedInfile[i]->frames() != infile[i]->frames()) {
+				mappedInfile[i].reset();
+			}
+			infile[i]->seek(firstBlock * blockSize, SEEK_SET);
+			if (mappedInfile[i]) mappedInfile[i]->seek(firstBlock * blockSize);
+			inChannels += infile[i]->channels();
+		}
 
-	channels = m1transcode.getOutputNumChannels();
-	SndFileWriter outfiles[Mach1TranscodeMAXCHANS];
-	int actualOutFileChannels = outFileChans == 0 ? channels : outFileChans;
+		bool fused = layout.kernel && FusedOutputStage::worthIt(*layout.kernel, layout.outFileChannels);
+		BufferArena arena;
+		std::vector<float*> inPtrs, outPtrs;
+		arena.reset(BufferArena::padded((size_t)inChannels * blockSize) + BufferArena::planesSize(layout.processInChannels, blockSize)
+			+ BufferArena::planesSize(layout.outChannels, blockSize) + BufferArena::padded((size_t)layout.outChannels * blockSize)
+			+ (fused ? FusedOutputStage::arenaSize(layout.outChannels) : 0));
+		float* fileBuffer = arena.allocate((size_t)inChannels * blockSize);
+		arena.allocatePlanes(inPtrs, layout.processInChannels, blockSize);
+		arena.allocatePlanes(outPtrs, layout.outChannels, blockSize);
+		float* interleaved = arena.allocate((size_t)layout.outChannels * blockSize);
+		std::vector<unsigned char> scratch;
+		// one dither sequence per file and segment, so segments don't repeat each other's noise
+		std::vector<PcmQuantizer> quantizers(layout.numOutFiles);
+		for (int file = 0; file < layout.numOutFiles; file++) {
+			quantizers[file].setup(layout.outFileChannels, layout.bitDepth, job.dither);
+			quantizers[file].seed((uint32_t)(segment * layout.numOutFiles + file));
+		}
+		FusedOutputStage fusedStage;
+		if (fused) {
+			fusedStage.setup(arena, *layout.kernel, layout.outFileChannels, layout.numOutFiles);
+		}
 
-	if (actualOutFileChannels == 0) {
-		std::cout << "Output channels count is 0!" << std::endl;
+		for (long long b = firstBlock; b < endBlock; b++) {
+			int frames = (int)(std::min)((long long)blockSize, layout.frames - b * blockSize);
+			int firstBuf = 0;
+			for (size_t file = 0; file < numInFiles; file++) {
+				int numChannels = infile[file]->channels();
+				int framesRead;
+				if (mappedInfile[file]) {
+					framesRead = mappedInfile[file]->readPlanar(inPtrs.data() + firstBuf, 0, frames);
+				} else {
+					framesRead = (int)(infile[file]->read(fileBuffer, (sf_count_t)numChannels * frames) / numChannels);
+					InterleaveKernels::deinterleave(fileBuffer, numChannels, inPtrs.data() + firstBuf, 0, framesRead);
+				}
+				// a short read would leave the previous block's samples behind
+				if (framesRead < frames) {
+					framesRead = (std::max)(framesRead, 0);
+					for (int k = 0; k < numChannels; k++) {
+						memset(inPtrs[firstBuf + k] + framesRead, 0, (size_t)(frames - framesRead) * sizeof(float));
+					}
+				}
+				firstBuf += numChannels;
+			}
+
+			if (fused) {
+				float blockPeak = fusedStage.process(inPtrs.data(), frames, measure ? 1.0f : gain, measure ? nullptr : interleaved);
+				if (measure) {
+					peaks[segment] = (std::max)(peaks[segment], blockPeak);
+					continue;
+				}
+				for (int file = 0; file < layout.numOutFiles; file++) {
+					if (!writers[file]->writeFrames(b * blockSize, interleaved + (size_t)file * layout.outFileChannels * frames, frames, quantizers[file], scratch)) {
+						throw std::runtime_error("writing out-file");
+					}
+				}
+				continue;
+			}
+
+			if (layout.kernel) {
+				layout.kernel->process(inPtrs.data(), outPtrs.data(), frames);
+			} else {
+				m1transcode.processConversion(inPtrs.data(), outPtrs.data(), frames);
+			}
+
+			if (measure) {
+				peaks[segment] = (std::max)(peaks[segment], m1transcode.processNormalization(outPtrs.data(), frames));
+				continue;
+			}
+			m1transcode.processMasterGain(outPtrs.data(), frames, gain);
+			for (int file = 0; file < layout.numOutFiles; file++) {
+				InterleaveKernels::interleave(outPtrs.data() + (file*layout.outFileChannels), layout.outFileChannels, interleaved, frames);
+				if (!writers[file]->writeFrames(b * blockSize, interleaved, frames, quantizers[file], scratch)) {
+					throw std::runtime_error("writing out-file");
+				}
+			}
+		}
+	};
+
+	try {
+		WorkStealingPool pool(numSegments);
+		if (job.normalize) {
+			for (int segment = 0; segment < numSegments; segment++) {
+				pool.submit([&, segment](int) { runSegment(segment, true, 1.0f); });
+			}
+			pool.wait();
+			float peak = *std::max_element(peaks.begin(), peaks.end());
+			Mach1Transcode<float> m1transcode;
+			std::cout << "Reducing gain by    " << m1transcode.level2db(peak) << "dB" << std::endl;
+			std::cout << std::endl;
+			masterGain /= peak;
+		}
+		for (int segment = 0; segment < numSegments; segment++) {
+			pool.submit([&, segment](int) { runSegment(segment, false, masterGain); });
+		}
+		pool.wait();
+	} catch (const std::exception& e) {
+		cerr << "Error: " << e.what() << std::endl;
 		return -1;
 	}
 
-	int numOutFiles = channels / actualOutFileChannels;
+	// print time played
+	std::cout << "Length (sec):       " << (float)layout.frames / (float)layout.sampleRate << std::endl;
+	return 0;
+}
+
+/*
+ OutputTarget
+ One output format of a job: its transcoder, writers and the state that
+ changes while the job runs. Fan-out jobs have one per -out-fmt, all fed
+ from the same input blocks, each converting into its own range of the
+ block's output planes.
+ */
+struct OutputTarget {
+	TranscodeJob job; // narrowed to this target's format and file
+	TranscodeSession::Conversion* conversion = nullptr;
+	int outFmt = 0;
+	int channels = 0;
+	int actualOutFileChannels = 0;
+	int numOutFiles = 0;
+	int firstPlane = 0; // first of the block's output planes
+	float masterGain = 1.0f;
+	float peak = 0.0f;
+	const MatrixKernel* matrixKernel = nullptr; // null converts with processConversion
+	std::unique_ptr<TimelineMatrix> timelineMatrix; // moving timeline objects, instead of processConversion
+	std::unique_ptr<Mach1Transcode<float>> pointsTranscode; // computes the timeline matrices
+	FusedOutputStage fusedStage;
+	bool fusedOutput = false; // matrixKernel output goes through fusedStage
+	TruePeakLimiter limiter;
+	SndFileWriter outfiles[Mach1TranscodeMAXCHANS];
+
+	Mach1Transcode<float>& transcode() { return *conversion->transcode; }
+};
 
-	for (int i = 0; i < Mach1TranscodeMAXCHANS; i++) {
-		memset(inBuffers[i], 0, sizeof(inBuffers[i]));
-		memset(outBuffers[i], 0, sizeof(outBuffers[i]));
+/*
+ runTranscodeJob(job, session)
+ Runs one conversion from start to finish, or one per target when several
+ output formats share the input. Returns 0 on success.
+ */
+int runTranscodeJob(const TranscodeJob& job, TranscodeSession& session) {
+	// declared first so the buffers are handed back after everything using them is gone
+	TranscodeSession::JobScope jobScope(session);
+    Mach1AudioTimeline m1audioTimeline;
+	ADMParse admParse; // Reading ADM data
+
+	// locals that change while the job runs
+	int outFileChans = job.outFileChans;
+	int blockSize = job.blockSize;
+	int channels; // output planes of all targets
+	std::string md_outfilename = job.outfilename;
+
+	sf_count_t totalSamples;
+	long sampleRate;
+
+	BufferArena& arena = session.arena;
+	// multiplexed read buffer, owned by the reader stage
+	float* fileBuffer = nullptr;
+
+	// process buffers live in the pipeline blocks
+	TranscodePipeline pipeline;
+
+	if (!job.outfilename.empty())
+	{
+		std::string FileExt = ".txt";
+		std::string Path, FileName;
+		std::string::size_type found = md_outfilename.find_last_of(".");
+		// if we found one of this symbols
+		if (found != std::string::npos) {
+			// path will be all symbols before found position
+			Path = md_outfilename.substr(0, found);
+		}
+		else { // if we not found '.', path is empty
+			Path.clear();
+		}
+		md_outfilename += FileExt;
+	}
+	// if "-extract-metadata arg detected, analyze and extract xml metadata
+	if (job.extractMetadata)
+	{
+		char* infilename = (char*)job.inFiles[0].c_str();
+		// one walk over the chunk headers, only the metadata chunk itself is read
+		ADMParse::metadataLocators locators = admParse.locateMetadata(infilename);
+		if (locators.mdStartIndex > 0)
+		{
+			admParse.exportMetadata(infilename, md_outfilename, locators.mdStartIndex, locators.mdEndIndex, locators.totalFileSize);
+		}
+	}
+
+	// ADM without -in-folder: every object is a track of the BW64 in-file,
+	// found through its chna and axml chunks
+	bool nativeAdm = job.inFmtStr == "ADM" && job.inFolder.empty();
+	std::unique_ptr<bw64::Bw64Reader> bw64Infile;
+	AdmTrackMap admTracks;
+	std::vector<int> objectTracks;
+	if (nativeAdm) {
+		try {
+			bw64Infile = bw64::readFile(job.inFiles[0]);
+		} catch (std::exception& e) {
+			cerr << "Error: opening in-file: " << job.inFiles[0] << " (" << e.what() << ")" << std::endl;
+			return -1;
+		}
+		std::shared_ptr<bw64::ChnaChunk> chna = bw64Infile->chnaChunk();
+		std::shared_ptr<bw64::AxmlChunk> axml = bw64Infile->axmlChunk();
+		if (!chna || !axml || !admTracks.build(*chna, axml->data())) {
+			cerr << "Error: in-file has no ADM objects in chna/axml, use -in-folder for per object WAV files: " << job.inFiles[0] << std::endl;
+			return -1;
+		}
+	}
+
+	// timeline formats describe their objects in the input's metadata
+	if (nativeAdm) {
+		// the timeline parser reads the ADM from a file of its own
+		std::string axmlPath = writeTempFile(bw64Infile->axmlChunk()->data(), ".xml");
+		if (axmlPath.empty()) {
+			cerr << "Error: writing the axml chunk to " << SpillFile::defaultDirectory() << std::endl;
+			return -1;
+		}
+		m1audioTimeline.parseADM((char*)axmlPath.c_str());
+		remove(axmlPath.c_str());
+	} else if (job.inFmtStr == "ADM") {
+		m1audioTimeline.parseADM((char*)job.inFiles[0].c_str());
+	} else if (job.inFmtStr == "Atmos") {
+		m1audioTimeline.parseAtmos((char*)job.inFiles[0].c_str(), (char*)job.inFileMeta.c_str());
+	}
+	// callbackPointsSampler reads the global audioObjects, so timeline jobs run one at a time
+	std::unique_lock<std::mutex> timelineLock(audioObjectsMutex, std::defer_lock);
+	if (job.useAudioTimeline) {
+		timelineLock.lock();
+		audioObjects = m1audioTimeline.getAudioObjects();
+		keypointTimeline.build(audioObjects);
 	}
 
 	//=================================================================
-	//  print intermediate formats path
+	// initialize inputs, outputs and components
 	//
-	if (!m1transcode.processConversionPath()) {
-		printf("Can't find conversion between formats!");
+
+	// held until every file of the job is closed
+	std::unique_ptr<ResourceBudget::Reservation> openFiles;
+
+	// -io-backend queues, these outlive the readers and writers using them
+	AsyncFileIO readIO;
+	AsyncFileIO writeIO;
+
+	// -- input file ---------------------------------------
+	// determine number of input files
+	std::vector<std::unique_ptr<SndfileHandle>> infile;
+	// zero-copy readers for plain WAV/RF64/BW64 inputs, null when libsndfile is used
+	std::vector<std::unique_ptr<MappedAudioReader>> mappedInfile;
+	// stdin and FIFO inputs, these have no libsndfile handle
+	std::vector<std::unique_ptr<StreamAudioReader>> streamInfile;
+	// read-ahead on readIO, taking over from the mapped readers
+	std::vector<std::unique_ptr<AsyncAudioReader>> asyncInfile;
+	// reads ahead on all of the readers above at once with several inputs,
+	// declared after them so its workers stop first
+	std::vector<std::vector<float>> prefetchScratch;
+	InputPrefetcher prefetcher;
+	bool usePrefetch = false;
+	vector<string> fNames;
+    audiofileInfo inputInfo;
+
+    if (nativeAdm) {
+        fNames = job.inFiles;
+        fNames.resize(1);
+        // objects of the same name are matched in document order
+        std::map<std::string, int> occurrences;
+        for (int i = 0; i < audioObjects.size(); i++) {
+            std::string name = audioObjects[i].getName();
+            const AdmTrackMap::Object* object = admTracks.find(name, occurrences[name]++);
+            if (!object || object->tracks.empty() || object->tracks[0] < 0 || object->tracks[0] >= bw64Infile->channels()) {
+                cerr << "Error: no track of " << job.inFiles[0] << " carries ADM object " << name << std::endl;
+                return -1;
+            }
+            // the timeline places an object at one point, its other channels would be lost
+            if (object->tracks.size() > 1) {
+                cerr << "Error: ADM object " << name << " (" << object->id << ") has " << object->tracks.size() << " tracks, multi-track objects need -in-folder" << std::endl;
+                return -1;
+            }
+            int track = object->tracks[0];
+            if (std::find(objectTracks.begin(), objectTracks.end(), track) != objectTracks.end()) {
+                cerr << "Error: ADM objects sharing track " << track + 1 << " of " << job.inFiles[0] << " need -in-folder" << std::endl;
+                return -1;
+            }
+            objectTracks.push_back(track);
+        }
+    } else if (job.useAudioTimeline) {
+        for (int i = 0; i < audioObjects.size(); i++) {
+            std::string filename = job.inFolder + "/" + audioObjects[i].getName() + ".wav";
+            fNames.push_back(filename);
+        }
+    } else {
+		fNames = job.inFiles;
+	}
+
+	size_t numInFiles = fNames.size();
+	if (numInFiles == 0 || numInFiles > (job.useAudioTimeline ? MAX_TIMELINE_OBJECTS : Mach1TranscodeMAXCHANS)) {
+		cerr << "Error: unsupported number of input files: " << numInFiles << std::endl;
 		return -1;
-	} else {
-        std::vector<int> formatsConvertionPath = m1transcode.getFormatConversionPath();
-		printf("Conversion Path:    ");
-		for (int k = 0; k < formatsConvertionPath.size(); k++) {
-            printf("%s", m1transcode.getFormatName(formatsConvertionPath[k]).c_str());
-			if (k < formatsConvertionPath.size() - 1) {
-				printf(" > ");
+	}
+	// timeline objects are files, or tracks of one BW64
+	int numObjects = job.useAudioTimeline ? keypointTimeline.getNumObjects() : 0;
+	if (numObjects > MAX_TIMELINE_OBJECTS) {
+		cerr << "Error: unsupported number of objects: " << numObjects << std::endl;
+		return -1;
+	}
+	infile.resize(numInFiles);
+	mappedInfile.resize(numInFiles);
+	streamInfile.resize(numInFiles);
+	asyncInfile.resize(numInFiles);
+
+	// -- setup
+	// one transcoder and set of output files per target
+	std::vector<std::unique_ptr<OutputTarget>> targets;
+	size_t numTargets = (std::max)(job.outFmts.size(), (size_t)1);
+	channels = 0;
+	int numOutFiles = 0; // of all targets
+	for (size_t t = 0; t < numTargets; t++) {
+		std::unique_ptr<OutputTarget> target(new OutputTarget());
+		target->job = targetJob(job, t);
+		target->conversion = &session.getConversion(target->job, t);
+		target->outFmt = target->job.outFmt;
+		target->masterGain = job.masterGain;
+		target->channels = target->transcode().getOutputNumChannels();
+		target->actualOutFileChannels = outFileChans == 0 ? target->channels : outFileChans;
+		if (target->actualOutFileChannels == 0) {
+			std::cout << "Output channels count is 0!" << std::endl;
+			return -1;
+		}
+		target->numOutFiles = target->channels / target->actualOutFileChannels;
+		target->firstPlane = channels;
+		channels += target->channels;
+		numOutFiles += target->numOutFiles;
+		targets.push_back(std::move(target));
+	}
+	// format lookups and the input side only need one of the transcoders
+	Mach1Transcode<float>& m1transcode = targets[0]->transcode();
+
+	// libsndfile and mapped handle per input, the outputs and a spill file
+	// every segment opens its own input handles
+	size_t jobFiles = numInFiles * 2 * (job.segments > 1 ? job.segments + 1 : 1) + numOutFiles + 1;
+	openFiles.reset(new ResourceBudget::Reservation(session.fileBudget, jobFiles));
+
+	// channels of each input and the subformat of the first, for any backend
+	std::vector<int> inFileChannels(numInFiles);
+	std::vector<sf_count_t> inFileFrames(numInFiles);
+	int inputFormat = 0;
+	bool streamInput = false;
+
+	for (int i = 0; i < numInFiles; i++) {
+		if (StreamAudioReader::isStream(fNames[i])) {
+			streamInfile[i].reset(new StreamAudioReader());
+			if (!streamInfile[i]->open(fNames[i])) {
+				cerr << "Error: opening in-file: " << fNames[i] << " (streams have to be PCM or float WAV/RF64)" << std::endl;
+				return -1;
+			}
+			streamInput = true;
+			inFileChannels[i] = streamInfile[i]->channels();
+			sampleRate = streamInfile[i]->samplerate();
+			inputInfo.sampleRate = (int)sampleRate;
+			inputInfo.numberOfChannels = inFileChannels[i];
+			inputInfo.format = SF_FORMAT_FLOAT;
+			if (streamInfile[i]->getSampleType() == MappedAudioReader::SAMPLE_PCM_16) inputInfo.format = SF_FORMAT_PCM_16;
+			if (streamInfile[i]->getSampleType() == MappedAudioReader::SAMPLE_PCM_24) inputInfo.format = SF_FORMAT_PCM_24;
+			if (streamInfile[i]->getSampleType() == MappedAudioReader::SAMPLE_PCM_32) inputInfo.format = SF_FORMAT_PCM_32;
+			inputInfo.duration = (float)streamInfile[i]->frames() / (float)sampleRate;
+			std::cout << "Input File:         " << fNames[i] << std::endl;
+			std::cout << "Sample Rate:        " << sampleRate << std::endl;
+			std::cout << "Channels:           " << inFileChannels[i] << std::endl;
+			std::cout << "Streaming:          " << (streamInfile[i]->hasLength() ? "" : "open ended, ") << "single pass" << std::endl;
+			std::cout << std::endl;
+			if (i == 0) inputFormat = inputInfo.format;
+			continue;
+		}
+
+		if (bw64Infile) {
+			// libsndfile doesn't know the BW64 header, the mapped reader and libbw64 do
+			inFileChannels[i] = bw64Infile->channels();
+			inFileFrames[i] = (sf_count_t)bw64Infile->numberOfFrames();
+			sampleRate = (long)bw64Infile->sampleRate();
+			inputInfo.sampleRate = (int)sampleRate;
+			inputInfo.numberOfChannels = inFileChannels[i];
+			inputInfo.format = SF_FORMAT_FLOAT;
+			if (bw64Infile->formatTag() != 3 && bw64Infile->bitDepth() == 16) inputInfo.format = SF_FORMAT_PCM_16;
+			if (bw64Infile->formatTag() != 3 && bw64Infile->bitDepth() == 24) inputInfo.format = SF_FORMAT_PCM_24;
+			if (bw64Infile->formatTag() != 3 && bw64Infile->bitDepth() == 32) inputInfo.format = SF_FORMAT_PCM_32;
+			inputInfo.duration = (float)inFileFrames[i] / (float)sampleRate;
+			inputFormat = inputInfo.format;
+			std::cout << "Input File:         " << fNames[i] << std::endl;
+			std::cout << "Sample Rate:        " << sampleRate << std::endl;
+			std::cout << "Bit Depth:          " << bw64Infile->bitDepth() << std::endl;
+			std::cout << "Channels:           " << inFileChannels[i] << std::endl;
+			std::cout << "Length (sec):       " << inputInfo.duration << std::endl;
+			std::cout << "ADM Objects:        " << numObjects << " on " << admTracks.getNumObjects() << " audioObjects of chna/axml" << std::endl;
+			std::cout << std::endl;
+
+			mappedInfile[i].reset(new MappedAudioReader());
+			if (!mappedInfile[i]->open(fNames[i])
+				|| mappedInfile[i]->channels() != inFileChannels[i]
+				|| (sf_count_t)mappedInfile[i]->frames() != inFileFrames[i]) {
+				mappedInfile[i].reset(); // read through libbw64
+			}
+			continue;
+		}
+
+		infile[i].reset(new SndfileHandle(fNames[i].c_str()));
+		if (infile[i] && (infile[i]->error() == 0)) {
+			// print input file stats
+			std::cout << "Input File:         " << fNames[i] << std::endl;
+            inputInfo = printFileInfo(*infile[i], true);
+			sampleRate = (long)infile[i]->samplerate();
+			inFileChannels[i] = infile[i]->channels();
+			inFileFrames[i] = infile[i]->frames();
+			if (i == 0) inputFormat = infile[i]->format() & 0xffff;
+
+			mappedInfile[i].reset(new MappedAudioReader());
+			if (!mappedInfile[i]->open(fNames[i])
+				|| mappedInfile[i]->channels() != infile[i]->channels()
+				|| (sf_count_t)mappedInfile[i]->frames() != infile[i]->frames()) {
+				mappedInfile[i].reset(); // fall back to libsndfile
+			}
+			//            int inChannels = 0;
+			//            for (int i = 0; i < numInFiles; i++)
+			//                inChannels += infile[i]->channels();
+			//            parseFile(*infile[i], inChannels);
+		} else {
+			cerr << "Error: opening in-file: " << fNames[i] << std::endl;
+			return -1;
+		}
+	}
+
+	std::cout << "Master Gain:        " << m1transcode.level2db(job.masterGain) << "dB" << std::endl;
+    std::cout << std::endl;
+
+	// a stream is read once, so nothing may need a second pass over it
+	if (streamInput) {
+		const char* reason = nullptr;
+		if (job.useAudioTimeline) reason = "timeline inputs are located by their metadata";
+		else if (job.extractMetadata) reason = "-extract-metadata";
+		else if (job.normalize) reason = "-normalize";
+		else if (job.spatialDownmixerMode) reason = "-spatial-downmix";
+		if (reason) {
+			cerr << "Error: " << reason << " needs seekable input files, streams are transcoded in a single pass" << std::endl;
+			return -1;
+		}
+	}
+
+	// queued read-ahead for every input the mapped reader understood
+	int numAsyncInFiles = 0;
+	for (int i = 0; i < numInFiles; i++) {
+		if (mappedInfile[i]) numAsyncInFiles++;
+	}
+	if (job.ioBackend != AsyncFileIO::BACKEND_SYNC && numAsyncInFiles > 0 && readIO.setup(job.ioBackend, numAsyncInFiles * job.ioDepth)) {
+		for (int i = 0; i < numInFiles; i++) {
+			if (!mappedInfile[i]) continue;
+			asyncInfile[i].reset(new AsyncAudioReader());
+			if (asyncInfile[i]->open(fNames[i], *mappedInfile[i], readIO, job.ioDepth)) {
+				mappedInfile[i].reset();
+			} else {
+				asyncInfile[i].reset();
 			}
 		}
-		printf("\r\n");
+		printf("Input I/O:          %s, %d x %dKB per file%s\r\n", AsyncFileIO::backendName(readIO.getBackend()), job.ioDepth, (int)(readIO.getBufferBytes() / 1024),
+			readIO.hasRegisteredBuffers() ? ", registered buffers" : "");
 	}
 
-	vector<vector<float>> matrix = m1transcode.getMatrixConversion();
+	for (int i = 0; i < numInFiles; i++) {
+		if (infile[i]) infile[i]->seek(0, 0); // rewind input
+		if (bw64Infile) bw64Infile->seek(0);
+		if (mappedInfile[i]) mappedInfile[i]->seek(0);
+		if (asyncInfile[i]) asyncInfile[i]->seek(0);
+	}
+
+	for (size_t t = 0; t < targets.size(); t++) {
+		OutputTarget& target = *targets[t];
+		TranscodeSession::Conversion& conversion = *target.conversion;
+		Mach1Transcode<float>& m1transcode = target.transcode();
+		if (targets.size() > 1) {
+			printf("Target %d:           %s > %s\r\n", (int)t + 1, target.job.outFmtStr.c_str(), target.job.outfilename.c_str());
+		}
+
+		m1transcode.setLFESub(job.subChannelIndices, sampleRate);
+
+		// first init of custom points
+		if (job.useAudioTimeline) {
+			std::vector<Mach1Point3D> points;
+			for (int i = 0; i < keypointTimeline.getNumObjects(); i++) {
+				points.push_back(keypointTimeline.getFirstPoint(i));
+			}
+			m1transcode.setInputFormatCustomPoints(points);
+		}
+
+		//=================================================================
+		//  print intermediate formats path
+		//
+		bool reused = conversion.ready;
+		if (!reused) {
+			if (!m1transcode.processConversionPath()) {
+				printf("Can't find conversion between formats!");
+				return -1;
+			}
+			conversion.matrix = m1transcode.getMatrixConversion();
+			conversion.kernel.setMatrix(conversion.matrix, m1transcode.getInputNumChannels(), m1transcode.getOutputNumChannels(), MatrixKernel::LAYOUT_OUT_IN);
+			const FixedMatrixKernels::Entry* fixedKernel = FixedMatrixKernels::find(m1transcode, job.inFmt, target.outFmt);
+			if (fixedKernel) {
+				FixedMatrixKernels::apply(conversion.kernel, *fixedKernel);
+			}
+			conversion.ready = true;
+		}
+		{
+			std::vector<int> formatsConvertionPath = m1transcode.getFormatConversionPath();
+			printf("Conversion Path:    ");
+			for (int k = 0; k < formatsConvertionPath.size(); k++) {
+				printf("%s", m1transcode.getFormatName(formatsConvertionPath[k]).c_str());
+				if (k < formatsConvertionPath.size() - 1) {
+					printf(" > ");
+				}
+			}
+			printf("%s\r\n", reused ? " (reused)" : "");
+		}
+
+		// fixed matrix conversions run on the SIMD matrix kernel, everything
+		// processConversion() does beyond the matrix keeps it on the SDK path
+		const char* sdkReason = nullptr;
+		if (job.sdkMatrix) sdkReason = "-sdk-matrix";
+		else if (!job.subChannelIndices.empty()) sdkReason = "lfe-sub filters";
+		else if (job.spatialDownmixerMode) sdkReason = "spatial downmix analysis";
+		else if (job.useAudioTimeline) {
+			// the points change over time, matrices are computed at the keypoints and ramped in between
+			target.pointsTranscode.reset(new Mach1Transcode<float>());
+			Mach1Transcode<float>* pointsTranscode = target.pointsTranscode.get();
+			pointsTranscode->setInputFormat(job.inFmt);
+			if (!target.job.outJsonStr.empty()) pointsTranscode->setOutputFormatCustomPointsJson((char*)target.job.outJsonStr.c_str());
+			pointsTranscode->setOutputFormat(target.outFmt);
+			target.timelineMatrix.reset(new TimelineMatrix());
+			bool ready = target.timelineMatrix->setup(keypointTimeline, m1transcode.getInputNumChannels(), m1transcode.getOutputNumChannels(),
+				[pointsTranscode](const std::vector<Mach1Point3D>& points, std::vector<std::vector<float>>& matrix) -> bool {
+					pointsTranscode->setInputFormatCustomPoints(points);
+					if (!pointsTranscode->processConversionPath()) return false;
+					matrix = pointsTranscode->getMatrixConversion();
+					return true;
+				});
+			if (!ready) {
+				target.timelineMatrix.reset();
+				target.pointsTranscode.reset();
+				sdkReason = "time varying custom points";
+			}
+		}
+		else if (!conversion.kernel.isReady()) sdkReason = "unexpected matrix shape";
+		target.matrixKernel = sdkReason || target.timelineMatrix ? nullptr : &conversion.kernel;
+		if (target.timelineMatrix) {
+			printf("Matrix Kernel:      %s timeline ramp (%d keypoint boundaries)\r\n", CpuFeatures::levelName(CpuFeatures::get().getLevel()), target.timelineMatrix->getNumBoundaries());
+		} else if (target.matrixKernel) {
+			printf("Matrix Kernel:      %s %s (%d of %d coefficients)\r\n", CpuFeatures::levelName(target.matrixKernel->getLevel()), MatrixKernel::strategyName(target.matrixKernel->getStrategy()),
+				target.matrixKernel->getNumNonZeros(), target.matrixKernel->getInputChannels() * target.matrixKernel->getOutputChannels());
+		} else {
+			printf("Matrix Kernel:      processConversion (%s)\r\n", sdkReason);
+		}
+	}
 
 	//=================================================================
 	//  main sound loop
-	// 
+	//
 
 	int inChannels = 0;
 	for (int i = 0; i < numInFiles; i++)
-		inChannels += infile[i]->channels();
-	sf_count_t numBlocks = infile[0]->frames() / BUFFERLEN; // files must be the same length
+		inChannels += inFileChannels[i];
+	int processInChannels = (std::max)(inChannels, m1transcode.getInputNumChannels());
+
+	// pick the processing block size, fan-out jobs tune on their first target
+	OutputTarget& first = *targets[0];
+	if (job.autotune && first.conversion->tunedBlockSize > 0) {
+		blockSize = first.conversion->tunedBlockSize;
+	} else if (job.autotune) {
+		// time on a separate transcoder so the real one keeps pristine filter state
+		Mach1Transcode<float> tuneTranscode;
+		tuneTranscode.setInputFormat(job.inFmt);
+		if (!job.inJsonStr.empty()) tuneTranscode.setInputFormatCustomPointsJson((char*)job.inJsonStr.c_str());
+		if (job.useAudioTimeline) {
+			std::vector<Mach1Point3D> points;
+			for (int i = 0; i < keypointTimeline.getNumObjects(); i++) {
+				points.push_back(keypointTimeline.getFirstPoint(i));
+			}
+			tuneTranscode.setInputFormatCustomPoints(points);
+		}
+		tuneTranscode.setOutputFormat(first.outFmt);
+		if (!job.outJsonStr.empty()) tuneTranscode.setOutputFormatCustomPointsJson((char*)job.outJsonStr.c_str());
+		tuneTranscode.setLFESub(job.subChannelIndices, sampleRate);
+
+		if (tuneTranscode.processConversionPath()) {
+			BlockSizeTuner tuner;
+			blockSize = tuner.tune(processInChannels, first.channels, [&](float** in, float** out, float* interleaved, int frames) {
+				if (first.matrixKernel) {
+					first.matrixKernel->process(in, out, frames);
+				} else {
+					tuneTranscode.processConversion(in, out, frames);
+				}
+				tuneTranscode.processMasterGain(out, frames, job.masterGain);
+				for (int file = 0; file < first.numOutFiles; file++) {
+					InterleaveKernels::interleave(out + (file*first.actualOutFileChannels), first.actualOutFileChannels, interleaved + (file*first.actualOutFileChannels*frames), frames);
+				}
+			});
+			first.conversion->tunedBlockSize = blockSize;
+			printf("Autotune:           ");
+			for (size_t i = 0; i < tuner.getResults().size(); i++) {
+				printf("%d: %.2fns/frame%s", tuner.getResults()[i].blockSize, tuner.getResults()[i].nsPerFrame, i + 1 < tuner.getResults().size() ? ", " : "");
+			}
+			printf("\r\n");
+		}
+	}
+	printf("Block Size:         %d%s\r\n", blockSize, job.autotune ? " (autotuned)" : "");
+
+	// -- time segmented transcoding -----------------------
+	if (job.segments > 1) {
+		const char* reason = nullptr;
+		if (targets.size() > 1) reason = "fan-out targets share one read of the input";
+		else if (streamInput || StreamWavWriter::isStream(job.outfilename)) reason = "streams are read and written in order";
+		else if (job.useAudioTimeline) reason = "timeline objects are sampled in stream order";
+		else if (job.spatialDownmixerMode) reason = "the spatial downmix is decided on the whole input";
+		else if (job.limit) reason = "the limiter runs in stream order";
+		else if (!job.subChannelIndices.empty()) reason = "the lfe-sub filters run in stream order";
+		else if (job.writeMetadata) reason = "ADM outputs are written through libbw64";
+		for (int i = 1; !reason && i < numInFiles; i++) {
+			if (inFileFrames[i] != inFileFrames[0]) reason = "input files differ in length";
+		}
+		if (!reason) {
+			SegmentLayout layout;
+			layout.inFiles = fNames;
+			layout.processInChannels = processInChannels;
+			layout.outChannels = first.channels;
+			layout.outFileChannels = first.actualOutFileChannels;
+			layout.numOutFiles = first.numOutFiles;
+			layout.sampleRate = sampleRate;
+			layout.bitDepth = 16;
+			if (inputFormat == SF_FORMAT_PCM_24) layout.bitDepth = 24;
+			if (inputFormat == SF_FORMAT_PCM_32) layout.bitDepth = 32;
+			layout.frames = inFileFrames[0];
+			layout.blockSize = blockSize;
+			layout.comment = formatComment(m1transcode, first.outFmt);
+			layout.kernel = first.matrixKernel;
+
+			int status = transcodeSegments(job, layout, job.masterGain);
+			if (status != SEGMENTS_UNAVAILABLE) {
+				return status;
+			}
+			reason = "outputs can't be written positionally here";
+		}
+		printf("Segments:           off, %s\r\n", reason);
+	}
+
+	pipeline.setThreads(job.numThreads);
+	pipeline.setQueueDepth(job.queueDepth);
+	size_t arenaFloats = BufferArena::padded((size_t)inChannels * blockSize) + pipeline.arenaSize(processInChannels, channels, blockSize);
+	for (size_t t = 0; t < targets.size(); t++) {
+		OutputTarget& target = *targets[t];
+		target.fusedOutput = target.matrixKernel && FusedOutputStage::worthIt(*target.matrixKernel, target.actualOutFileChannels);
+		if (target.fusedOutput) arenaFloats += FusedOutputStage::arenaSize(target.channels);
+	}
+	// PCM outputs go through writeIO with -io-backend, -write-buffer or -direct-io
+	bool useWriteQueue = job.ioBackend != AsyncFileIO::BACKEND_SYNC || job.writeBufferMB > 0 || job.directIO;
+	int writeBuffersPerFile = job.ioBackend == AsyncFileIO::BACKEND_SYNC ? 1 : job.ioDepth;
+	size_t writeBufferBytes = job.writeBufferMB > 0 ? (size_t)job.writeBufferMB << 20 : AsyncFileIO::DEFAULT_BUFFER_BYTES;
+	size_t ioBytes = (size_t)readIO.getNumBuffers() * readIO.getBufferBytes();
+	if (useWriteQueue) ioBytes += (size_t)numOutFiles * writeBuffersPerFile * writeBufferBytes;
+	// several inputs are read ahead concurrently, unless the queue already does
+	usePrefetch = job.prefetchChunks > 0 && numInFiles > 1 && !streamInput && readIO.getNumBuffers() == 0;
+	int prefetchFrames = (std::max)(blockSize, 16384);
+	if (usePrefetch) {
+		// large object sessions get shorter chunks, about 64MB read ahead in all
+		size_t perFrame = (size_t)inChannels * job.prefetchChunks * sizeof(float);
+		size_t fitting = ((size_t)64 << 20) / perFrame;
+		if (fitting < (size_t)prefetchFrames) prefetchFrames = (std::max)(blockSize, (int)fitting);
+	}
+	if (usePrefetch) {
+		size_t prefetchFloats = InputPrefetcher::requiredFloats(inFileChannels, prefetchFrames, job.prefetchChunks);
+		for (int i = 0; i < numInFiles; i++) {
+			if (!mappedInfile[i]) prefetchFloats += (size_t)inFileChannels[i] * prefetchFrames;
+		}
+		ioBytes += prefetchFloats * sizeof(float);
+	}
+	session.reserveMemory(arenaFloats * sizeof(float) + ioBytes);
+	arena.reset(arenaFloats);
+	fileBuffer = arena.allocate((size_t)inChannels * blockSize);
+	pipeline.setup(arena, processInChannels, channels, blockSize);
+
+	if (usePrefetch) {
+		prefetchScratch.resize(numInFiles);
+		for (int i = 0; i < numInFiles; i++) {
+			if (!mappedInfile[i]) prefetchScratch[i].resize((size_t)inFileChannels[i] * prefetchFrames);
+		}
+		prefetcher.setup(inFileChannels, prefetchFrames, job.prefetchChunks, 8, [&](int file, float** planes, int frames) -> int {
+			if (mappedInfile[file]) return mappedInfile[file]->readPlanar(planes, 0, frames);
+			int numChannels = inFileChannels[file];
+			float* interleaved = prefetchScratch[file].data();
+			int framesRead = (int)(infile[file]->read(interleaved, (sf_count_t)frames * numChannels) / numChannels);
+			InterleaveKernels::deinterleave(interleaved, numChannels, planes, 0, framesRead);
+			return framesRead;
+		});
+		printf("Prefetch:           %d files, %d x %d frames ahead, %d threads\r\n", (int)numInFiles, job.prefetchChunks, prefetchFrames, prefetcher.getNumThreads());
+	}
+
+	// matrix, gain, peak and interleave in one walk over the output
+	for (size_t t = 0; t < targets.size(); t++) {
+		OutputTarget& target = *targets[t];
+		if (target.fusedOutput) {
+			target.fusedStage.setup(arena, *target.matrixKernel, target.actualOutFileChannels, target.numOutFiles);
+		}
+	}
+
+	// fan-out targets convert each block concurrently, except timeline ones
+	// on processConversion, whose points sampler shares global state
+	bool sharedSampler = false;
+	for (size_t t = 0; t < targets.size(); t++) {
+		if (job.useAudioTimeline && !targets[t]->timelineMatrix) sharedSampler = true;
+	}
+	std::unique_ptr<WorkStealingPool> targetPool;
+	if (targets.size() > 1) {
+		if (!sharedSampler) {
+			targetPool.reset(new WorkStealingPool((int)targets.size() - 1));
+		}
+		printf("Fan-out:            %d targets, converted %s\r\n", (int)targets.size(), targetPool ? "in parallel" : "one after another");
+	}
+	// timeline objects on the timeline matrix are only read and converted while they sound
+	ObjectScheduler scheduler;
+	bool sparseObjects = job.useAudioTimeline && !sharedSampler;
+	if (job.useAudioTimeline) {
+		if (sharedSampler && numObjects > Mach1TranscodeMAXCHANS) {
+			cerr << "Error: more than " << Mach1TranscodeMAXCHANS << " objects need the timeline matrix, without -sdk-matrix, -lfe-sub or -spatial-downmix" << std::endl;
+			return -1;
+		}
+		// an object's file starts with it, its track runs from the session start
+		std::vector<long long> objectStarts(numObjects), objectFrames(numObjects);
+		for (int i = 0; i < numObjects; i++) {
+			objectStarts[i] = keypointTimeline.getStartSample(i);
+			objectFrames[i] = nativeAdm ? (std::max)((long long)inFileFrames[0] - objectStarts[i], 0LL) : (long long)inFileFrames[i];
+		}
+		scheduler.setup(objectStarts, objectFrames);
+		printf("Objects:            %d, %s\r\n", numObjects, sparseObjects ? "read and converted while they sound" : "all converted every block");
+	}
+
+	// files must be the same length, timeline objects end with the last one,
+	// streams end with the first short block
+	sf_count_t numBlocks = streamInput ? std::numeric_limits<sf_count_t>::max() / 2 : (job.useAudioTimeline ? scheduler.getSessionEnd() : inFileFrames[0]) / blockSize;
+	sf_count_t streamEndBlock = -1;
+	sf_count_t drainBlocks = 0;
 	totalSamples = 0;
-	float peak = 0.0f;
 
-    for (int pass = 1, countPasses = ((normalize || spatialDownmixerMode) ? 2 : 1); pass <= countPasses; pass++)
+	// keep the converted planes of pass 1 so pass 2 only has to apply gain and write
+	SpillFile spill;
+	bool useSpill = false;
+	if ((job.normalize || job.spatialDownmixerMode) && job.spillBudgetMB > 0) {
+		uint64_t spillBytes = SpillFile::requiredBytes(channels, blockSize, numBlocks + 1);
+		if (spillBytes <= (uint64_t)job.spillBudgetMB * 1024 * 1024 && spill.create(job.spillDir, channels, blockSize, numBlocks + 1)) {
+			useSpill = true;
+			printf("Pass 1 Spill:       %.1fMB in %s\r\n", spillBytes / (1024.0 * 1024.0), job.spillDir.c_str());
+		} else {
+			printf("Pass 1 Spill:       off, transcoding twice\r\n");
+		}
+	}
+
+    for (int pass = 1, countPasses = ((job.normalize || job.spatialDownmixerMode) ? 2 : 1); pass <= countPasses; pass++)
     {
         if (pass == 2) {
-            // Mach1 Spatial Downmixer
-            // Triggered due to correlation of top vs bottom
-            // being higher than threshold
-            if (spatialDownmixerMode && (outFmt == m1transcode.getFormatFromString("M1Spatial-8"))) {
-                m1transcode.setSpatialDownmixer(corrThreshold);
-				if (m1transcode.getSpatialDownmixerPossibility()) {
-					/*
-					std::vector<float> avgSamplesDiff = spatialDownmixChecker.getAvgSamplesDiff();
-					for (int i = 0; i < avgSamplesDiff.size(); i++) {
-						printf("Average samples diff: %f\r\n", avgSamplesDiff[i]);
-					}
-					*/ 
-
-                    // reinitialize inputs and outputs
-					outFmt = m1transcode.getFormatFromString("M1Spatial-4");
-					m1transcode.setOutputFormat(outFmt);
-					m1transcode.processConversionPath();
-
-					channels = m1transcode.getOutputNumChannels();
-					actualOutFileChannels = outFileChans == 0 ? channels : outFileChans;
-					numOutFiles = channels / actualOutFileChannels;
+			for (size_t t = 0; t < targets.size(); t++) {
+				OutputTarget& target = *targets[t];
+				Mach1Transcode<float>& m1transcode = target.transcode();
+
+				// Mach1 Spatial Downmixer
+				// Triggered due to correlation of top vs bottom
+				// being higher than threshold
+				if (job.spatialDownmixerMode && (target.outFmt == m1transcode.getFormatFromString("M1Spatial-8"))) {
+					m1transcode.setSpatialDownmixer(job.corrThreshold);
+					if (m1transcode.getSpatialDownmixerPossibility()) {
+						// reinitialize outputs, the target keeps its planes and uses fewer of them
+						target.outFmt = m1transcode.getFormatFromString("M1Spatial-4");
+						m1transcode.setOutputFormat(target.outFmt);
+						m1transcode.processConversionPath();
+
+						target.channels = m1transcode.getOutputNumChannels();
+						target.actualOutFileChannels = outFileChans == 0 ? target.channels : outFileChans;
+						target.numOutFiles = target.channels / target.actualOutFileChannels;
+
+						// pass 1 was converted to the old format, so it has to run again
+						if (useSpill) {
+							spill.close();
+							useSpill = false;
+						}
 
-                    printf("Spatial Downmix:    ");
-                    printf("%s", m1transcode.getFormatName(outFmt).c_str());
-                    printf("\r\n");
+						printf("Spatial Downmix:    ");
+						printf("%s", m1transcode.getFormatName(target.outFmt).c_str());
+						printf("\r\n");
+					}
 				}
-			}
 
-			// normalize
-			if (normalize)
-			{
-				std::cout << "Reducing gain by    " << m1transcode.level2db(peak) << "dB" << std::endl;
-                std::cout << std::endl;
-				masterGain /= peak;
+				// normalize
+				if (job.normalize)
+				{
+					std::cout << "Reducing gain by    " << m1transcode.level2db(target.peak) << "dB";
+					if (targets.size() > 1) std::cout << " (" << target.job.outFmtStr << ")";
+					std::cout << std::endl;
+					target.masterGain /= target.peak;
+				}
 			}
+			std::cout << std::endl;
 
 			totalSamples = 0;
-			for (int file = 0; file < numInFiles; file++)
-				infile[file]->seek(0, SEEK_SET);
+			if (!useSpill) {
+				if (usePrefetch) prefetcher.pause();
+				for (int file = 0; file < numInFiles; file++)
+					if (infile[file]) infile[file]->seek(0, SEEK_SET);
+				if (bw64Infile) bw64Infile->seek(0);
+				for (int file = 0; file < numInFiles; file++)
+					if (mappedInfile[file]) mappedInfile[file]->seek(0);
+				for (int file = 0; file < numInFiles; file++)
+					if (asyncInfile[file]) asyncInfile[file]->seek(0);
+				if (usePrefetch) prefetcher.resume();
+			}
 		}
 
 		if (pass == countPasses) {
-			// init outfiles
-			for (int i = 0; i < numOutFiles; i++) {
-				//TODO: expand this out to other output types and better handling from printFileInfo()
-				int format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
-				int inputFormat = infile[0]->format() & 0xffff;
-				if (inputFormat == SF_FORMAT_PCM_16) format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
-				if (inputFormat == SF_FORMAT_PCM_24) format = SF_FORMAT_WAV | SF_FORMAT_PCM_24;
-				if (inputFormat == SF_FORMAT_PCM_32) format = SF_FORMAT_WAV | SF_FORMAT_PCM_32;
-				char outfilestr[1024];
-				if (numOutFiles > 1) {
-					sprintf(outfilestr, "%s_%0d.wav", outfilename, i);
-				}
-				else {
-					strcpy(outfilestr, outfilename);
-				}
+			// queued writes for the plain WAV outputs
+			int numAsyncOutFiles = 0;
+			for (size_t t = 0; t < targets.size() && !job.writeMetadata; t++) {
+				if (!StreamWavWriter::isStream(targets[t]->job.outfilename)) numAsyncOutFiles += targets[t]->numOutFiles;
+			}
+			// staged (sync) or queued writes in large aligned blocks
+			WriteBuffering buffering;
+			if (useWriteQueue && numAsyncOutFiles > 0 && writeIO.setup(job.ioBackend, numAsyncOutFiles * writeBuffersPerFile, writeBufferBytes)) {
+				buffering.io = &writeIO;
+				buffering.buffers = writeBuffersPerFile;
+				buffering.frames = streamInput ? 0 : (job.useAudioTimeline ? scheduler.getSessionEnd() : inFileFrames[0]);
+				buffering.directIO = job.directIO;
+				printf("Output I/O:         %s, %d x %dKB per file%s\r\n", AsyncFileIO::backendName(writeIO.getBackend()), writeBuffersPerFile, (int)(writeIO.getBufferBytes() / 1024),
+					writeIO.hasRegisteredBuffers() ? ", registered buffers" : "");
+				std::cout << std::endl;
+			}
+
+			for (size_t t = 0; t < targets.size(); t++) {
+				OutputTarget& target = *targets[t];
+				Mach1Transcode<float>& m1transcode = target.transcode();
+				int outFmt = target.outFmt;
+				int numOutFiles = target.numOutFiles;
+				int actualOutFileChannels = target.actualOutFileChannels;
+				const char* outfilename = target.job.outfilename.c_str();
+				SndFileWriter* outfiles = target.outfiles;
+
+				// init outfiles
+				for (int i = 0; i < numOutFiles; i++) {
+					//TODO: expand this out to other output types and better handling from printFileInfo()
+					int format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+					if (inputFormat == SF_FORMAT_PCM_16) format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+					if (inputFormat == SF_FORMAT_PCM_24) format = SF_FORMAT_WAV | SF_FORMAT_PCM_24;
+					if (inputFormat == SF_FORMAT_PCM_32) format = SF_FORMAT_WAV | SF_FORMAT_PCM_32;
+					if (target.job.outfilename == "-" && (numOutFiles > 1 || job.writeMetadata)) {
+						cerr << "Error: stdout takes a single WAV output, without -write-metadata" << std::endl;
+						return -1;
+					}
+					char outfilestr[1024];
+					if (numOutFiles > 1) {
+						sprintf(outfilestr, "%s_%0d.wav", outfilename, i);
+					}
+					else {
+						strcpy(outfilestr, outfilename);
+					}
 
-                /*
-                 Section for writing ADM based metadata to output
-                 */
-				if (writeMetadata) {
-                    // Setup empty metadata chunks
-                    bw64::ChnaChunk chnaChunkAdm;
-                    std::string axmlChunkAdmCorrectedString;
-                    int bitDepth;
-                    if (inputInfo.format == SF_FORMAT_PCM_16){
-                        bitDepth = 16;
-                    } else if (inputInfo.format == SF_FORMAT_PCM_24) {
-                        bitDepth = 24;
-                    } else if (inputInfo.format == SF_FORMAT_PCM_32) {
-                        bitDepth = 32;
-                    }
+                    /*
+                     Section for writing ADM based metadata to output
+                     */
+					if (job.writeMetadata) {
+                        // Setup empty metadata chunks
+                        bw64::ChnaChunk chnaChunkAdm;
+                        std::string axmlChunkAdmCorrectedString;
+                        int bitDepth;
+                        if (inputInfo.format == SF_FORMAT_PCM_16){
+                            bitDepth = 16;
+                        } else if (inputInfo.format == SF_FORMAT_PCM_24) {
+                            bitDepth = 24;
+                        } else if (inputInfo.format == SF_FORMAT_PCM_32) {
+                            bitDepth = 32;
+                        }
                     
-                    // TODO: remove the hardcoded `adm_metadata.h` file and write inline instructions for creating the metadata to scale for all formats
-                    if (outFmt == m1transcode.getFormatFromString("M1Spatial-8")){
-                        // setup `chna` metadata chunk
-                        /// Creates a description of an 8 objects
-                        std::vector<ChannelDescType> channelDescType = { {3}, {3}, {3}, {3}, {3}, {3}, {3}, {3} };
-                        chnaChunkAdm = fillChnaChunkADMDesc(channelDescType);
-                        if (chnaChunkAdm.audioIds().size() != actualOutFileChannels){
-                            std::cout << "ERROR: Issue writing `chna` metadata chunk due to mismatching channel count" << std::endl;
-                            break;
+                        // TODO: remove the hardcoded `adm_metadata.h` file and write inline instructions for creating the metadata to scale for all formats
+                        if (outFmt == m1transcode.getFormatFromString("M1Spatial-8")){
+                            // setup `chna` metadata chunk
+                            /// Creates a description of an 8 objects
+                            std::vector<ChannelDescType> channelDescType = { {3}, {3}, {3}, {3}, {3}, {3}, {3}, {3} };
+                            chnaChunkAdm = fillChnaChunkADMDesc(channelDescType);
+                            if (chnaChunkAdm.audioIds().size() != actualOutFileChannels){
+                                std::cout << "ERROR: Issue writing `chna` metadata chunk due to mismatching channel count" << std::endl;
+                                break;
+                            }
+                            // setup `axml` metadata chunk
+                            axmlChunkAdmCorrectedString = prepareAdmMetadata(axml_m1spatial_ChunkAdmString, inputInfo.duration, inputInfo.sampleRate, bitDepth).c_str();
+                            bw64::AxmlChunk axmlChunkAdmCorrected(axmlChunkAdmCorrectedString);
+                            outfiles[i].open(outfilestr, inputInfo.sampleRate, actualOutFileChannels, bitDepth, chnaChunkAdm, axmlChunkAdmCorrected, (size_t)job.writeBufferMB << 20);
                         }
-                        // setup `axml` metadata chunk
-                        axmlChunkAdmCorrectedString = prepareAdmMetadata(axml_m1spatial_ChunkAdmString, inputInfo.duration, inputInfo.sampleRate, bitDepth).c_str();
-                        bw64::AxmlChunk axmlChunkAdmCorrected(axmlChunkAdmCorrectedString);
-                        outfiles[i].open(outfilestr, inputInfo.sampleRate, actualOutFileChannels, bitDepth, chnaChunkAdm, axmlChunkAdmCorrected);
-                    }
-                    else if (outFmt == m1transcode.getFormatFromString("7.1.2_M") || outFmt == m1transcode.getFormatFromString("7.1.2_C") || outFmt == m1transcode.getFormatFromString("7.1.2_S") || outFmt == m1transcode.getFormatFromString("7.1.2_C_SIM")){
-                        // setup `chna` metadata chunk
-                        /// Creates a description of an 7.1.2 channel bed
-                        std::vector<ChannelDescType> channelDescType = { {1}, {1}, {1}, {1}, {1}, {1}, {1}, {1}, {1}, {1} };
-                        chnaChunkAdm = fillChnaChunkADMDesc(channelDescType);
-                        if (chnaChunkAdm.audioIds().size() != actualOutFileChannels){
-                            std::cout << "ERROR: Issue writing `chna` metadata chunk due to mismatching channel count" << std::endl;
-							break;
+                        else if (outFmt == m1transcode.getFormatFromString("7.1.2_M") || outFmt == m1transcode.getFormatFromString("7.1.2_C") || outFmt == m1transcode.getFormatFromString("7.1.2_S") || outFmt == m1transcode.getFormatFromString("7.1.2_C_SIM")){
+                            // setup `chna` metadata chunk
+                            /// Creates a description of an 7.1.2 channel bed
+                            std::vector<ChannelDescType> channelDescType = { {1}, {1}, {1}, {1}, {1}, {1}, {1}, {1}, {1}, {1} };
+                            chnaChunkAdm = fillChnaChunkADMDesc(channelDescType);
+                            if (chnaChunkAdm.audioIds().size() != actualOutFileChannels){
+                                std::cout << "ERROR: Issue writing `chna` metadata chunk due to mismatching channel count" << std::endl;
+								break;
+                            }
+                            // setup `axml` metadata chunk
+                            axmlChunkAdmCorrectedString = prepareAdmMetadata(axml_7_1_2_ChunkAdmString, inputInfo.duration, inputInfo.sampleRate, bitDepth).c_str();
+                            bw64::AxmlChunk axmlChunkAdmCorrected(axmlChunkAdmCorrectedString);
+                            outfiles[i].open(outfilestr, inputInfo.sampleRate, actualOutFileChannels, bitDepth, chnaChunkAdm, axmlChunkAdmCorrected, (size_t)job.writeBufferMB << 20);
                         }
-                        // setup `axml` metadata chunk
-                        axmlChunkAdmCorrectedString = prepareAdmMetadata(axml_7_1_2_ChunkAdmString, inputInfo.duration, inputInfo.sampleRate, bitDepth).c_str();
-                        bw64::AxmlChunk axmlChunkAdmCorrected(axmlChunkAdmCorrectedString);
-                        outfiles[i].open(outfilestr, inputInfo.sampleRate, actualOutFileChannels, bitDepth, chnaChunkAdm, axmlChunkAdmCorrected);
-                    }
-                    else if (outFmt == m1transcode.getFormatFromString("5.1.4_M") || outFmt == m1transcode.getFormatFromString("5.1.4_C") || outFmt == m1transcode.getFormatFromString("5.1.4_S")){
-                        // setup `chna` metadata chunk
-                        /// Creates a description of an 5.1 channel bed + 4 object bed
-                        std::vector<ChannelDescType> channelDescType = { {1}, {1}, {1}, {1}, {1}, {1}, {3}, {3}, {3}, {3} };
-                        chnaChunkAdm = fillChnaChunkADMDesc(channelDescType);
-                        if (chnaChunkAdm.audioIds().size() != actualOutFileChannels){
-                            std::cout << "ERROR: Issue writing `chna` metadata chunk due to mismatching channel count" << std::endl;
-                            break;
+                        else if (outFmt == m1transcode.getFormatFromString("5.1.4_M") || outFmt == m1transcode.getFormatFromString("5.1.4_C") || outFmt == m1transcode.getFormatFromString("5.1.4_S")){
+                            // setup `chna` metadata chunk
+                            /// Creates a description of an 5.1 channel bed + 4 object bed
+                            std::vector<ChannelDescType> channelDescType = { {1}, {1}, {1}, {1}, {1}, {1}, {3}, {3}, {3}, {3} };
+                            chnaChunkAdm = fillChnaChunkADMDesc(channelDescType);
+                            if (chnaChunkAdm.audioIds().size() != actualOutFileChannels){
+                                std::cout << "ERROR: Issue writing `chna` metadata chunk due to mismatching channel count" << std::endl;
+                                break;
+                            }
+                            // setup `axml` metadata chunk
+                            axmlChunkAdmCorrectedString = prepareAdmMetadata(axml_5_1_4_ChunkAdmString, inputInfo.duration, inputInfo.sampleRate, bitDepth).c_str();
+                            bw64::AxmlChunk axmlChunkAdmCorrected(axmlChunkAdmCorrectedString);
+                            outfiles[i].open(outfilestr, inputInfo.sampleRate, actualOutFileChannels, bitDepth, chnaChunkAdm, axmlChunkAdmCorrected, (size_t)job.writeBufferMB << 20);
                         }
-                        // setup `axml` metadata chunk
-                        axmlChunkAdmCorrectedString = prepareAdmMetadata(axml_5_1_4_ChunkAdmString, inputInfo.duration, inputInfo.sampleRate, bitDepth).c_str();
-                        bw64::AxmlChunk axmlChunkAdmCorrected(axmlChunkAdmCorrectedString);
-                        outfiles[i].open(outfilestr, inputInfo.sampleRate, actualOutFileChannels, bitDepth, chnaChunkAdm, axmlChunkAdmCorrected);
-                    }
-                    else if (outFmt == m1transcode.getFormatFromString("7.1.4_M") || outFmt == m1transcode.getFormatFromString("7.1.4_C") || outFmt == m1transcode.getFormatFromString("7.1.4_S") || outFmt == m1transcode.getFormatFromString("7.1.4_C_SIM")){
-                        // setup `chna` metadata chunk
-                        /// Creates a description of an 7.1 channel bed + 4 object bed
-                        std::vector<ChannelDescType> channelDescType = { {1}, {1}, {1}, {1}, {1}, {1}, {1}, {1}, {3}, {3}, {3}, {3} };
-                        chnaChunkAdm = fillChnaChunkADMDesc(channelDescType);
-                        if (chnaChunkAdm.audioIds().size() != actualOutFileChannels){
-                            std::cout << "ERROR: Issue writing `chna` metadata chunk due to mismatching channel count" << std::endl;
-                            break;
+                        else if (outFmt == m1transcode.getFormatFromString("7.1.4_M") || outFmt == m1transcode.getFormatFromString("7.1.4_C") || outFmt == m1transcode.getFormatFromString("7.1.4_S") || outFmt == m1transcode.getFormatFromString("7.1.4_C_SIM")){
+                            // setup `chna` metadata chunk
+                            /// Creates a description of an 7.1 channel bed + 4 object bed
+                            std::vector<ChannelDescType> channelDescType = { {1}, {1}, {1}, {1}, {1}, {1}, {1}, {1}, {3}, {3}, {3}, {3} };
+                            chnaChunkAdm = fillChnaChunkADMDesc(channelDescType);
+                            if (chnaChunkAdm.audioIds().size() != actualOutFileChannels){
+                                std::cout << "ERROR: Issue writing `chna` metadata chunk due to mismatching channel count" << std::endl;
+                                break;
+                            }
+                            // setup `axml` metadata chunk
+                            axmlChunkAdmCorrectedString = prepareAdmMetadata(axml_7_1_4_ChunkAdmString, inputInfo.duration, inputInfo.sampleRate, bitDepth).c_str();
+                            bw64::AxmlChunk axmlChunkAdmCorrected(axmlChunkAdmCorrectedString);
+                            outfiles[i].open(outfilestr, inputInfo.sampleRate, actualOutFileChannels, bitDepth, chnaChunkAdm, axmlChunkAdmCorrected, (size_t)job.writeBufferMB << 20);
                         }
-                        // setup `axml` metadata chunk
-                        axmlChunkAdmCorrectedString = prepareAdmMetadata(axml_7_1_4_ChunkAdmString, inputInfo.duration, inputInfo.sampleRate, bitDepth).c_str();
-                        bw64::AxmlChunk axmlChunkAdmCorrected(axmlChunkAdmCorrectedString);
-                        outfiles[i].open(outfilestr, inputInfo.sampleRate, actualOutFileChannels, bitDepth, chnaChunkAdm, axmlChunkAdmCorrected);
-                    }
-				}
-				else {
-					outfiles[i].open(outfilestr, (int)sampleRate, actualOutFileChannels, format);
-				}
+					}
+					else {
+						outfiles[i].open(outfilestr, (int)sampleRate, actualOutFileChannels, format, job.dither, buffering);
+					}
 
-				if (outfiles[i].isOpened()) {
-					// set clipping mode
-					outfiles[i].setClip();
-					// output file stats
-					std::cout << "Output File:        " << outfilestr << std::endl;
-					outfiles[i].printInfo();
-				}
-				else {
-					cerr << "Error: opening out-file: " << outfilestr << std::endl;
-					return -1;
-				}
-				if (outFmt == m1transcode.getFormatFromString("M1Spatial") || outFmt == m1transcode.getFormatFromString("M1Spatial-8")) {
-					outfiles[i].setString(0x05, "mach1spatial-8");
-				}
-                else if (outFmt == m1transcode.getFormatFromString("M1Spatial-12")) {
-                    outfiles[i].setString(0x05, "mach1spatial-12");
-                }
-                else if (outFmt == m1transcode.getFormatFromString("M1Spatial-14")) {
-                    outfiles[i].setString(0x05, "mach1spatial-14");
-                }
-                else if (outFmt == m1transcode.getFormatFromString("M1Spatial-32")) {
-                    outfiles[i].setString(0x05, "mach1spatial-32");
-                }
-                else if (outFmt == m1transcode.getFormatFromString("M1Spatial-60")) {
-                    outfiles[i].setString(0x05, "mach1spatial-60");
-                }
-				else if (outFmt == m1transcode.getFormatFromString("M1Horizon") || outFmt == m1transcode.getFormatFromString("M1Spatial-4")) {
-					outfiles[i].setString(0x05, "mach1horizon-4");
-				}
-				else if (outFmt == m1transcode.getFormatFromString("M1HorizonPairs")) {
-					outfiles[i].setString(0x05, "mach1horizon-8");
+					if (outfiles[i].isOpened()) {
+						// set clipping mode
+						outfiles[i].setClip();
+						// output file stats
+						std::cout << "Output File:        " << outfilestr << std::endl;
+						outfiles[i].printInfo();
+					}
+					else {
+						cerr << "Error: opening out-file: " << outfilestr << std::endl;
+						return -1;
+					}
+					std::string comment = formatComment(m1transcode, outFmt);
+					if (!comment.empty()) {
+						outfiles[i].setString(0x05, comment.c_str());
+					}
 				}
+				std::cout << std::endl;
 			}
-			std::cout << std::endl;
 		}
 
-		// get start samples for all objects (ADM format)
-		std::vector<long long> startSampleForAudioObject;
-		for (int i = 0; i < audioObjects.size(); i++) {
-			startSampleForAudioObject.push_back(audioObjects[i].getKeyPoints()[0].sample);
+		// first input plane of every file
+		std::vector<int> firstInPlane(numInFiles, 0);
+		for (int file = 1; file < numInFiles; file++) {
+			firstInPlane[file] = firstInPlane[file - 1] + inFileChannels[file - 1];
 		}
 
-		for (int i = 0; i <= numBlocks; i++) {
-			// read next buffer from each infile
+		// reads up to `frames` frames of a file into its planes of the block
+		// from `offset` on, returns the frames read
+		auto readFile = [&](TranscodeBlock& block, int file, int offset, int frames) -> sf_count_t {
+			float** planes = block.inPtrs.data() + firstInPlane[file];
+			if (usePrefetch) {
+				return prefetcher.read(file, planes, offset, frames);
+			} else if (streamInfile[file]) {
+				return streamInfile[file]->readPlanar(planes, offset, frames);
+			} else if (asyncInfile[file]) {
+				return asyncInfile[file]->readPlanar(planes, offset, frames);
+			} else if (mappedInfile[file]) {
+				// convert straight from the mapped file into the process buffers
+				return mappedInfile[file]->readPlanar(planes, offset, frames);
+			}
+			sf_count_t numChannels = inFileChannels[file];
 			sf_count_t samplesRead = 0;
-			sf_count_t firstBuf = 0;
-			float(*inBuf)[Mach1TranscodeMAXCHANS][BUFFERLEN] = (float(*)[Mach1TranscodeMAXCHANS][BUFFERLEN])&(inBuffers[0][0]);
-			for (int file = 0; file < numInFiles; file++) {
-				sf_count_t numChannels = infile[file]->channels();
+			if (bw64Infile) {
+				samplesRead = (sf_count_t)bw64Infile->read(fileBuffer, (uint64_t)frames);
+			} else {
+				samplesRead = infile[file]->read(fileBuffer, frames * numChannels) / numChannels;
+			}
+			// demultiplex into process buffers
+			InterleaveKernels::deinterleave(fileBuffer, (int)numChannels, planes, offset, (int)samplesRead);
+			return samplesRead;
+		};
+
+		// zero whatever the read didn't cover
+		auto zeroOutside = [&](TranscodeBlock& block, int file, sf_count_t offset, sf_count_t fileFrames) {
+			for (int k = 0; k < inFileChannels[file]; k++) {
+				float* plane = block.inPtrs[firstInPlane[file] + k];
+				if (offset > 0) memset(plane, 0, offset * sizeof(float));
+				if (offset + fileFrames < blockSize) memset(plane + offset + fileFrames, 0, (blockSize - offset - fileFrames) * sizeof(float));
+			}
+		};
+
+		// reader stage: read next buffer from each infile and demultiplex
+		// into the block's process buffers
+		TranscodePipeline::ReadStage readBlock = [&](TranscodeBlock& block) -> int {
+			if (useSpill && pass == 2) {
+				// converted planes come straight back from the pass 1 spill
+				if (block.index >= spill.getNumBlocks()) return 0;
+				int frames = spill.readBlock(block.index, block.outPtrs.data());
+				totalSamples += frames;
+				return frames;
+			}
 
-				// first fill buffer with zeros
-				for (int j = 0; j < BUFFERLEN; j++)
-					for (int k = 0; k < numChannels; k++) {
-						(*inBuf)[firstBuf + k][j] = 0;
-					}
+			// past the end of a stream only the limiter's drain blocks are left
+			if (streamEndBlock >= 0 && block.index > streamEndBlock + drainBlocks) {
+				return TranscodePipeline::END_OF_STREAM;
+			}
 
-				int startSample = 0;
-				if (useAudioTimeline) {
-					startSample = startSampleForAudioObject[file];
-				}
-                
-				if (totalSamples + BUFFERLEN >= startSample) {
-					sf_count_t framesToRead = numChannels * BUFFERLEN;
-
-					// cut samples if the beginning of the offset does not match with the beginning of the buffer
-					sf_count_t offset = 0;
-					if (startSample + BUFFERLEN < totalSamples && totalSamples < startSample) {
-						offset = startSample - totalSamples;
-						framesToRead = BUFFERLEN + totalSamples - startSample;
-					}
+			if (nativeAdm) {
+				// every object is a track of the one file, read in a single pass;
+				// objects that don't sound in this block aren't converted
+				sf_count_t frames = readFile(block, 0, 0, blockSize);
+				zeroOutside(block, 0, 0, frames);
+				const std::vector<int>& active = scheduler.activeIn(totalSamples, blockSize);
+				block.sparse = sparseObjects;
+				block.activePlanes.assign(active.begin(), active.end());
+				block.convertPtrs.resize(numObjects);
+				for (int i = 0; i < numObjects; i++) block.convertPtrs[i] = block.inPtrs[objectTracks[i]];
+				frames = (std::max)((std::min)((sf_count_t)blockSize, (sf_count_t)scheduler.getSessionEnd() - totalSamples), (sf_count_t)0);
+				totalSamples += frames;
+				return (int)frames;
+			}
 
-					sf_count_t framesRead = infile[file]->read(fileBuffer, framesToRead);
-					samplesRead = framesRead / numChannels;
-					// demultiplex into process buffers
-					float *ptrFileBuffer = fileBuffer;
-					for (int j = 0; j < samplesRead; j++) {
-						for (int k = 0; k < numChannels; k++) {
-							(*inBuf)[firstBuf + k][offset + j] = *ptrFileBuffer++;
-						}
+			if (job.useAudioTimeline) {
+				// only the objects sounding in this block are read
+				const std::vector<int>& active = scheduler.activeIn(totalSamples, blockSize);
+				block.sparse = sparseObjects;
+				block.activePlanes.clear();
+				for (size_t a = 0; a < active.size(); a++) {
+					int file = active[a];
+					sf_count_t offset = (std::max)(scheduler.getStart(file) - (long long)totalSamples, 0LL);
+					sf_count_t fileFrames = readFile(block, file, (int)offset, (int)(blockSize - offset));
+					zeroOutside(block, file, offset, fileFrames);
+					for (int k = 0; k < inFileChannels[file]; k++) block.activePlanes.push_back(firstInPlane[file] + k);
+				}
+				if (!sparseObjects) {
+					// processConversion reads every plane, silent objects are zeroed
+					size_t next = 0;
+					for (int file = 0; file < numInFiles; file++) {
+						if (next < active.size() && active[next] == file) next++;
+						else zeroOutside(block, file, 0, 0);
 					}
 				}
+				sf_count_t frames = (std::max)((std::min)((sf_count_t)blockSize, (sf_count_t)scheduler.getSessionEnd() - totalSamples), (sf_count_t)0);
+				totalSamples += frames;
+				return (int)frames;
+			}
 
-				firstBuf += numChannels;
+			sf_count_t samplesRead = 0;
+			for (int file = 0; file < numInFiles; file++) {
+				samplesRead = readFile(block, file, 0, blockSize);
+				zeroOutside(block, file, 0, samplesRead);
 			}
 			totalSamples += samplesRead;
+			if (streamInput && streamEndBlock < 0 && samplesRead < blockSize) {
+				streamEndBlock = block.index;
+			}
+			return (int)samplesRead;
+		};
+
+		// the spill file and the limiter need the planar output
+		bool fusedPass = !useSpill && !job.limit;
+
+		// converts one target's share of a block, then gain and multiplex to
+		// its output channels; returns the frames left for its files
+		auto processTarget = [&](OutputTarget& target, TranscodeBlock& block) -> int {
+			int samplesRead = block.frames;
+			float** inPtrs = block.convertPtrs.empty() ? block.inPtrs.data() : block.convertPtrs.data();
+			float** outPtrs = block.outPtrs.data() + target.firstPlane;
+			float* targetBuffer = block.fileBuffer + (size_t)target.firstPlane * blockSize;
+			Mach1Transcode<float>& m1transcode = target.transcode();
+
+			if (fusedPass && target.fusedOutput) {
+				if (pass == countPasses) {
+					target.fusedStage.process(inPtrs, samplesRead, target.masterGain, targetBuffer);
+				} else if (job.normalize) {
+					target.peak = (std::max)(target.peak, target.fusedStage.process(inPtrs, samplesRead, 1.0f, nullptr));
+				}
+				return samplesRead;
+			}
 
-			m1transcode.processConversion(inPtrs, outPtrs, (int)samplesRead);
+			if (!(useSpill && pass == 2)) {
+				if (target.matrixKernel) {
+					target.matrixKernel->process(inPtrs, outPtrs, samplesRead);
+				} else if (target.timelineMatrix) {
+					target.timelineMatrix->process(inPtrs, outPtrs, (long long)block.index * blockSize, samplesRead, block.sparse ? &block.activePlanes : nullptr);
+				} else {
+					m1transcode.processConversion(inPtrs, outPtrs, samplesRead);
+				}
+			}
 
 			if (pass == 1) {
-				if (normalize) {
+				if (job.normalize) {
 					// find max
-					peak = (std::max)(peak, m1transcode.processNormalization(outPtrs, samplesRead));
+					target.peak = (std::max)(target.peak, m1transcode.processNormalization(outPtrs, samplesRead));
 				}
 			}
 
 			if (pass == countPasses) {
-				m1transcode.processMasterGain(outPtrs, samplesRead, masterGain);
+				m1transcode.processMasterGain(outPtrs, samplesRead, target.masterGain);
+
+				if (job.limit) {
+					// the limiter delays its output, the tail is drained once the input runs short
+					int produced = target.limiter.process(outPtrs, samplesRead);
+					if (samplesRead < blockSize) {
+						produced += target.limiter.flush(outPtrs, produced, blockSize - produced);
+					}
+					samplesRead = produced;
+				}
 
 				// multiplex to output channels with master gain
-				float *ptrFileBuffer = fileBuffer;
-				float(*outBuf)[Mach1TranscodeMAXCHANS][BUFFERLEN] = (float(*)[Mach1TranscodeMAXCHANS][BUFFERLEN])&(outBuffers[0][0]);
+				float *ptrFileBuffer = targetBuffer;
 
-				for (int file = 0; file < numOutFiles; file++) {
-                    for (int j = 0; j < samplesRead; j++) {
-                        for (int k = 0; k < actualOutFileChannels; k++) {
-							*ptrFileBuffer++ = (*outBuf)[(file*actualOutFileChannels) + k][j];
-                        }
-                    }
+				for (int file = 0; file < target.numOutFiles; file++) {
+					InterleaveKernels::interleave(outPtrs + (file*target.actualOutFileChannels), target.actualOutFileChannels, ptrFileBuffer, samplesRead);
+					ptrFileBuffer += target.actualOutFileChannels * samplesRead;
                 }
+			}
+			return samplesRead;
+		};
+
+		// transcode stage: every target converts the same input block
+		TranscodePipeline::BlockStage processBlock = [&](TranscodeBlock& block) {
+			int frames = block.frames;
+			if (targetPool) {
+				for (size_t t = 1; t < targets.size(); t++) {
+					OutputTarget* target = targets[t].get();
+					targetPool->submit([&, target](int) { processTarget(*target, block); });
+				}
+				frames = processTarget(*targets[0], block);
+				targetPool->wait();
+			} else {
+				for (size_t t = 0; t < targets.size(); t++) {
+					int produced = processTarget(*targets[t], block);
+					if (t == 0) frames = produced;
+				}
+			}
+			if (useSpill && pass == 1) {
+				spill.writeBlock(block.index, block.outPtrs.data(), block.frames);
+			}
+			// the limiters of all targets have the same latency
+			block.frames = frames;
+		};
 
-				// write to outfile
-				for (int j = 0; j < numOutFiles; j++) {
-					outfiles[j].write(fileBuffer + (j*actualOutFileChannels*samplesRead), samplesRead);
+		// writer stage
+		TranscodePipeline::BlockStage writeBlock = [&](TranscodeBlock& block) {
+			if (pass == countPasses) {
+				int samplesRead = block.frames;
+				for (size_t t = 0; t < targets.size(); t++) {
+					OutputTarget& target = *targets[t];
+					float* targetBuffer = block.fileBuffer + (size_t)target.firstPlane * blockSize;
+					for (int j = 0; j < target.numOutFiles; j++) {
+						target.outfiles[j].write(targetBuffer + (j*target.actualOutFileChannels*samplesRead), samplesRead);
+					}
 				}
+				// the buffers filled up by this block go to the disk together
+				writeIO.flush();
+			}
+		};
+
+		sf_count_t passBlocks = numBlocks + 1;
+		if (job.limit && pass == countPasses) {
+			for (size_t t = 0; t < targets.size(); t++) {
+				targets[t]->limiter.setup(targets[t]->channels, (int)sampleRate, job.limitCeiling);
+			}
+			// extra empty blocks to drain the limiter's look-ahead delay
+			drainBlocks = (targets[0]->limiter.getLatency() + blockSize - 1) / blockSize;
+			passBlocks += drainBlocks;
+			printf("True Peak Limit:    %.1fdBTP\r\n", job.limitCeiling);
+		}
+
+		if (fusedPass && first.fusedOutput && pass == 1) {
+			printf("Output Stage:       fused, %d frame tiles\r\n", first.fusedStage.getTileFrames());
+		}
+		try {
+			pipeline.run(passBlocks, readBlock, processBlock, writeBlock);
+		} catch (const std::exception& e) {
+			cerr << "Error: " << e.what() << std::endl;
+			return -1;
+		}
+
+		if (job.limit && pass == countPasses) {
+			for (size_t t = 0; t < targets.size(); t++) {
+				std::cout << "Limiter Reduction:  " << m1transcode.level2db(targets[t]->limiter.getMinGain()) << "dB";
+				if (targets.size() > 1) std::cout << " (" << targets[t]->job.outFmtStr << ")";
+				std::cout << std::endl;
+			}
+		}
+	}
+	for (size_t t = 0; t < targets.size(); t++) {
+		for (int i = 0; i < targets[t]->numOutFiles; i++) {
+			if (!targets[t]->outfiles[i].close()) {
+				cerr << "Error: writing out-file: " << targets[t]->job.outfilename << std::endl;
+				return -1;
 			}
 		}
 	}
@@ -946,3 +2318,241 @@ int main(int argc, char* argv[]) {
 	std::cout << "Length (sec):       " << (float)totalSamples / (float)sampleRate << std::endl;
 	return 0;
 }
+
+/*
+ manifestArgs(node, args)
+ Turns one map of a batch manifest into command line arguments:
+ `key: value` becomes `-key value`, a list becomes several values and
+ boolean flags set to false are left out.
+ */
+void manifestArgs(Yaml::Node& node, std::vector<std::string>& args) {
+	for (Yaml::Iterator it = node.Begin(); it != node.End(); it++) {
+		std::string option = "-" + (*it).first;
+		Yaml::Node& value = (*it).second;
+		if (value.IsSequence()) {
+			args.push_back(option);
+			for (size_t i = 0; i < value.Size(); i++) {
+				args.push_back(value[i].As<std::string>());
+			}
+		} else if (value.IsScalar()) {
+			std::string str = value.As<std::string>();
+			if (str == "false" || str == "no" || str == "off") continue;
+			// flags are read with getCmdOption, so they keep a value after them
+			args.push_back(option);
+			args.push_back(str);
+		} else {
+			args.push_back(option);
+			args.push_back("true");
+		}
+	}
+}
+
+/*
+ runBatch(manifest, argc, argv)
+ Runs every job of a yaml manifest in this process, reusing conversion
+ setups between jobs:
+
+   defaults:                  # optional, applies to every job
+     out-file-chans: 0
+   jobs:
+     - in-file: a.wav         # a list for sets of input files
+       in-fmt: M1Spatial-8
+       out-file: a_714.wav
+       out-fmt: 7.1.4_C
+       master-gain: -3
+       normalize: true
+
+ Keys are the command line options without the dash. Options given on the
+ command line next to -batch apply to every job that doesn't set them.
+ A failing job is reported and the batch carries on with the next one.
+ */
+int runBatch(const char* manifest, int argc, char* argv[]) {
+	Yaml::Node root;
+	try {
+		Yaml::Parse(root, manifest);
+	} catch (const Yaml::Exception& e) {
+		cerr << "Error: reading batch manifest: " << manifest << ": " << e.Message() << std::endl;
+		return -1;
+	}
+	// the manifest is either a map with a `jobs` list or just the list
+	Yaml::Node& jobs = root.IsSequence() ? root : root["jobs"];
+	if (!jobs.IsSequence() || jobs.Size() == 0) {
+		cerr << "Error: batch manifest has no jobs: " << manifest << std::endl;
+		return -1;
+	}
+
+	std::vector<std::string> defaultArgs;
+	if (root.IsMap() && root["defaults"].IsMap()) {
+		manifestArgs(root["defaults"], defaultArgs);
+	}
+	std::vector<std::string> commonArgs;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-batch") == 0) {
+			i++;
+			continue;
+		}
+		commonArgs.push_back(argv[i]);
+	}
+
+	// concurrency and resource limits of the whole batch
+	int numJobs = 1;
+	size_t maxMemoryMB = 0;
+	size_t maxOpenFiles = ResourceBudget::defaultFileLimit();
+	char* pStr = getCmdOption(argv, argv + argc, "-jobs");
+	if (pStr != NULL)
+	{
+		numJobs = atoi(pStr);
+		if (numJobs < 1) {
+			std::cout << "Please use 1 or more jobs" << std::endl;
+			return -1;
+		}
+	}
+	pStr = getCmdOption(argv, argv + argc, "-max-memory");
+	if (pStr != NULL)
+	{
+		maxMemoryMB = (size_t)atoll(pStr);
+	}
+	pStr = getCmdOption(argv, argv + argc, "-max-open-files");
+	if (pStr != NULL)
+	{
+		maxOpenFiles = (size_t)atoll(pStr);
+	}
+
+	struct JobResult {
+		std::string name;
+		int status;
+		int worker;
+		double seconds;
+	};
+	std::vector<TranscodeJob> parsedJobs(jobs.Size());
+	std::vector<JobResult> results(jobs.Size());
+
+	// options are parsed up front, on one thread
+	Mach1Transcode<float> formatLookup;
+	for (size_t i = 0; i < jobs.Size(); i++) {
+		// getCmdOption takes the first match, so job options win over defaults
+		std::vector<std::string> args(1, argv[0]);
+		if (jobs[i].IsMap()) {
+			manifestArgs(jobs[i], args);
+		}
+		args.insert(args.end(), defaultArgs.begin(), defaultArgs.end());
+		args.insert(args.end(), commonArgs.begin(), commonArgs.end());
+		std::vector<char*> jobArgv;
+		for (size_t a = 0; a < args.size(); a++) {
+			jobArgv.push_back(&args[a][0]);
+		}
+
+		TranscodeJob& job = parsedJobs[i];
+		results[i].status = -1;
+		results[i].worker = -1;
+		results[i].seconds = 0.0;
+		try {
+			if (parseJobOptions((int)jobArgv.size(), jobArgv.data(), formatLookup, job) == 0) {
+				results[i].status = 1; // queued
+			} else {
+				std::cout << "Batch Job:          " << i + 1 << "/" << jobs.Size() << " has invalid options" << std::endl;
+			}
+		} catch (const std::exception& e) {
+			cerr << "Error: batch job " << i + 1 << ": " << e.what() << std::endl;
+		}
+		results[i].name = job.outfilename.empty() ? (job.inFiles.empty() ? "?" : job.inFiles[0]) : job.outfilename;
+	}
+
+	ResourceBudget memoryBudget(maxMemoryMB * 1024 * 1024);
+	ResourceBudget fileBudget(maxOpenFiles);
+	std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+	long long steals = 0;
+	int numConversions = 0;
+	{
+		// one session, and so one set of transcoders and buffers, per worker
+		std::vector<std::unique_ptr<TranscodeSession>> sessions;
+		for (int w = 0; w < numJobs; w++) {
+			sessions.emplace_back(new TranscodeSession());
+			sessions.back()->memoryBudget = maxMemoryMB > 0 ? &memoryBudget : nullptr;
+			sessions.back()->fileBudget = maxOpenFiles > 0 ? &fileBudget : nullptr;
+		}
+
+		WorkStealingPool pool(numJobs);
+		for (size_t i = 0; i < parsedJobs.size(); i++) {
+			if (results[i].status != 1) continue;
+			pool.submit([&, i](int worker) {
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				std::cout << "Batch Job:          " << i + 1 << "/" << parsedJobs.size() << std::endl << std::endl;
+				int status = -1;
+				try {
+					status = runTranscodeJob(parsedJobs[i], *sessions[worker]);
+				} catch (const std::exception& e) {
+					cerr << "Error: batch job " << i + 1 << ": " << e.what() << std::endl;
+				}
+				results[i].status = status;
+				results[i].worker = worker;
+				results[i].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				std::cout << std::endl;
+			});
+		}
+		pool.wait();
+		steals = pool.getNumSteals();
+		for (size_t w = 0; w < sessions.size(); w++) {
+			numConversions += (int)sessions[w]->getNumConversions();
+		}
+	}
+
+	int failed = 0;
+	std::cout << "Batch Results:" << std::endl;
+	for (size_t i = 0; i < results.size(); i++) {
+		if (results[i].status != 0) failed++;
+		printf("  %4d %-7s %8.2fs  worker %-3d %s\r\n", (int)i + 1, results[i].status == 0 ? "ok" : "FAILED", results[i].seconds, results[i].worker, results[i].name.c_str());
+	}
+	double batchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+	printf("Batch Summary:      %d jobs, %d ok, %d failed, %d workers, %lld steals, %d conversion setups, %.2fs\r\n", (int)results.size(), (int)results.size() - failed, failed, numJobs, steals, numConversions, batchSeconds);
+	if (maxMemoryMB > 0) {
+		printf("Peak Buffers:       %.1fMB of %dMB\r\n", memoryBudget.getPeak() / (1024.0 * 1024.0), (int)maxMemoryMB);
+	}
+	return failed == 0 ? 0 : -1;
+}
+
+int main(int argc, char* argv[]) {
+	//=================================================================
+	// read command line parameters
+	//
+
+	char *pStr;
+	if (cmdOptionExists(argv, argv + argc, "-h")
+		|| cmdOptionExists(argv, argv + argc, "-help")
+		|| cmdOptionExists(argv, argv + argc, "--help")
+		|| argc == 1)
+	{
+		printHelp();
+		return 0;
+	}
+    if (cmdOptionExists(argv, argv + argc, "-f")
+        || cmdOptionExists(argv, argv + argc, "-formats")
+        || cmdOptionExists(argv, argv + argc, "-format-list")
+        || cmdOptionExists(argv, argv + argc, "--formats")
+        || argc == 1)
+    {
+        printFormats();
+        return 0;
+    }
+	// with the audio on stdout everything printed goes to stderr
+	pStr = getCmdOption(argv, argv + argc, "-out-file");
+	if (pStr && strcmp(pStr, "-") == 0)
+	{
+		StreamWavWriter::claimStdout();
+	}
+	pStr = getCmdOption(argv, argv + argc, "-batch");
+	if (pStr && (strlen(pStr) > 0))
+	{
+		return runBatch(pStr, argc, argv);
+	}
+
+	Mach1Transcode<float> m1transcode;
+	TranscodeJob job;
+	if (parseJobOptions(argc, argv, m1transcode, job) != 0) {
+		return -1;
+	}
+	std::cout << std::endl;
+
+	TranscodeSession session;
+	return runTranscodeJob(job, session);
+}